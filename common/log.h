@@ -42,6 +42,12 @@
 #define TOOLBAR_ON       0 
 #define PLUGIN_ON        1
 
+// Binary trace events (see trace_events.h), by level:
+// 0 none, 1 render stages, 2 also every call of the poppler-like shim.
+#define TRACE_EVENTS_LEVEL  1
+#define TRACE_STAGE         1
+#define TRACE_DETAIL        2
+
 #if (LOGGING_ON)
 #define LOGPRINTF(x, ...) fprintf(stderr, "(LOG)" __FILE__ ":%d,%s() " x "\n", __LINE__, __FUNCTION__ , ##__VA_ARGS__)
 #else
@@ -102,4 +108,25 @@
 #define TBPRINTF(x, ...) do {} while (0)
 #endif
 
+#ifdef __cplusplus
+#include "trace_events.h"
+
+#define TRACE_EVENT_CONCAT_(a, b) a ## b
+#define TRACE_EVENT_CONCAT(a, b) TRACE_EVENT_CONCAT_(a, b)
+
+/// Record a complete event for the rest of the enclosing scope.
+#define TRACE_EVENT_SCOPE(level, name, page, task)                          \
+    trace::Scope<((level) <= TRACE_EVENTS_LEVEL)>                           \
+        TRACE_EVENT_CONCAT(trace_scope_, __LINE__)((name), (page), (task))
+
+/// Record an instant event.
+#define TRACE_EVENT_INSTANT(level, name, page, task)                        \
+    do {                                                                    \
+        if ((level) <= TRACE_EVENTS_LEVEL)                                  \
+        {                                                                   \
+            trace::record((name), trace::now(), -1, (page), (task));        \
+        }                                                                   \
+    } while (0)
+#endif
+
 #endif // PLUGIN_TEXT_LOG_H
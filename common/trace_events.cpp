@@ -0,0 +1,183 @@
+/*
+ * File Name: trace_events.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-common.
+ *
+ * uds-plugin-common is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-common is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <glib.h>
+
+#include "log.h"
+#include "trace_events.h"
+
+namespace trace
+{
+
+// Events per thread, must be a power of two.
+static const int RING_SIZE = 4096;
+
+// When a ring has wrapped, or is about to, the writer may be overwriting
+// the oldest slots while we dump. Skip that many of them instead of taking a lock.
+static const int RING_GUARD = 16;
+
+struct Ring
+{
+    volatile gint   head;       ///< Number of events ever written.
+    int             tid;
+    Ring            *next;
+    Event           events[RING_SIZE];
+};
+
+// Rings are never freed: threads come and go, but the plugin only has a
+// few of them and the dump must still see the events of finished ones.
+static Ring * volatile g_rings = 0;
+static __thread Ring *t_ring = 0;
+
+static Ring * thread_ring()
+{
+    if (t_ring == 0)
+    {
+        Ring *ring = new Ring;
+        ring->head = 0;
+        ring->tid  = static_cast<int>(syscall(SYS_gettid));
+
+        // Lock free push onto the list of rings.
+        do
+        {
+            ring->next = g_rings;
+        }
+        while (!g_atomic_pointer_compare_and_exchange(
+            reinterpret_cast<volatile gpointer *>(&g_rings), ring->next, ring));
+        t_ring = ring;
+    }
+    return t_ring;
+}
+
+long long now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void record(const char *name, long long ts, int dur, int page, unsigned task)
+{
+    Ring *ring = thread_ring();
+    gint head = ring->head;
+    Event & e = ring->events[head & (RING_SIZE - 1)];
+    e.ts   = ts;
+    e.dur  = dur;
+    e.page = page;
+    e.task = task;
+    e.name = name;
+
+    // Publish after the slot is written, the dumper reads head first.
+    g_atomic_int_set(&ring->head, head + 1);
+}
+
+// Write a string without its quotes, escaped for JSON
+static void write_json_string(FILE *fp, const char *str)
+{
+    for (const char *c = str; *c != 0; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(fp, "\\%c", *c);
+        }
+        else if (static_cast<unsigned char>(*c) < 0x20)
+        {
+            fprintf(fp, "\\u%04x", static_cast<unsigned char>(*c));
+        }
+        else
+        {
+            fputc(*c, fp);
+        }
+    }
+}
+
+bool dump_chrome_json(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == 0)
+    {
+        ERRORPRINTF("Cannot write trace to %s", path);
+        return false;
+    }
+
+    int pid = static_cast<int>(getpid());
+    bool first = true;
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (Ring *ring = static_cast<Ring *>(g_atomic_pointer_get(
+             reinterpret_cast<volatile gpointer *>(&g_rings)));
+         ring != 0; ring = ring->next)
+    {
+        gint head = g_atomic_int_get(&ring->head);
+        // the slots the writer may reach while we read are skipped, once
+        // the ring is about to wrap
+        gint begin = 0;
+        if (head >= RING_SIZE - RING_GUARD)
+        {
+            begin = head - RING_SIZE + RING_GUARD;
+        }
+
+        for (gint i = begin; i < head; ++i)
+        {
+            const Event & e = ring->events[i & (RING_SIZE - 1)];
+            if (e.name == 0)
+            {
+                continue;
+            }
+            fprintf(fp, "%s{\"name\":\"", first ? "" : ",\n");
+            write_json_string(fp, e.name);
+            fprintf(fp, "\",\"cat\":\"djvu\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,",
+                    pid, ring->tid, e.ts);
+            if (e.dur >= 0)
+            {
+                fprintf(fp, "\"ph\":\"X\",\"dur\":%d,", e.dur);
+            }
+            else
+            {
+                fprintf(fp, "\"ph\":\"i\",\"s\":\"t\",");
+            }
+            fprintf(fp, "\"args\":{\"page\":%d,\"task\":%u}}", e.page, e.task);
+            first = false;
+        }
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(fp) == 0;
+}
+
+void dump_if_requested()
+{
+    const char *path = getenv("UDS_PLUGIN_TRACE");
+    if (path && *path)
+    {
+        dump_chrome_json(path);
+    }
+}
+
+}   // namespace trace
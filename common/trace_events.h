@@ -0,0 +1,96 @@
+/*
+ * File Name: trace_events.h
+ */
+
+/*
+ * This file is part of uds-plugin-common.
+ *
+ * uds-plugin-common is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-common is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#ifndef PLUGIN_TRACE_EVENTS_H
+#define PLUGIN_TRACE_EVENTS_H
+
+// Binary trace events, recorded into per-thread ring buffers. Use the
+// TRACE_EVENT_* macros from log.h instead of calling this directly, so
+// that events above TRACE_EVENTS_LEVEL are compiled out.
+
+namespace trace
+{
+
+/// One recorded event. name must be a string literal, only the pointer
+/// is stored.
+struct Event
+{
+    long long   ts;         ///< Start time, monotonic microseconds.
+    int         dur;        ///< Duration in us, -1 for instant events.
+    int         page;
+    unsigned    task;
+    const char  *name;
+};
+
+/// Monotonic clock in microseconds.
+long long now();
+
+/// Append an event to the ring buffer of the calling thread. Never
+/// blocks, the oldest events are overwritten when the ring is full.
+void record(const char *name, long long ts, int dur, int page, unsigned task);
+
+/// Write all buffered events of all threads as Chrome trace JSON
+/// (chrome://tracing, Perfetto). Returns false if path can't be written.
+bool dump_chrome_json(const char *path);
+
+/// Dump to the file named by UDS_PLUGIN_TRACE, if that is set.
+void dump_if_requested();
+
+/// Records a complete event covering the lifetime of the object. The
+/// disabled variant is empty, so that scopes above the compiled trace
+/// level cost nothing.
+template <bool enabled>
+class Scope
+{
+public:
+    Scope(const char *name, int page, unsigned task)
+        : name_(name), page_(page), task_(task), start_(now())
+    {
+    }
+
+    ~Scope()
+    {
+        long long end = now();
+        record(name_, start_, static_cast<int>(end - start_), page_, task_);
+    }
+
+private:
+    const char  *name_;
+    int         page_;
+    unsigned    task_;
+    long long   start_;
+};
+
+template <>
+class Scope<false>
+{
+public:
+    Scope(const char *, int, unsigned) {}
+};
+
+};  // namespace trace
+
+#endif // PLUGIN_TRACE_EVENTS_H
@@ -60,6 +60,19 @@ public:
         }
     }
 
+    /// Wait at most usec microseconds, return false on timeout
+    bool timed_wait(GMutex* m, long long usec)
+    {
+        if (m == 0)
+        {
+            return false;
+        }
+        GTimeVal end;
+        g_get_current_time(&end);
+        g_time_val_add(&end, static_cast<glong>(usec));
+        return g_cond_timed_wait(cond_, m, &end) != FALSE;
+    }
+
 private:
     GCond*   cond_;
 };
@@ -0,0 +1,138 @@
+/*
+ * File Name: pdf_bitmap_ops.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#ifndef PDF_BITMAP_OPS_H_
+#define PDF_BITMAP_OPS_H_
+
+#include <math.h>
+#include "pdf_doc.h"
+
+namespace pdf
+{
+
+/// Dithering used when a bitmap is packed to fewer bits per pixel
+typedef enum
+{
+    DITHER_NONE = 0,    ///< round to the nearest level
+    DITHER_ORDERED,     ///< 4x4 Bayer matrix
+    DITHER_DIFFUSION    ///< Floyd-Steinberg error diffusion
+} DitherMode;
+
+/// Grey level post-processing applied to rendered bitmaps, tuned for
+/// e-ink panels. The default settings leave the bitmap untouched.
+struct PostProcessSettings
+{
+    double      gamma;      ///< output = input ^ gamma, above 1 darkens
+    double      contrast;   ///< stretch around mid grey, 1 is unchanged
+    int         darken;     ///< thin stroke darkening, 0 off, 1 light, 2 full
+    int         depth;      ///< output bits per pixel, 24 RGB, 8 or packed 4, 2, 1
+    DitherMode  dither;     ///< dithering when depth is below 8
+
+    PostProcessSettings()
+        : gamma(1.0f)
+        , contrast(1.0f)
+        , darken(0)
+        , depth(8)
+        , dither(DITHER_ORDERED)
+    {}
+
+    bool operator==(const PostProcessSettings &right) const
+    {
+        return (fabs(gamma - right.gamma) < 0.001f &&
+                fabs(contrast - right.contrast) < 0.001f &&
+                darken == right.darken &&
+                depth == right.depth &&
+                (depth >= 8 || dither == right.dither));
+    }
+
+    /// Does the grey level processing change anything, depth aside
+    bool is_identity() const
+    {
+        return (fabs(gamma - 1.0f) < 0.001f &&
+                fabs(contrast - 1.0f) < 0.001f &&
+                darken == 0);
+    }
+
+    /// The supported output depth closest to a color depth set by UDS
+    static int output_depth(unsigned int color_depth)
+    {
+        return color_depth >= 24 ? 24 :
+            (color_depth >= 8 ? 8 : (color_depth >= 4 ? 4 : (color_depth >= 2 ? 2 : 1)));
+    }
+
+    /// Mode of the output bitmaps
+    SplashColorMode output_mode() const
+    {
+        return splashColorModeForBits(depth);
+    }
+
+    /// Mode to ask ddjvu for, see SplashOutputDev::setColorMode. The other
+    /// packed modes are made from grey.
+    SplashColorMode render_mode() const
+    {
+        return depth == 24 ? splashModeRGB8 : (depth == 1 ? splashModeMono1 : splashModeMono8);
+    }
+};
+
+// The kernels are templates over the pixel formats of pdf_pixel_format.h
+// and take bitmaps of any SplashColorMode. They use SSE2 or NEON when the
+// compiler targets them, and plain C otherwise.
+
+/// Scale a bitmap to width x height with bilinear filtering. The result
+/// is 8 bit grey, or RGB for RGB bitmaps. Returns a new bitmap owned by
+/// the caller.
+SplashBitmap * scale_bitmap(SplashBitmap *src, int width, int height);
+
+/// Apply the post-processing to a bitmap in place: gamma and contrast
+/// through a lookup table, then the darkening, a min filter over the
+/// pixel and its four neighbours that thickens thin dark strokes.
+void post_process_bitmap(SplashBitmap *bitmap, const PostProcessSettings &settings);
+
+/// Quantize an 8 bit grey bitmap to mode with dithering, mostly to the
+/// packed grey modes. Returns a new bitmap owned by the caller.
+SplashBitmap * pack_bitmap(SplashBitmap *src, SplashColorMode mode, DitherMode dither);
+
+/// Convert a bitmap of any mode to mode, through 8 bit grey unless the
+/// modes are the same. Returns a new bitmap owned by the caller.
+SplashBitmap * convert_bitmap(SplashBitmap *src, SplashColorMode mode, DitherMode dither);
+
+/// Halve a bitmap in both directions with a 2x2 box filter. The result
+/// is 8 bit grey, or RGB for RGB bitmaps. Returns a new bitmap owned by
+/// the caller, or 0 if src is too small.
+SplashBitmap * halve_bitmap(SplashBitmap *src);
+
+/// Find the content of a page bitmap from its row and column projections.
+/// Pixels darker than threshold are ink. Rows and columns with at most a
+/// noise share of ink are margin, which skips the speckle of scans, and
+/// so are those with nearly all ink, the bars at the edges of scans.
+/// Returns false, leaving the bounds undefined, for a blank bitmap. The
+/// bounds are from (x1, y1) up to (x2, y2), exclusive.
+bool find_content_bounds(SplashBitmap *bitmap, unsigned char threshold, double noise,
+                         int &x1, int &y1, int &x2, int &y2);
+
+};
+
+#endif //PDF_BITMAP_OPS_H_
@@ -0,0 +1,71 @@
+/*
+ * File Name: pdf_content_area_task.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#ifndef PDF_CONTENT_AREA_TASK_H_
+#define PDF_CONTENT_AREA_TASK_H_
+
+#include "task.h"
+
+#include "pdf_define.h"
+
+namespace pdf
+{
+
+class PDFController;
+
+/// @brief The background task finding the content areas of the pages,
+/// for the zoom to crop modes. It handles one page, the visible page
+/// shown whole until its area is known or else the one without an area
+/// nearest to the current page, and posts a new task for the next one.
+/// Rendering and searching abort it, and post it again when done.
+class PDFContentAreaTask : public Task
+{
+public:
+    PDFContentAreaTask(PDFController *ctrl);
+
+    virtual ~PDFContentAreaTask();
+
+    /// execute the task
+    void execute();
+
+    /// get the pointer of PDFController intance
+    void* get_user_data();
+
+    /// there is one content area task for a document
+    unsigned int get_id();
+
+private:
+    // Rendering aborting function
+    static GBool abort_check(void *data);
+
+private:
+    // The reference of document controller
+    PDFController *doc_ctrl;
+};
+
+};
+
+#endif //PDF_CONTENT_AREA_TASK_H_
@@ -0,0 +1,92 @@
+/*
+ * File Name: pdf_content_areas.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+#ifndef PDF_CONTENT_AREAS_H_
+#define PDF_CONTENT_AREAS_H_
+
+#include <vector>
+
+#include "mutex.h"
+#include "pdf_define.h"
+
+namespace pdf
+{
+
+/// @brief The content areas of all pages of a document, as found by the
+/// background content area task. Each page takes 8 bytes, the area is
+/// stored in 1/65535 of the page size. All methods are thread safe.
+class PDFContentAreas
+{
+public:
+    PDFContentAreas();
+    ~PDFContentAreas();
+
+    /// Forget all areas and make room for pages pages.
+    void reset(const int pages);
+
+    /// Get the area of a page, false if it is not known yet.
+    bool get(const int page_number, RenderArea &area);
+
+    /// Store the area of a page.
+    void set(const int page_number, const RenderArea &area);
+
+    /// The page without an area that is nearest to around, 0 if every
+    /// page has its area.
+    int next_missing(const int around);
+
+    /// Does every page have its area.
+    bool is_complete();
+
+    /// Memory held by the table, in bytes.
+    int memory_length();
+
+    /// Take the areas of a sidecar, 4 unsigned shorts per page in the
+    /// order x, y, width, height. Pages with width 0 are left alone.
+    void load(const unsigned short *packed, const int pages);
+
+    /// Get all areas in the layout load takes, returns the number of
+    /// pages that have their area.
+    int dump(std::vector<unsigned short> &packed);
+
+private:
+    struct PackedArea
+    {
+        unsigned short x;
+        unsigned short y;
+        unsigned short width;     ///< 0 if not known
+        unsigned short height;
+    };
+
+private:
+    std::vector<PackedArea> areas;
+    int missing;        ///< pages without an area
+    Mutex mutex;
+};
+
+};
+
+#endif //PDF_CONTENT_AREAS_H_
@@ -12,8 +12,14 @@
 #include <libdjvu/ddjvuapi.h>
 #include <libdjvu/miniexp.h>
 
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
 #include "log.h"
 #include "mutex.h"
+#include "pdf_sidecar.h"
 
 class PDFDoc;
 
@@ -59,6 +65,8 @@ public:
 	}
 	~TextWord() { delete text; }
 	int getLength() { return text->getLength(); }
+	// bytes held by the word, its string counted as if on the heap
+	unsigned int getMemorySize() const { return sizeof(*this) + sizeof(GooString) + text->getLength() + 1; }
 	GooString *getText() { return new GooString(text); }
 	void getBBox(double* xMinA, double* yMinA, double* xMaxA, double* yMaxA) { 
 		// WARNPRINTF("TextWord::getBBox (%s) (%f,%f)-(%f,%f)",text->getCString(),bbox.x1,bbox.y1,bbox.x2,bbox.y2);
@@ -107,6 +115,11 @@ public:
 					  delete[] words; }
 	int getLength() const { /* WARNPRINTF("TextWordList::length: %d", length); */ return length; }
 	TextWord* get(int idx) const { return words[idx]; } // is this correct?
+	unsigned int getMemorySize() const {
+		unsigned int size = sizeof(*this) + length * sizeof(TextWord*);
+		for(int i=0;i<length;i++) size += words[i]->getMemorySize();
+		return size;
+	}
 private:
 	TextWord **words;
 	int length;	
@@ -158,98 +171,133 @@ private:
 	GooString* name;
 };
 
+// a hyperlink of a page, the rectangle in page pixels with the origin at
+// the bottom left, as in the DjVu annotations
 class Link {
 public:
-	void getRect(double *xa1, double *ya1, double *xa2, double *ya2) { WARNPRINTF("Link::getRect"); }
-	GBool inRect(double x, double y) { WARNPRINTF("Link::inRect"); return false; }
-	LinkAction* getAction() { WARNPRINTF("Link::getAction"); return &action; }
+	Link(double xa1, double ya1, double xa2, double ya2, int page) : action(page) {
+		x1 = xa1 < xa2 ? xa1 : xa2;
+		x2 = xa1 < xa2 ? xa2 : xa1;
+		y1 = ya1 < ya2 ? ya1 : ya2;
+		y2 = ya1 < ya2 ? ya2 : ya1;
+	}
+	void getRect(double *xa1, double *ya1, double *xa2, double *ya2) { *xa1 = x1; *ya1 = y1; *xa2 = x2; *ya2 = y2; }
+	GBool inRect(double x, double y) { return x1 <= x && x <= x2 && y1 <= y && y <= y2; }
+	LinkAction* getAction() { return &action; }
 private:
+	Link(const Link &);
+	Link &operator=(const Link &);
+	double x1, y1, x2, y2;
 	LinkGoTo action;
 };
 
 
+// the links of a page, with a grid over the page so that finding the
+// link under a point only looks at the few links of one cell
 class Links {
 public:
-	int getNumLinks() { WARNPRINTF("Links::getNumLinks"); return 0; }
-	Link* getLink(int i) const { WARNPRINTF("Links::getLink"); return 0; }
-	GBool onLink(double x, double y) const { WARNPRINTF("Links::onLink"); return false; }
-};
-
-
-class OutlineItem {
-public:
-	OutlineItem(Unicode* txt, int l, int page, GooList *k) { 
-		//WARNPRINTF("Constructing OutlineItem"); 
-		unic = txt;
-		length = l;
-		kids = k;
-		action = new LinkGoTo(page);
-	}
-	~OutlineItem() { /* WARNPRINTF("Destructing OutlineItem"); */
-		delete[] unic;
-		delete action;
-		deleteGooList(kids,OutlineItem);
-	}
-	LinkAction* getAction() { return action; }
-	Unicode* getTitle() { return unic; }
-	int getTitleLength() { return length; }
-	void open() { /*WARNPRINTF("OutlineItem::open"); */ }
-	void close() { /* WARNPRINTF("OutlineItem::close"); */ }
-	GooList *getKids() { return kids; }
+	// takes over the links; width and height are the page size in pixels
+	Links(std::vector<Link*> &linksA, double width, double height);
+	~Links();
+	int getNumLinks() const { return (int)links.size(); }
+	Link* getLink(int i) const { return i >= 0 && i < (int)links.size() ? links[i] : 0; }
+	GBool onLink(double x, double y) const { return find(x, y) >= 0; }
+	// index of the first link containing (x,y), -1 if there is none
+	int find(double x, double y) const;
+	// bytes held by the links and the grid
+	unsigned int getMemorySize() const;
 private:
-	int length;
-	Unicode *unic;
-	LinkAction *action;
-	GooList *kids;
+	Links(const Links &);
+	Links &operator=(const Links &);
+	int cellOf(double v, double size, int n) const;
+	std::vector<Link*> links;
+	int cols, rows;
+	double cellW, cellH;
+	std::vector<int> cellStart; // cells[c] are cellLinks[cellStart[c]..cellStart[c+1]]
+	std::vector<int> cellLinks; // link indices, ascending within a cell
 };
 
 
+// the outline: the items in preorder in one array, all titles as UTF-8
+// in one buffer. It is built once, in linear time, and only read after
+// it has been published.
 class Outline {
 public:
-	Outline(GooList* aItems) {
-		items = aItems;
-		kids = 0;
+	struct Item {
+		gint32 page;        // destination page, 1 based
+		gint32 parent;      // -1 for the top level
+		gint32 firstChild;  // -1 if none
+		gint32 nextSibling; // -1 if last
+		gint32 title;       // offset in the title buffer
+		gint32 titleLength; // in bytes, without the nul
+	};
+	Outline() { tails.push_back(-1); }
+	int getLength() const { return (int)items.size(); }
+	const Item& getItem(int i) const { return items[i]; }
+	const char* getTitle(int i) const { return &titles[items[i].title]; }
+	// first top level item, -1 for an empty outline
+	int getFirst() const { return items.empty() ? -1 : 0; }
+	// add an item as the last child of parent (-1: the top level) and
+	// return its index. Items must be added in preorder.
+	int append(int parent, int page, const char *title, int length);
+	// the sidecar form: item count, title buffer size, the items, the titles
+	void serialize(std::string &out) const;
+	static Outline* load(const char *data, unsigned int size);
+	unsigned int getMemorySize() const {
+		return sizeof(*this) + items.capacity() * sizeof(Item) + titles.capacity() + tails.capacity() * sizeof(gint32);
 	}
-	~Outline() { deleteGooList(items, OutlineItem); }
-	GooList *getItems() { return items; }
-	void open() { }
-	void close() { }
-	GooList *getKids() { /* return kids; */ return 0; }
 private:
-	GooList *items;
-	GooList *kids; // 0 if no kids?
+	std::vector<Item> items;
+	std::vector<char> titles;
+	std::vector<gint32> tails; // last child of every parent, [0] the top level
 };
 
 
 
-enum SplashColorMode { splashModeMono8 };
+// Mono4, Mono2 and Mono1 are packed grey, leftmost pixel in the high bits.
+// RGB8 is 8 bits per channel, three bytes per pixel.
+enum SplashColorMode { splashModeMono8, splashModeMono4, splashModeMono2, splashModeMono1, splashModeRGB8 };
 typedef Guchar *SplashColorPtr;
 
-// only gray8 color model supported
+// bits per pixel of a color mode
+int splashColorModeBits(SplashColorMode mode);
+// the color mode with this many bits per pixel, 24 is RGB and the others grey
+SplashColorMode splashColorModeForBits(int bits);
+
+// the kernels that work on the pixels are templates over pdf_pixel_format.h
 class SplashBitmap {
 public:
-	SplashBitmap(int w, int h);
+	SplashBitmap(int w, int h, SplashColorMode mode = splashModeMono8);
 	~SplashBitmap() { delete[] data; }
 	int getWidth() { return w; }
 	int getHeight() { return h; }
-	void getPixel(int x, int y, SplashColorPtr pxl) { pxl[0] = data[x+w*y]; }
+	SplashColorMode getMode() { return mode; }
+	int getDepth() { return splashColorModeBits(mode); }
 	int getRowSize() { return rowSize; }
 	SplashColorPtr getDataPtr() { return data; }
 private:
 	int w;
 	int h;
+	SplashColorMode mode;
 	int rowSize;
 	SplashColorPtr data;
 };
 
 class OutputDev {
 public:
-	OutputDev() { WARNPRINTF("Creating OutputDev");  }
+	OutputDev() { WARNPRINTF("Creating OutputDev"); abortCheckCbk = 0; abortCheckCbkData = 0; aborted = gFalse; }
 	virtual ~OutputDev() { WARNPRINTF("Destructing OutputDev");  }
 	void startDoc(XRef *xref) { WARNPRINTF("OutputDev::startDoc"); } // unused, so no need for virtual
 	virtual void renderPage(int page, PDFDoc *doc, double hDPI, double vDPI, int rotate, GBool useMediaBox, GBool crop, GBool printing) = 0;
+	// abort check used by renderPage between its steps, set by PDFDoc::displayPage
+	void setAbortCheck(GBool (*cbk)(void *data), void *data) { abortCheckCbk = cbk; abortCheckCbkData = data; aborted = gFalse; }
+	GBool wasAborted() { return aborted; }
+protected:
+	GBool checkAbort() { if(abortCheckCbk && abortCheckCbk(abortCheckCbkData)) aborted = gTrue; return aborted; }
 private:
-
+	GBool (*abortCheckCbk)(void *data);
+	void *abortCheckCbkData;
+	GBool aborted;
 };
 
 class SplashOutputDev : public OutputDev {
@@ -257,6 +305,12 @@ public:
 	SplashOutputDev(SplashColorMode colorModeA, int bitmapRowPadA,
 					GBool reverseVideoA, SplashColorPtr paperColorA) : OutputDev() {
 						bmp = 0;
+						colorMode = colorModeA;
+						bitonal = gFalse;
+						cacheDecoded = gTrue;
+						decodeCached = gFalse;
+						decodeTime = 0;
+						rasterTime = 0;
 						defCtm[0] = 1.0;
 						defCtm[1] = 0.0;
 						defCtm[2] = 0.0;
@@ -275,9 +329,35 @@ public:
 	double* getDefICTM() { return defIctm; }
 	SplashBitmap* takeBitmap();
 	virtual void renderPage(int page, PDFDoc *doc, double hDPI, double vDPI, int rotate, GBool useMediaBox, GBool crop, GBool printing);
+	// size of the bitmap renderPage produces at these settings
+	static void getBitmapSize(PDFDoc *doc, int page, double hDPI, double vDPI, int *w, int *h);
+	// time spent in decoding and ddjvu_page_render by the last renderPage, in us
+	int getDecodeTime() { return decodeTime; }
+	int getRasterTime() { return rasterTime; }
+	// renderPage produces Mono8 or RGB8 bitmaps, and Mono1 for text only
+	// pages at full resolution. Mono1 asks for 1 bit output, then text
+	// only pages are Mono1 at any resolution.
+	void setColorMode(SplashColorMode mode) { colorMode = mode; }
+	SplashColorMode getColorMode() { return colorMode; }
+	// keep pages decoded by renderPage in the decoded pages cache. Off for
+	// the background thumbnails, which would push the pages being read out.
+	void setCacheDecoded(GBool cache) { cacheDecoded = cache; }
+	// was the last page rendered as a 1 bit mask
+	GBool isBitonal() { return bitonal; }
+	// did the last renderPage find its page decoded already
+	GBool wasDecodeCached() { return decodeCached; }
 private:
 	void setBitmap(SplashBitmap *b) { if(bmp) delete bmp; bmp = b; }
-	double defCtm[6];  // coordinate transform matrix
+	// page pixels (origin bottom left, as the links) to bitmap pixels:
+	// scaled by sx and sy, flipped over height h and shifted left by x0
+	void setDefCTM(double sx, double sy, double x0, double h);
+	SplashColorMode colorMode;
+	GBool bitonal;
+	GBool decodeCached;
+	GBool cacheDecoded;
+	int decodeTime;
+	int rasterTime;
+	double defCtm[6];  // coordinate transform matrix, set by renderPage
 	double defIctm[6]; // inverse coordinate transform matrix
 	//void setBitmap(SplashBitmap *b) { if(bmp) delete bmp; bmp = b; }
 	SplashBitmap *bmp;
@@ -289,6 +369,7 @@ public:
 	TextPage(TextWordList* w) { wl = w; }
 	~TextPage() { delete wl; }
 	TextWordList *makeWordList(GBool physLayout) { return new TextWordList(*wl); } // fixme should this create a copy?
+	unsigned int getMemorySize() const { return sizeof(*this) + (wl ? wl->getMemorySize() : 0); }
 private:
 	TextWordList *wl;
 };
@@ -320,63 +401,84 @@ class Annot {
 
 class PDFDoc {
 public:	
-	PDFDoc(GooString *fileNameA);
+	// page sizes and the outline are taken from the sidecar when it has them
+	PDFDoc(GooString *fileNameA, const pdf::PDFSidecar *sidecarA = 0);
 	~PDFDoc();
-	GBool isOk() { WARNPRINTF("PDFDoc::isOk"); return ok; }
+	GBool isOk() { TRACE_EVENT_INSTANT(TRACE_DETAIL, "PDFDoc::isOk", -1, 0); return ok; }
 	int getNumPages() { 
 		if(twoPageMode) return 2*nPages;
 		return nPages;
 	}
+	// the page geometry getters never block: until the info of a page is
+	// loaded they give an estimate, see getPageInfo
 	double getPageCropWidth(int page) {
 		if(twoPageMode) page = (page+1) / 2;
-		refreshPage(page-1);
-		/* if(pageRotations[page-1] != 0) {
-			return 72.0 * (double)pageHeights[page-1] / (double)pageDpis[page-1]; // fixme
-		}*/
-		if(twoPageMode) return 0.5 * 72.0 * (double)pageWidths[page-1] / (double)pageDpis[page-1];
-		return 72.0 * (double)pageWidths[page-1] / (double)pageDpis[page-1];
+		const PageInfo &pi = getPageInfo(page-1);
+		if(twoPageMode) return 0.5 * 72.0 * (double)pi.width / (double)pi.dpi;
+		return 72.0 * (double)pi.width / (double)pi.dpi;
 	}
 	double getPageCropHeight(int page) {
 		if(twoPageMode) page = (page+1) / 2;
-		refreshPage(page-1);
-		/*if(pageRotations[page-1] != 0) {
-			return 72.0 * (double)pageWidths[page-1] / (double)pageDpis[page-1];
-		}*/
-		return 72.0 * (double)pageHeights[page-1] / (double)pageDpis[page-1];
+		const PageInfo &pi = getPageInfo(page-1);
+		return 72.0 * (double)pi.height / (double)pi.dpi;
 	}
 	double getPageDPI(int page) {
 		if(twoPageMode) page = (page+1) / 2;
-		refreshPage(page-1);
-		return pageDpis[page-1];
+		return getPageInfo(page-1).dpi;
 	}
 	int getPageHeightPixels(int page) {
 		if(twoPageMode) page = (page+1) / 2;
-		refreshPage(page-1);
-		return pageHeights[page-1];
+		return getPageInfo(page-1).height;
 	}
 	int getPageWidthPixels(int page) {
 		if(twoPageMode) page = (page+1) / 2;
-		refreshPage(page-1);
-		return pageWidths[page-1];  // always whole image!
+		return getPageInfo(page-1).width;  // always whole image!
 	}
 	int getPageRotate(int page) {
 		return 0;                   // present unrotated pages to uds
 	}
 	int getPageRealRotate(int page) {
 		if(twoPageMode) page = (page+1) / 2;
-		refreshPage(page-1);
  // already rotated? (should still use this for annotation coordinates!)
-		return pageRotations[page-1];
+		return getPageInfo(page-1).rotation;
 	} // fixme check value?
-	Links* getLinks(int page) { WARNPRINTF("PDFDoc::getLinks(%d)", page); return 0; } // fixme
-	Links* generateLinks(int page) { WARNPRINTF("PDFDoc::generateLinks(%d)", page); return 0; } // added by iRex, generate links without rendering?
+	// are the page geometry getters exact for this page
+	GBool isPageInfoLoaded(int page) {
+		if(twoPageMode) page = (page+1) / 2;
+		return g_atomic_int_get(&pageInfoReady[page-1]) != 0;
+	}
+	// load the info of a page, the global mutex must be held
+	GBool loadPageInfo(int page);
+	// the same, taking the global mutex itself if the info is missing
+	GBool prefetchPageInfo(int page);
+	// load the info of up to count more pages, for the background task.
+	// Takes the global mutex itself.
+	void loadPageInfos(int count);
+	// has loadPageInfos been through all pages
+	GBool isPageInfoComplete() { return g_atomic_int_get(&nextPageInfo) >= nPages; }
+	// the links of a page, parsed from its annotations the first time and
+	// kept until the document is closed. Owned by PDFDoc. Takes the global
+	// mutex when the page was not parsed yet.
+	Links* getLinks(int page);
+	// bytes held by the links parsed so far and the page names they needed
+	unsigned int getLinksSize() { return (unsigned int)g_atomic_int_get(&linksSize); }
+	// bytes held by the page tables and the outline
+	unsigned int getAuxSize();
 	int findPage(int num, int gen) { 
 		// WARNPRINTF("PDFDoc::findPage(%d, %d)",num,gen); 
 		if(twoPageMode) return 2*num-1; // links in toc are to original DjVu page numbers
 		return num; 
 	} // find page given object id, 0 = not found
 	LinkDest* findDest(GooString *name) { WARNPRINTF("PDFDoc::findDest(\"%s\")",name->getCString()); return 0; } // not a destination	
-	Outline* getOutline() { return outline; }
+	// 0 until loadOutline has built it, unless the sidecar had it
+	Outline* getOutline() { return (Outline*)g_atomic_pointer_get((volatile gpointer*)&outline); }
+	// build the outline, which the constructor leaves out so that the
+	// first page can be shown as soon as the directory is known.
+	// Takes the global mutex itself, call from the worker thread.
+	void loadOutline();
+	GBool isOutlineReady() { return getOutline() != 0; }
+	// the outline and the info of every page are loaded
+	GBool isMetadataReady() { return isOutlineReady() && isPageInfoComplete(); }
 	RenderRet displayPage(OutputDev *out, int page, double hDPI, double vDPI,
 				int rotate, GBool useMediaBox, GBool crop, GBool printing,
 				GBool (*abortCheckCbk)(void *data) = 0,
@@ -388,31 +490,81 @@ public:
 	bool isTwoPageMode() { return twoPageMode; }
 	ddjvu_document_t *getDoc() { return doc; }
 
+	// decoded ddjvu pages are kept in a small cache of their own, so that
+	// rendering a prefetched or re-zoomed page skips the decoding.
+	// pageno is the 0-based DjVu page, the global mutex must be held.
+	ddjvu_page_t *getDecodedPage(int pageno);
+	GBool isPageDecoded(int pageno);
+	// decode a page without caching it, the caller releases it
+	ddjvu_page_t *decodePage(int pageno);
+	// decode a page ahead of rendering, takes the global mutex itself
+	GBool prefetchPage(int page);
+	// cap the decoded pages cache, dropping pages over the new limit.
+	// Both take the global mutex; trimDecodedCache returns the bytes freed.
+	void setDecodedCacheLimit(unsigned int bytes);
+	unsigned int trimDecodedCache(unsigned int limit);
+	unsigned int getDecodedCacheLimit() { return decodedLimit; }
+	// how to render a decoded page: DDJVU_RENDER_BLACK for text only pages,
+	// or what the page annotations ask for. The global mutex must be held.
+	ddjvu_render_mode_t getRenderMode(int pageno, ddjvu_page_t *pg);
+	unsigned int getDecodedCacheSize() { return decodedSize; }
+	// what a new sidecar holds: the page infos read so far and the outline
+	void getSidecarContents(pdf::PDFSidecar::Contents &contents);
+
 private:
-	// should this be mutexed?
-	void refreshPage(int page) { 
-		if(pageWidths[page] == -1) {
-			ddjvu_pageinfo_t pi;
-			ddjvu_document_get_pageinfo(doc,page,&pi);
-			pageWidths[page] = pi.width;
-			pageHeights[page] = pi.height;
-			pageDpis[page] = pi.dpi;
-			pageRotations[page] = pi.rotation;
-			// WARNPRINTF("pageinfo: p: %d, w: %d, h: %d, dpi: %d", page, pi.width, pi.height, pi.dpi);
-		}
+	struct DecodedPage {
+		int pageno;
+		ddjvu_page_t *page;
+		unsigned int size;  // estimated memory use
+	};
+	void trimDecoded(unsigned int limit);
+	std::list<DecodedPage> decoded; // most recently used first
+	unsigned int decodedSize;
+	unsigned int decodedLimit;
+
+	// geometry of a DjVu page, as in ddjvu_pageinfo_t
+	struct PageInfo {
+		int width;
+		int height;
+		int dpi;
+		int rotation;
+	};
+	// The info of a page, 0-based. Entries are written once, then flagged
+	// in pageInfoReady, so readers on any thread see a whole entry or
+	// none. A page without an entry gets the last page loaded, which is
+	// usually the size of its neighbours, or defaultPageInfo.
+	const PageInfo &getPageInfo(int pageno) {
+		if(g_atomic_int_get(&pageInfoReady[pageno])) return pageInfos[pageno];
+		int known = g_atomic_int_get(&lastPageInfo);
+		return known >= 0 ? pageInfos[known] : defaultPageInfo;
 	}
-		
+	// fill and flag an entry, only the thread holding the global mutex
+	// or the constructor publish
+	void publishPageInfo(int pageno, const PageInfo &pi);
+	GBool fetchPageInfo(int pageno);
+
+	// parse the links of a page, the global mutex must be held
+	Links* parseLinks(int page);
+	// the page a "#name" link refers to, 0 if none; mutex held
+	int findPageByName(const char *name);
+
 	GBool twoPageMode; // artificially split pages
 	ddjvu_document_t *doc;
 	int nPages;
 	GBool ok;
 	XRef xref;
-	Outline* outline;
-
-	int *pageWidths; // -1 if info for this page not loaded
-	int *pageHeights;
-	int *pageDpis;
-	int *pageRotations;
+	Outline* volatile outline; // published by loadOutline
+
+	PageInfo *pageInfos;
+	volatile gint *pageInfoReady; // 1 once the entry is filled
+	volatile gint lastPageInfo; // the entry last filled, -1 if none
+	volatile gint nextPageInfo; // where loadPageInfos goes on
+	PageInfo defaultPageInfo;
+	signed char *pageModes; // ddjvu_render_mode_t, -1 if not known yet
+	Links* volatile *pageLinks; // by page as given to getLinks, 0 until parsed
+	std::map<std::string, int> pageNames; // component ids to pages, filled on the first named link
+	GBool pageNamesLoaded;
+	volatile gint linksSize;
 };
 
 #define splashMaxColorComps 4
@@ -35,6 +35,9 @@
 #include "pdf_toc.h"
 #include "pdf_pages_cache.h"
 #include "pdf_collection.h"
+#include "pdf_stats.h"
+#include "pdf_content_areas.h"
+#include "pdf_sidecar.h"
 
 namespace pdf
 {
@@ -50,6 +53,10 @@ public:
     Signal<void, SearchResult, PDFRangeCollection*, unsigned int>
         sig_search_results_ready;
 
+    /// The metadata left out by open has been loaded: the outline, and
+    /// then the exact page sizes
+    Signal<void> sig_metadata_ready;
+
 public:
     PDFController(void);
     ~PDFController(void);
@@ -161,6 +168,28 @@ public:
     /// Clear all of the cached pages
     void clear_cache() { pages_cache.clear(); }
 
+    /// Get the latency histograms and counters of this document
+    PDFStats & get_stats() { return stats; }
+
+    /// Get the content areas found so far by the background task
+    PDFContentAreas & get_content_areas() { return content_areas; }
+
+    /// Queue the next background task: the metadata task until the outline
+    /// and the page infos are loaded, then the content area task. Nothing
+    /// is queued if a background task is queued already, or all is done.
+    /// Thread safe.
+    void post_background_task(long long delay = 0);
+
+    /// Called by the metadata task when it has loaded the outline
+    void outline_loaded();
+
+    /// Called by the metadata task when the exact sizes of all pages have
+    /// replaced the estimated ones
+    void page_infos_loaded();
+
+    /// Called by a background task when it starts running
+    void background_task_started() { g_atomic_int_set(&background_task_queued, 0); }
+
 private:
     // Compare between two anchor parameters
     int compare_anchor_param(const PDFAnchor & first_param,
@@ -178,8 +207,40 @@ private:
     // Clear all cached pages but the locked one
     void clear_cached_bitmaps();
 
-    // Update the memory usage by adding the length of page
-    void update_memory_usage(const int length);
+    // Update the memory usage by adding the length of one category
+    void update_memory_usage(const int length,
+                             const MemoryCategory category = MEMORY_BITMAP);
+
+    // Report what pdf_doc and the content areas hold to the pages cache,
+    // as the links and auxiliary categories
+    void account_document_memory();
+
+    // Drop the text layers of pages with a lower priority than page_num
+    // while the pages cache is over its limit, the bitmaps stay
+    void trim_text(const int page_num);
+
+    // Memory used by the pages cache (bitmaps, text layers, links and
+    // auxiliary data) and the decoded pages
+    int get_memory_usage();
+
+    // Evict down to target bytes: decoded pages first, then text layers
+    // and bitmaps with a lower priority than page_num. Returns the bytes
+    // freed.
+    int shrink_memory(const int target, const int page_num);
+
+    // Memory for decoded pages: the limit and what is used
+    int get_decode_limit();
+    int get_decode_usage();
+
+    // Move memory between the bitmaps and the decoded pages, by their
+    // hit rates since the last rebalance. Cheap when there is nothing to do.
+    void rebalance_memory();
+
+    // Give the bitmaps and the decoded pages their parts of memory_limit
+    bool apply_memory_split();
+
+    // Does length fit in the cache without removing any page
+    bool cache_has_room(const int length) { return pages_cache.has_room(length); }
 
     // Set the current page number
     void set_cur_page_num(const int page_num) { current_page_num = page_num; }
@@ -187,6 +248,9 @@ private:
     // Get the pages cache
     PagesCache & get_pages_cache() { return pages_cache; }
 
+    // Write the sidecar of the document if it learned something new
+    void save_sidecar(std::vector<unsigned short> &areas, int known_areas);
+
 private:
     // The pages cache
     PagesCache pages_cache;
@@ -213,10 +277,43 @@ private:
     // prerender policy
     PDFPrerenderPolicy *prerender_policy;
 
+    // statistics of this document, added up in PDFLibrary
+    PDFStats stats;
+
+    // content areas of all pages, for the zoom to crop modes
+    PDFContentAreas content_areas;
+
+    // is a background task in the queue
+    volatile gint background_task_queued;
+
+    // may background tasks be queued, not while closing
+    volatile gint background_enabled;
+
+    // metadata saved at the previous close, used by pdf_doc
+    PDFSidecar sidecar;
+
+    // the memory UDS gives this document, shared by the bitmaps in the
+    // pages cache and the decoded pages of pdf_doc. 0 until it is set.
+    unsigned int memory_limit;
+
+    // the part of memory_limit for decoded pages, in eighths
+    volatile gint decode_eighths;
+
+    // what was last reported to the pages cache by account_document_memory
+    volatile gint reported_links;
+    volatile gint reported_aux;
+
+    // counters at the last rebalance
+    unsigned int window_bitmap_hits;
+    unsigned int window_bitmap_lookups;
+    unsigned int window_decode_hits;
+    unsigned int window_decode_lookups;
+
     friend class PDFRenderer;
     friend class PDFSearcher;
     friend class PDFPage;
     friend class PDFLibrary;
+    friend class PDFMemoryGovernor;
 };
 
 };
@@ -29,6 +29,8 @@
 
 #include "pdf_thread.h"
 #include "pdf_define.h"
+#include "pdf_stats.h"
+#include "pdf_memory_governor.h"
 
 namespace pdf
 {
@@ -51,6 +53,15 @@ public:
                             const int page_num,
                             const int length);
 
+    /// size libdjvu's cache again, after the memory of a document was split
+    void update_ddjvu_cache() { governor.update_ddjvu_cache(); }
+
+    /// share the memory budget with a document while its file is open.
+    /// The governor reaches into the PDFDoc, so a document must leave
+    /// before it is deleted.
+    void share_memory(PDFController *doc_ptr) { governor.add_document(doc_ptr); }
+    void unshare_memory(PDFController *doc_ptr) { governor.remove_document(doc_ptr); }
+
     /// add new document
     void add_document(PDFController *doc_ptr);
 
@@ -69,6 +80,12 @@ public:
     /// clear all of the render tasks
     void thread_cancel_render_tasks(void *user_data);
 
+    /// get the statistics of all documents
+    PDFStats & get_stats() { return stats; }
+
+    /// write the statistics to the file named by UDS_PLUGIN_STATS, if set
+    void dump_stats_if_requested();
+
 private:
     typedef std::vector<PDFController*> Documents;
     typedef Documents::iterator DocumentsIter;
@@ -83,6 +100,12 @@ private:
     // memory limitation of PDF plugin
     unsigned int size_limit;
 
+    // shares the memory of the system between the documents
+    PDFMemoryGovernor governor;
+
+    // statistics of all documents
+    PDFStats stats;
+
 private:
     PDFLibrary();
     PDFLibrary(const PDFLibrary &right);
@@ -0,0 +1,120 @@
+/*
+ * File Name: pdf_memory_governor.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+#ifndef PDF_MEMORY_GOVERNOR_H_
+#define PDF_MEMORY_GOVERNOR_H_
+
+#include <list>
+#include <string>
+
+#include "mutex.h"
+
+namespace pdf
+{
+
+class PDFController;
+
+/// @brief Shares the memory for bitmaps and decoding between all open
+/// documents and libdjvu's own cache.
+///
+/// The room left in the system is the smaller of MemAvailable and what
+/// the cgroup v2 limits allow, so that the page cache and container
+/// limits are taken into account. Memory pressure reported by PSI shrinks
+/// the budget a step at a time. The budget is divided over the documents
+/// by recency: the document used last may use half of it, the one before
+/// a quarter, and so on. When the budget is exceeded, documents over
+/// their share lose their lowest priority pages one at a time, least
+/// recently used document first.
+///
+/// libdjvu keeps decoded chunks in a cache of the ddjvu context. It gets
+/// what the decode parts of the documents leave unused, and it is the
+/// first to shrink when the budget is exceeded.
+class PDFMemoryGovernor
+{
+public:
+    PDFMemoryGovernor();
+    ~PDFMemoryGovernor();
+
+    /// Start and stop sharing the budget with a document. Removing waits
+    /// for a make_room that may be using the document, adding a document
+    /// twice keeps one entry.
+    void add_document(PDFController *doc);
+    void remove_document(PDFController *doc);
+
+    /// Make room for length more bytes in doc, which becomes the most
+    /// recently used document. Pages of doc with a higher priority than
+    /// page_num are kept. Returns false if the budget is still exceeded
+    /// after evicting everything that may go.
+    bool make_room(PDFController *doc, const int page_num, const int length);
+
+    /// The budget for all documents as of the last sample, in bytes.
+    long long get_budget();
+
+    /// Size the ddjvu context cache again, after the decode parts of the
+    /// documents have changed.
+    void update_ddjvu_cache();
+
+private:
+    // recompute the budget from the system state, usage is what the
+    // documents use now
+    void sample(const long long usage);
+
+    // free memory of the system as MemAvailable sees it, -1 if unknown
+    static long long read_mem_available();
+
+    // room left under the tightest memory.max of our cgroup and its
+    // ancestors, -1 if there is no limit
+    long long read_cgroup_headroom();
+
+    // share of time stalled on memory over the last 10s, in percent
+    int read_pressure();
+
+    // find our cgroup v2 directory, once
+    void find_cgroup();
+
+    // the same as update_ddjvu_cache, with the mutex held
+    void size_ddjvu_cache();
+
+    // pass a new size to ddjvu_cache_set_size if it differs
+    void set_ddjvu_cache(long long bytes);
+
+private:
+    typedef std::list<PDFController *> Documents;
+    typedef Documents::iterator DocumentsIter;
+
+    Documents   docs;           ///< Most recently used first.
+    Mutex       mutex;          ///< Guards docs and the budget.
+    long long   budget;         ///< Bytes all documents may use.
+    long long   ddjvu_cache;    ///< Size given to the ddjvu cache, -1 if never set.
+    long long   sampled_at;     ///< PDFStats::now() of the last sample.
+    std::string cgroup_dir;     ///< Empty if not under cgroup v2.
+    bool        cgroup_checked;
+};
+
+};
+
+#endif // PDF_MEMORY_GOVERNOR_H_
@@ -0,0 +1,66 @@
+/*
+ * File Name: pdf_metadata_task.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#ifndef PDF_METADATA_TASK_H_
+#define PDF_METADATA_TASK_H_
+
+#include "task.h"
+
+#include "pdf_define.h"
+
+namespace pdf
+{
+
+class PDFController;
+
+/// @brief The background task loading what opening a document leaves
+/// out. The first run builds the outline, after which PDFController
+/// tells UDS to ask for the marker trees again. The runs after that load
+/// the page infos a few pages at a time. Each run posts the next one.
+class PDFMetadataTask : public Task
+{
+public:
+    PDFMetadataTask(PDFController *ctrl);
+
+    virtual ~PDFMetadataTask();
+
+    /// execute the task
+    void execute();
+
+    /// get the pointer of PDFController intance
+    void* get_user_data();
+
+    /// there is one metadata task for a document
+    unsigned int get_id();
+
+private:
+    // The reference of document controller
+    PDFController *doc_ctrl;
+};
+
+};
+
+#endif //PDF_METADATA_TASK_H_
@@ -31,6 +31,8 @@
 #include "pdf_anchor.h"
 #include "pdf_searcher.h"
 #include "pdf_observer.h"
+#include "pdf_page_pyramid.h"
+#include "pdf_bitmap_ops.h"
 
 namespace pdf
 {
@@ -49,6 +51,7 @@ public:
         : zoom_setting(attr.zoom_setting)
         , real_zoom_value(attr.real_zoom_value)
         , rotate(attr.rotate)
+        , post_process(attr.post_process)
     {}
 
     ~PDFRenderAttributes() {}
@@ -63,6 +66,7 @@ public:
         zoom_setting = right.zoom_setting;
         real_zoom_value = right.real_zoom_value;
         rotate = right.rotate;
+        post_process = right.post_process;
         return *this;
     }
 
@@ -70,7 +74,8 @@ public:
     {
         return ((fabs(this->zoom_setting - right.zoom_setting) < ZERO_RANGE) &&
                 (fabs(this->real_zoom_value - right.real_zoom_value) < ZERO_RANGE) &&
-                this->rotate == right.rotate);
+                this->rotate == right.rotate &&
+                this->post_process == right.post_process);
     }
 
     void set_zoom_setting(double z) {zoom_setting = z;}
@@ -82,6 +87,9 @@ public:
     void set_real_zoom_value(double z) {real_zoom_value = z;}
     double get_real_zoom_value() const {return real_zoom_value;}
 
+    void set_post_process(const PostProcessSettings &p) {post_process = p;}
+    const PostProcessSettings & get_post_process() const {return post_process;}
+
 private:
     // the zoom setting
     double zoom_setting;
@@ -92,6 +100,9 @@ private:
     // the rotation degree
     int    rotate;
 
+    // the grey level post-processing of the bitmap
+    PostProcessSettings post_process;
+
 };
 
 struct SearchWordRecord
@@ -146,9 +157,13 @@ public:
     bool operator == (const PDFPage &right);
     bool operator == (const PDFRenderAttributes &right);
 
-    /// Destroy the resource of the page
+    /// Destroy the bitmaps of the page, returns the length freed. The
+    /// text layer is kept, it is evicted on its own by destroy_text.
     unsigned int destroy();
 
+    /// Destroy the text layer, returns the length freed
+    unsigned int destroy_text();
+
     ///  Lock the page so that it has the highest priority(cannot
     /// be removed until UDS unlocks it)
     void lock() { b_lock = true; }
@@ -186,6 +201,15 @@ public:
     ///  Get the data length of the bitmap
     unsigned int length();
 
+    ///  Get the memory held by the text layer
+    unsigned int get_text_length() const { return text_length; }
+
+    ///  Estimate the data length of a bitmap rendered at the zoom value,
+    ///  crop width and height are in pixels at zoom 100
+    static unsigned int try_calc_length(const double zoom_value
+                                        , const double crop_width
+                                        , const double crop_height);
+
     ///  Get the data of the bitmap
     const unsigned char* get_bitmap_data();
 
@@ -196,9 +220,39 @@ public:
     ///  Render a splash page by render attributes passed in
     bool render_splash_map(PDFRenderer *renderer, void *abort_data);
 
+    ///  Render a quick preview at the render attributes, scaled from the
+    ///  current bitmap or from a subsampled rendering. The next
+    ///  render_splash_map replaces it.
+    bool render_preview(PDFRenderer *renderer, void *abort_data);
+
+    ///  Is the bitmap a preview that still has to be refined
+    bool is_preview() const { return bitmap != 0 && preview; }
+
+    ///  Keep the bitmap UDS is showing until the next render_splash_map
+    ///  replaces it, as a preview is
+    void keep_as_preview() { preview = bitmap != 0; }
+
+    ///  Can a preview at the attributes be scaled from the current bitmap
+    ///  or a pyramid level
+    bool has_scalable_bitmap(const PDFRenderAttributes &attr) const
+    {
+        return (bitmap != 0 && bitmap_rotate == attr.get_rotate()) ||
+               pyramid.has_level(attr.get_rotate());
+    }
+
+    ///  Rebuild the pyramid levels from the bitmap, if the cache has room
+    ///  for them without evicting anything
+    bool build_pyramid();
+
+    ///  Drop the pyramid levels, returns the length freed
+    unsigned int destroy_pyramid() { return pyramid.clear(); }
+
     ///  Render a text page by render attributes passed in
     bool render_text(PDFRenderer *renderer, bool use_defalt_setting = false);
 
+    ///  Is the text page rendered at the current render attributes
+    bool has_text_at_render_attr() const { return text != 0 && text_at_render_attr; }
+
     // Search functions
     ///  Search in the current PDFPage. Make sure the text page is
     /// rendered before searching
@@ -212,6 +266,15 @@ public:
     ///  Get rendering status
     RenderStatus get_render_status() {return render_status;}
 
+    ///  Record whether the current bitmap was rendered ahead of a request
+    void set_prerendered(bool p) { prerendered = p; shown = false; }
+
+    ///  Record that the bitmap is handed to UDS for display
+    void set_shown();
+
+    ///  Is the bitmap a prerendered one that has never been shown
+    bool is_unused_prerender() const { return bitmap != 0 && prerendered && !shown; }
+
     ///  Get the anchor of (x, y).
     void get_anchor_param_from_coordinates(double x, double y, PDFAnchor &param);
 
@@ -236,11 +299,6 @@ public:
                            const PDFAnchor & end_param,
                            std::string &result);
 
-    /// Get content area of a page.
-    /// The content area should be caculated by the result of a thumbnail rendering
-    bool get_content_area(PDFRenderer *renderer, RenderArea &area);
-    const RenderArea & get_content_area() const { return content_area; }
-
     ///  Translate point from device coordination to user's
     void coordinates_dev_to_user(const double dx, const double dy, 
                                  double *ux, double *uy);
@@ -270,8 +328,8 @@ private:
     void update_bitmap(SplashBitmap *m);
 
     // Destroy render results
-    void destroy_text();
     unsigned int destroy_bitmap();
+    unsigned int destroy_retired_bitmap();
     void destroy_links();
 
     // Search destination string by forward order
@@ -301,16 +359,13 @@ private:
                                 , PluginRangeImpl* &result
                                 , bool forward);
 
-    // Get content area from bitmap
-    bool get_content_from_bitmap(SplashBitmap *bitmap, PDFRectangle &rect);
+    // Pack a rendered 8 bit bitmap to the output depth of the render
+    // attributes, b is replaced
+    SplashBitmap * convert_to_output_depth(SplashBitmap *b);
 
     // Rendering aborting function, dealing with the aborting request
     static GBool abort_render_check(void *data);
 
-    // Try to calculate the size of a page
-    static unsigned int try_calc_length(const double zoom_value
-                                        , const double crop_width
-                                        , const double crop_height);
 
 private:
     ///  page number
@@ -321,9 +376,25 @@ private:
 
     // render result
     SplashBitmap    *bitmap;
+
+    // The bitmap is a scaled preview, and the zoom and rotation it was
+    // rendered at
+    bool            preview;
+    double          bitmap_zoom;
+    int             bitmap_rotate;
+
+    // Reductions of the last full bitmap, they outlive zoom changes
+    PDFPagePyramid  pyramid;
+
+    // A preview replaced by its refinement. UDS may still be reading it,
+    // so it is kept until the page renders again.
+    SplashBitmap    *retired_bitmap;
     Links           *links;
     TextPage        *text;
 
+    // The memory held by text, as accounted in the pages cache
+    unsigned int    text_length;
+
     // Reference of the document
     PDFController   *doc_controller;
 
@@ -336,8 +407,14 @@ private:
     // Reference id of this page
     int ref_id;
 
-    // Content area of a page
-    RenderArea content_area;
+    // The bitmap was rendered by a prerender task, and whether it has
+    // been shown since
+    bool prerendered;
+    bool shown;
+
+    // The text page was rendered at render_attr, not at the default
+    // setting used for searching
+    bool text_at_render_attr;
 
     // CTM and ICTM of a PDF page. It is used for retrieving rectangle of hyperlink
     double ctm[6];
@@ -0,0 +1,83 @@
+/*
+ * File Name: pdf_page_pyramid.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#ifndef PDF_PAGE_PYRAMID_H_
+#define PDF_PAGE_PYRAMID_H_
+
+#include "pdf_bitmap_ops.h"
+
+namespace pdf
+{
+
+/// @brief Power of two reductions of the last full bitmap of a page, like
+/// a mipmap. They survive zoom changes, so that a zoom request can show
+/// the nearest level scaled while the exact bitmap renders.
+class PDFPagePyramid
+{
+public:
+    /// Levels at 1/2 and 1/4 of the bitmap, a third of its length
+    static const int MAX_LEVELS = 2;
+
+    PDFPagePyramid();
+    ~PDFPagePyramid();
+
+    /// Length of the levels build() would create for a bitmap
+    static unsigned int estimate_length(SplashBitmap *bitmap);
+
+    /// Replace the levels by the reductions of a bitmap rendered at zoom
+    /// and rotate. Levels of a packed bitmap are packed the same way,
+    /// with dither. Returns the length of the new levels.
+    unsigned int build(SplashBitmap *bitmap, double zoom, int rotate,
+                       DitherMode dither);
+
+    /// Drop all levels, returns the length freed
+    unsigned int clear();
+
+    /// Length of all levels
+    unsigned int length() const;
+
+    /// Is there a level at the rotation
+    bool has_level(int rotate) const { return count > 0 && level_rotate == rotate; }
+
+    /// Improve the candidate source for rendering at zoom with the levels:
+    /// the smallest one not below zoom, since downscaling keeps detail,
+    /// or else the largest one. Pass best = 0 when there is no candidate.
+    void nearest(double zoom, int rotate, SplashBitmap *&best, double &best_zoom) const;
+
+private:
+    PDFPagePyramid(const PDFPagePyramid &);
+    PDFPagePyramid & operator=(const PDFPagePyramid &);
+
+private:
+    SplashBitmap    *levels[MAX_LEVELS];
+    double          zooms[MAX_LEVELS];
+    int             count;
+    int             level_rotate;
+};
+
+};
+
+#endif //PDF_PAGE_PYRAMID_H_
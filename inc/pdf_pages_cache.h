@@ -32,10 +32,23 @@
 
 #include "pdf_define.h"
 #include "pdf_page.h"
+#include "pdf_stats.h"
 
 namespace pdf
 {
 
+/// What the memory accounted in the pages cache is held by. Bitmaps and
+/// text layers belong to the cached pages and can be evicted, links and
+/// the auxiliary data are held by the document and reported to the cache.
+enum MemoryCategory
+{
+    MEMORY_BITMAP = 0,      ///< bitmaps, previews and pyramid levels
+    MEMORY_TEXT,            ///< text layers of the pages
+    MEMORY_LINKS,           ///< hyperlinks and page names of the document
+    MEMORY_AUX,             ///< outline, page tables, content areas
+    MEMORY_CATEGORY_COUNT
+};
+
 /// PagesCache caches the used PDFPage instances
 class PDFPage;
 class PagesCache
@@ -66,8 +79,31 @@ public:
     /// Get a page
     PagePtr get_page(const size_t idx);
 
-    /// Increase total length by adding the page length
-    void update_mem_usage(const int length);
+    /// Increase total length by adding the length of one category
+    void update_mem_usage(const int length,
+                          const MemoryCategory category = MEMORY_BITMAP);
+
+    /// Does length fit in the cache without removing anything
+    bool has_room(const int length);
+
+    /// Memory used by the cached pages and reported by the document
+    int get_total_length();
+
+    /// Memory used by one category
+    int get_length(const MemoryCategory category);
+
+    /// Mirror the lengths in the memory gauges of stats
+    void set_stats(PDFStats *s) { stats = s; }
+
+    /// Drop pyramid levels, then text layers, then the lowest priority
+    /// pages one at a time, until at most target bytes are used. Pages
+    /// with a higher priority than page_num stay. Returns the number of
+    /// bytes freed.
+    int shrink(const int target, const int page_num = -1);
+
+    /// Drop the text layers of the lowest priority pages until they use
+    /// at most target bytes, the bitmaps stay. Returns the bytes freed.
+    int shrink_text(const int target, const int page_num = -1);
 
     /// Get the mutex, for externally locking the cache
     Mutex & get_mutex() { return cache_mutex; }
@@ -77,6 +113,17 @@ private:
     // otherwise there is only one page in cache and it is locked.
     bool remove_page(const int page_num = -1);
 
+    // drop pyramid levels until length fits, all of them if length < 0.
+    // They go before any bitmap.
+    void drop_pyramids(const int length);
+
+    // drop text layers of pages with a lower priority than page_num,
+    // lowest first, until they use at most target bytes
+    void drop_text(const int target, const int page_num);
+
+    // add delta to the length of a category and to the total
+    void account(const MemoryCategory category, const int delta);
+
 private:
     typedef std::tr1::unordered_map<size_t, PagePtr> Pages;
     typedef Pages::iterator PagesIter;
@@ -85,8 +132,13 @@ private:
     // the size limit
     unsigned int size_limit;
 
-    // the memory cost of current cached pages
+    // the memory cost of current cached pages, all categories together
+    // and by category
     int total_length;
+    int lengths[MEMORY_CATEGORY_COUNT];
+
+    // where the gauges go, 0 if nowhere
+    PDFStats *stats;
 
     // the pages list
     Pages pages;
@@ -0,0 +1,259 @@
+/*
+ * File Name: pdf_pixel_format.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+#ifndef PDF_PIXEL_FORMAT_H_
+#define PDF_PIXEL_FORMAT_H_
+
+#include <string.h>
+#include "pdf_doc.h"
+
+namespace pdf
+{
+
+// Pixel format traits. The bitmap kernels are templates over these, so
+// that every format gets its own inner loop with the packing worked out
+// at compile time. A format provides:
+//   MODE       the SplashColorMode of its bitmaps
+//   BITS       bits per pixel
+//   CHANNELS   bytes per pixel in its sample rows
+//   PACKED     more than one pixel per byte
+//   MAX_LEVEL  number of grey levels minus one
+//   SAMPLE_MODE the mode of a bitmap holding sample rows
+//   grey(row, x)                       grey value 0..255 of a pixel
+//   to_samples(row, tmp, width)        sample row of a bitmap row, either
+//                                      row itself or tmp
+//   from_samples(samples, row, width)  store a sample row, rounding to the
+//                                      nearest level
+//   to_grey(row, out, width)           8 bit grey row of a bitmap row
+//   pack_levels(levels, row, width)    store a row of grey levels
+//                                      0..MAX_LEVEL
+// Samples are 8 bit values the filters can work on: the bytes themselves
+// for Grey8 and RGB24, the grey value of each pixel for the packed formats.
+
+/// 8 bit grey, the format ddjvu renders
+struct Grey8
+{
+    static const SplashColorMode MODE = splashModeMono8;
+    static const SplashColorMode SAMPLE_MODE = splashModeMono8;
+    static const int BITS = 8;
+    static const int CHANNELS = 1;
+    static const bool PACKED = false;
+    static const int MAX_LEVEL = 255;
+
+    static unsigned char grey(const unsigned char *row, int x)
+    {
+        return row[x];
+    }
+
+    static const unsigned char * to_samples(const unsigned char *row,
+                                            unsigned char *,
+                                            int)
+    {
+        return row;
+    }
+
+    static void from_samples(const unsigned char *samples, unsigned char *row, int width)
+    {
+        if (samples != row)
+        {
+            memcpy(row, samples, width);
+        }
+    }
+
+    static void to_grey(const unsigned char *row, unsigned char *out, int width)
+    {
+        memcpy(out, row, width);
+    }
+
+    static void pack_levels(const unsigned char *levels, unsigned char *row, int width)
+    {
+        memcpy(row, levels, width);
+    }
+};
+
+/// Packed grey with B bits per pixel, the leftmost pixel in the most
+/// significant bits and every row starting on a byte
+template <int B, SplashColorMode M>
+struct PackedGrey
+{
+    static const SplashColorMode MODE = M;
+    static const SplashColorMode SAMPLE_MODE = splashModeMono8;
+    static const int BITS = B;
+    static const int CHANNELS = 1;
+    static const bool PACKED = true;
+    static const int PER_BYTE = 8 / B;
+    static const int MAX_LEVEL = (1 << B) - 1;
+    static const int SCALE = 255 / MAX_LEVEL;    ///< exact for 1, 2 and 4 bits
+
+    static int level(const unsigned char *row, int x)
+    {
+        return (row[x / PER_BYTE] >> (8 - B * (x % PER_BYTE + 1))) & MAX_LEVEL;
+    }
+
+    static unsigned char grey(const unsigned char *row, int x)
+    {
+        return static_cast<unsigned char>(level(row, x) * SCALE);
+    }
+
+    static const unsigned char * to_samples(const unsigned char *row,
+                                            unsigned char *tmp,
+                                            int width)
+    {
+        to_grey(row, tmp, width);
+        return tmp;
+    }
+
+    static void from_samples(const unsigned char *samples, unsigned char *row, int width)
+    {
+        for (int x = 0; x < width; x += PER_BYTE)
+        {
+            unsigned char byte = 0;
+            for (int i = 0; i < PER_BYTE; ++i)
+            {
+                int v = (x + i < width) ? samples[x + i] : 255;
+                byte = static_cast<unsigned char>((byte << B) | ((v * MAX_LEVEL + 127) / 255));
+            }
+            row[x / PER_BYTE] = byte;
+        }
+    }
+
+    /// Pack levels 0..MAX_LEVEL
+    static void pack_levels(const unsigned char *levels, unsigned char *row, int width)
+    {
+        for (int x = 0; x < width; x += PER_BYTE)
+        {
+            unsigned char byte = 0;
+            for (int i = 0; i < PER_BYTE; ++i)
+            {
+                byte = static_cast<unsigned char>(
+                    (byte << B) | ((x + i < width) ? levels[x + i] : 0));
+            }
+            row[x / PER_BYTE] = byte;
+        }
+    }
+
+    static void to_grey(const unsigned char *row, unsigned char *out, int width)
+    {
+        int x = 0;
+        for (; x + PER_BYTE <= width; x += PER_BYTE)
+        {
+            unsigned char byte = row[x / PER_BYTE];
+            for (int i = PER_BYTE - 1; i >= 0; --i)
+            {
+                out[x + i] = static_cast<unsigned char>((byte & MAX_LEVEL) * SCALE);
+                byte >>= B;
+            }
+        }
+        for (; x < width; ++x)
+        {
+            out[x] = grey(row, x);
+        }
+    }
+};
+
+typedef PackedGrey<4, splashModeMono4> Grey4;
+typedef PackedGrey<2, splashModeMono2> Grey2;
+typedef PackedGrey<1, splashModeMono1> Mono1;
+
+/// 8 bits per channel RGB, for color screens
+struct RGB24
+{
+    static const SplashColorMode MODE = splashModeRGB8;
+    static const SplashColorMode SAMPLE_MODE = splashModeRGB8;
+    static const int BITS = 24;
+    static const int CHANNELS = 3;
+    static const bool PACKED = false;
+    static const int MAX_LEVEL = 255;
+
+    /// Luma with weights adding up to 256, white stays 255
+    static unsigned char grey(const unsigned char *row, int x)
+    {
+        const unsigned char *p = row + 3 * x;
+        return static_cast<unsigned char>((p[0] * 77 + p[1] * 151 + p[2] * 28) >> 8);
+    }
+
+    static const unsigned char * to_samples(const unsigned char *row,
+                                            unsigned char *,
+                                            int)
+    {
+        return row;
+    }
+
+    static void from_samples(const unsigned char *samples, unsigned char *row, int width)
+    {
+        if (samples != row)
+        {
+            memcpy(row, samples, width * 3);
+        }
+    }
+
+    static void to_grey(const unsigned char *row, unsigned char *out, int width)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            out[x] = grey(row, x);
+        }
+    }
+
+    static void pack_levels(const unsigned char *levels, unsigned char *row, int width)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = levels[x];
+        }
+    }
+};
+
+/// Call kernel.run<Format>() for the format of mode. This is the one
+/// place that maps run time modes to formats, a kernel is a functor with
+/// a member template run and its arguments and result as members.
+template <class Kernel>
+void dispatch_pixel_format(SplashColorMode mode, Kernel &kernel)
+{
+    switch (mode)
+    {
+    case splashModeMono8:
+        kernel.template run<Grey8>();
+        break;
+    case splashModeMono4:
+        kernel.template run<Grey4>();
+        break;
+    case splashModeMono2:
+        kernel.template run<Grey2>();
+        break;
+    case splashModeMono1:
+        kernel.template run<Mono1>();
+        break;
+    case splashModeRGB8:
+        kernel.template run<RGB24>();
+        break;
+    }
+}
+
+};
+
+#endif //PDF_PIXEL_FORMAT_H_
@@ -48,6 +48,21 @@ public:
 
     virtual int get_allowed_hyperlinks_number() = 0;
 
+    /// Generate the pages that are only decoded ahead, after the
+    /// requests list. They are appended to the requests with the lowest
+    /// priority. None by default.
+    virtual void generate_prefetch_list(const int current_page,
+                                        const int total,
+                                        std::vector<size_t> & result) { result.clear(); }
+
+    /// Report how long rendering one page took, in microseconds.
+    /// Called from the working thread.
+    virtual void report_render_cost(long long usec) {}
+
+    /// Set how many bitmaps fit in the pages cache at the current
+    /// render settings, the current page included.
+    virtual void set_page_budget(int pages) {}
+
     void set_prerender(bool prerender_on) { is_prerender = prerender_on; }
     bool support_prerender() const { return is_prerender; }
     PDFRenderRequests & get_requests() { return requests; }
@@ -86,6 +101,68 @@ private:
                             std::vector<size_t> & result);
 };
 
+/// @brief Prerender policy that learns from the reader. It keeps the
+/// time spent on each page, the recent page steps and the cost of a
+/// render. Pages are prerendered in the reading direction (backwards for
+/// right-to-left books), at a repeated jump distance, and only as many
+/// as can be rendered before the next flip is expected and fit in the
+/// page budget.
+class PDFPrerenderPolicyAdaptive : public PDFPrerenderPolicy
+{
+public:
+    PDFPrerenderPolicyAdaptive();
+    virtual ~PDFPrerenderPolicyAdaptive();
+
+    virtual void generate_requests_list(const int current_page,
+                                        const int previous_page,
+                                        const int total,
+                                        std::vector<size_t> & result);
+
+    virtual int get_allowed_hyperlinks_number();
+
+    virtual void generate_prefetch_list(const int current_page,
+                                        const int total,
+                                        std::vector<size_t> & result);
+
+    virtual void report_render_cost(long long usec);
+
+    virtual void set_page_budget(int pages);
+
+private:
+    // Update the reading model by a page flip
+    void add_step(const int step);
+
+    // The direction of reading, 1 forward, -1 backward, 0 undecided
+    int reading_direction() const;
+
+    // A step larger than one that has been repeated, 0 if none
+    int repeated_jump() const;
+
+    // How many pages can be rendered before the next flip
+    int lookahead();
+
+private:
+    static const int HISTORY_SIZE = 8;
+
+    // the latest steps, history[0] is the newest
+    int steps[HISTORY_SIZE];
+    int steps_count;
+
+    // time of the last flip and the average time spent on a page, in us
+    long long last_flip;
+    long long dwell;
+
+    // average render cost in ms, written by the working thread
+    volatile gint render_cost;
+
+    // number of bitmaps that fit in the cache
+    volatile gint page_budget;
+
+    // the direction and furthest offset of the last requests list
+    int last_direction;
+    int last_offset;
+};
+
 };
 
 #endif
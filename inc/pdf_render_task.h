@@ -40,6 +40,14 @@ namespace pdf
 class PDFRenderTask : public Task
 {
 public:
+    /// What the task produces
+    typedef enum
+    {
+        RENDER_BITMAP = 0,  ///< bitmap, links and text
+        RENDER_TEXT_ONLY,   ///< only the text page, for prefetching
+        RENDER_DECODE_ONLY  ///< only decode the DjVu page, for prefetching
+    } RenderMode;
+
     // constructor without existing page
     PDFRenderTask(int page_num,
                   const PDFRenderAttributes &attr,
@@ -65,6 +73,29 @@ public:
     /// get render id
     unsigned int get_id();
 
+    /// set what the task produces, RENDER_BITMAP by default
+    void set_mode(RenderMode m) { mode = m; }
+
+    /// stamp the task with the generation of the visible page request
+    /// it serves, see PDFRenderer::get_generation
+    void set_generation(unsigned int gen) { generation = gen; }
+
+    /// abort the task if a newer visible page request superseded it,
+    /// returns whether the task is aborted. Polled while rendering.
+    bool check_superseded();
+
+    /// remember how the visible page request of this task was classified
+    /// and when it was issued, to account its latency when it is done
+    void set_request(StatsStage outcome, long long issued)
+    {
+        request_outcome = outcome;
+        request_issued = issued;
+    }
+
+    /// the task crops the whole page UDS shows in the render result, it
+    /// holds the reference taken by PDFRenderer::wait_for_content_area
+    void set_refreshing() { refreshing = true; }
+
 private:
     // PDFPage
     PagePtr page;
@@ -84,10 +115,33 @@ private:
     // The pointer of render result(allocated in main thread)
     PluginRenderResultImpl *render_result;
 
+    // What the task produces
+    RenderMode mode;
+
+    // Generation of the visible page request, 0 for prerendering
+    unsigned int generation;
+
+    // Classification and issue time of the visible page request
+    StatsStage request_outcome;
+    long long request_issued;
+
+    // Refreshing the whole page sent before its content area was known
+    bool refreshing;
+
 private:
     // Estimate whether the page is out of date
     bool is_page_out_of_date();
 
+    // Render the text page ahead of the bitmap
+    void prefetch_text(PDFRenderer *renderer);
+
+    // Is the page slow enough to show a preview before the full bitmap
+    bool want_preview();
+
+    // Render a preview and send it to UDS, the full bitmap follows as a
+    // second page ready event for the same render result
+    bool deliver_preview(PDFRenderer *renderer);
+
 };
 
 };//namespace pdf
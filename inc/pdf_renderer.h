@@ -122,7 +122,8 @@ typedef enum RenderStatus_
 {
     TASK_RENDER_DONE = 0,
     TASK_RENDER_OOM,
-    TASK_RENDER_INVALID_PAGE
+    TASK_RENDER_INVALID_PAGE,
+    TASK_RENDER_PREVIEW         ///< a preview, the full bitmap follows
 } RenderStatus;
 
 class PDFController;
@@ -162,6 +163,12 @@ public:
     /// Get the current render attributes
     const PDFRenderAttributes& get_render_attr() { return cur_render_attr; }
 
+    /// Set/get the post-processing of the rendered bitmaps. It is a
+    /// document setting, calc_real_zoom puts it in the attributes of
+    /// every request, so bitmaps processed otherwise are rendered again.
+    void set_post_process(const PostProcessSettings &p) { post_process = p; }
+    const PostProcessSettings & get_post_process() const { return post_process; }
+
     /// Generate a page by input context
     PagePtr gen_page(int page_num, const PDFRenderAttributes &attr);
 
@@ -176,6 +183,41 @@ public:
                            const int height,
                            PluginBitmapAttributes *output);
 
+    /// Find the content area of a page from a thumbnail rendering, or the
+    /// whole page if it can't be rendered. Returns false if abort_check
+    /// stopped the rendering.
+    bool detect_content_area(int page_number,
+                             RenderArea &area,
+                             GBool (*abort_check)(void *data) = 0,
+                             void *abort_data = 0);
+
+    /// Is the page cropped at the render attributes to a content area
+    /// that is not known yet. It is rendered whole meanwhile.
+    bool lacks_content_area(int page_number, const PDFRenderAttributes &attr);
+
+    /// Post the visible page request again once the content area task
+    /// finds the area of the page shown whole. Takes a reference to the
+    /// render result, call it before the result is sent to UDS.
+    void wait_for_content_area(int page_number,
+                               const PDFRenderAttributes &attr,
+                               PluginRenderResultImpl *render_res,
+                               const unsigned int ref_id,
+                               const unsigned int gen);
+
+    /// Get the page waiting for its content area, 0 if there is none
+    int get_cropping_page();
+
+    /// Called when the content area of a page is known
+    void content_area_found(int page_number);
+
+    /// Get the generation of the latest visible page request. A task of
+    /// an older generation has been superseded.
+    unsigned int get_generation() { return static_cast<unsigned int>(g_atomic_int_get(&generation)); }
+
+    /// Estimate the length of the bitmap of a page at the render attributes
+    unsigned int estimate_bitmap_length(int page_num,
+                                        const PDFRenderAttributes &attr);
+
     /// Get the maximum/minimum zoom factor
     static double get_max_zoom() { return MAX_ZOOM; }
     static double get_min_zoom() { return MIN_ZOOM; }
@@ -185,6 +227,9 @@ public:
 
 private:
     // Generate render task without existing page
+    // Drop the page waiting for its content area
+    void cancel_content_area_wait();
+
     PDFRenderTask* gen_render_task(int page_num,
                                    const PDFRenderAttributes &page_attr,
                                    PluginRenderResultImpl *render_res = 0,
@@ -216,6 +261,17 @@ private:
     void post_prerender_task(const size_t page_number,
                              const PDFRenderAttributes &page_attr);
 
+    // Post a task that only prefetches the text of a page
+    void post_prefetch_task(const size_t page_number,
+                            const PDFRenderAttributes &page_attr);
+
+    // Post a task that only decodes a page
+    void post_decode_task(const size_t page_number,
+                          const PDFRenderAttributes &page_attr);
+
+    // Queue a prerender or prefetch task, deferred while flipping
+    void queue_prerender_task(PDFRenderTask *task);
+
     // Post prerender hyperlinks task
     void post_prerender_hyperlinks_task(PagePtr page);
 
@@ -238,9 +294,29 @@ private:
     // default render settings
     PDFRenderAttributes cur_render_attr;
 
+    // post-processing of the document's bitmaps
+    PostProcessSettings post_process;
+
     // the mutex used in rendering
     Mutex render_mutex;
 
+    // generation of the latest visible page request
+    volatile gint generation;
+
+    // the visible page request shown whole until its content area is
+    // known, 0 or null if there is none
+    Mutex crop_mutex;
+    int crop_page;
+    PDFRenderAttributes crop_attr;
+    PluginRenderResultImpl *crop_result;
+    unsigned int crop_ref_id;
+    unsigned int crop_generation;
+
+    // time of the latest visible page request, and the time before
+    // which prerendering does not start
+    long long last_request_time;
+    long long prerender_not_before;
+
     friend class PDFRenderTask;
     friend class PDFPage;
 };
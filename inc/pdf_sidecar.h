@@ -0,0 +1,113 @@
+/*
+ * File Name: pdf_sidecar.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#ifndef PDF_SIDECAR_H_
+#define PDF_SIDECAR_H_
+
+#include <string>
+#include <vector>
+#include <glib.h>
+
+namespace pdf
+{
+
+/// @brief Metadata of a document kept in a file of its own, so that
+/// reopening the document does not ask libdjvu for the page sizes and the
+/// outline again, nor look for the content areas.
+///
+/// The sidecars live in <user cache dir>/uds-djvu, named after a hash of
+/// the document path. A sidecar only matches the document with the same
+/// path, size and modification time. It is memory mapped while the
+/// document is open, the getters read the mapping and are thread safe.
+class PDFSidecar
+{
+public:
+    /// Geometry of one DjVu page, as in ddjvu_pageinfo_t
+    struct PageInfo
+    {
+        gint32 width;       ///< in pixels, 0 if not known
+        gint32 height;
+        gint32 dpi;
+        gint32 rotation;
+    };
+
+    /// What to write into a sidecar
+    struct Contents
+    {
+        std::vector<PageInfo> pages;            ///< every DjVu page
+        std::vector<unsigned short> areas;      ///< 4 per page, see PDFContentAreas
+        std::string outline;                    ///< serialized by PDFDoc
+    };
+
+public:
+    PDFSidecar();
+    ~PDFSidecar();
+
+    /// Map the sidecar of a document. False if it has none, or the
+    /// document changed since it was written.
+    bool open(const char *doc_path);
+
+    /// Unmap the sidecar.
+    void close();
+
+    bool is_open() const { return data != 0; }
+
+    /// Number of DjVu pages and of content areas, 0 if not open
+    int get_page_count() const;
+    int get_area_count() const;
+
+    /// How many pages have their info, and their content area
+    int get_known_pages() const;
+    int get_known_areas() const;
+
+    /// Get the info of a DjVu page, 0 based. False if not known.
+    bool get_page_info(const int pageno, PageInfo &info) const;
+
+    /// The content areas, 4 unsigned shorts per page, 0 if not open
+    const unsigned short * get_content_areas() const;
+
+    /// The serialized outline, 0 if the document has none
+    const char * get_outline(unsigned int &size) const;
+
+    /// Write the sidecar of a document, replacing the old one at once.
+    static bool save(const char *doc_path, const Contents &contents);
+
+private:
+    // The sidecar file of a document, and the identity of the document
+    static bool get_sidecar_path(const char *doc_path,
+                                 std::string &path,
+                                 guint64 &path_hash,
+                                 guint64 &doc_size,
+                                 gint64 &doc_mtime);
+
+private:
+    const char *data;       ///< the mapping
+    size_t size;
+};
+
+};
+
+#endif //PDF_SIDECAR_H_
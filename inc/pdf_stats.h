@@ -0,0 +1,216 @@
+/*
+ * File Name: pdf_stats.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#ifndef PDF_STATS_H_
+#define PDF_STATS_H_
+
+#include <string>
+#include <glib.h>
+
+namespace pdf
+{
+
+/// The timed stages of the render pipeline, followed by the end to end
+/// latency of visible page requests split by how they were served.
+enum StatsStage
+{
+    STAGE_DECODE = 0,       ///< ddjvu page decoding
+    STAGE_RASTER,           ///< ddjvu_page_render
+    STAGE_TEXT,             ///< text extraction
+    STAGE_CONTENT_AREA,     ///< content area detection
+    STAGE_EVICTION,         ///< making memory for a new bitmap
+    STAGE_BROADCAST,        ///< sending the page ready event
+    STAGE_RENDER_TASK,      ///< a whole render task
+    STAGE_REQUEST_PRERENDERED,  ///< served from an unseen prerendered bitmap
+    STAGE_REQUEST_CACHED,       ///< served from a bitmap shown before
+    STAGE_REQUEST_WAITED,       ///< waited for a running prerender
+    STAGE_REQUEST_RENDERED,     ///< rendered on demand
+    STAGE_REQUEST_PREVIEW,      ///< until the preview of a slow page was shown
+    STAGE_COUNT
+};
+
+/// The event counters.
+enum StatsCounter
+{
+    COUNTER_CACHE_HIT = 0,      ///< requested page was ready in cache
+    COUNTER_CACHE_MISS,         ///< requested page had to be rendered
+    COUNTER_EVICTION,           ///< bitmaps dropped from the cache
+    COUNTER_TASK_ABORTED,       ///< renderings aborted half way
+    COUNTER_TASK_SUPERSEDED,    ///< visible page tasks dropped for a newer one
+    COUNTER_PRERENDER_WASTED,   ///< prerender work that was thrown away
+    COUNTER_PAGES_RENDERED,     ///< bitmaps rendered
+    COUNTER_KBYTES_RENDERED,    ///< size of those bitmaps, in KB
+    COUNTER_PRERENDERED,        ///< bitmaps rendered ahead of a request
+    COUNTER_PRERENDER_SHOWN,    ///< prerendered bitmaps that were shown
+    COUNTER_PRERENDER_EVICTED,  ///< ... evicted before being shown
+    COUNTER_PRERENDER_INVALIDATED, ///< ... re-rendered before being shown
+    COUNTER_PREVIEWS,           ///< previews shown ahead of the full bitmap
+    COUNTER_REFINE_ABANDONED,   ///< previews whose refinement was aborted
+    COUNTER_BITONAL_RENDERS,    ///< text only pages rendered as a 1 bit mask
+    COUNTER_CONTENT_AREAS,      ///< content areas found in the background
+    COUNTER_BUDGET_EVICTIONS,   ///< documents shrunk to their memory share
+    COUNTER_DECODE_HIT,         ///< renders that found the page decoded
+    COUNTER_DECODE_MISS,        ///< renders that had to decode the page
+    COUNTER_DECODE_SHARE,       ///< moves of memory between bitmaps and decoding
+    COUNTER_TEXT_EVICTIONS,     ///< text layers dropped from the cache
+    COUNTER_COUNT
+};
+
+/// The gauges: memory held right now, in bytes, by what it holds.
+enum StatsGauge
+{
+    GAUGE_MEMORY_BITMAP = 0,    ///< bitmaps, previews and pyramid levels
+    GAUGE_MEMORY_TEXT,          ///< text layers
+    GAUGE_MEMORY_LINKS,         ///< parsed hyperlinks and page names
+    GAUGE_MEMORY_AUX,           ///< outline, page tables, content areas
+    GAUGE_COUNT
+};
+
+/// @brief Latency histogram with power of two buckets in microseconds.
+/// Adding a sample is a few atomic increments, so it can be left on in
+/// production builds and updated from any thread.
+class LatencyHistogram
+{
+public:
+    /// Bucket i counts samples below 2^i us, the last one the rest (>4s).
+    static const int BUCKETS = 24;
+
+    LatencyHistogram() { reset(); }
+
+    /// Add a sample
+    void add(long long usec);
+
+    /// Clear all samples
+    void reset();
+
+    /// Number of samples
+    unsigned int count() const;
+
+    /// Mean in microseconds, 0 when empty
+    unsigned int mean() const;
+
+    /// Upper bound of the bucket holding the given percentile (0..100)
+    unsigned int percentile(int p) const;
+
+    /// Largest sample in microseconds, saturated at G_MAXINT
+    unsigned int max() const;
+
+private:
+    volatile gint buckets[BUCKETS];
+    volatile gint samples;
+
+    volatile gint max_us;
+
+    // the sum in milliseconds, microseconds would wrap after half an
+    // hour of rendering, and the microseconds below it so that the mean
+    // of short stages is not rounded away
+    volatile gint sum_ms;
+    volatile gint sum_rem_us;
+};
+
+/// @brief Latency histograms and counters of one scope (a document or
+/// the whole library). Every update is forwarded to the parent, so that
+/// the library totals need no separate bookkeeping.
+class PDFStats
+{
+public:
+    explicit PDFStats(PDFStats *parent_stats = 0);
+
+    /// Record the latency of a stage
+    void add_latency(StatsStage stage, long long usec);
+
+    /// Increase a counter
+    void inc(StatsCounter counter, int delta = 1);
+
+    /// Get a counter value
+    unsigned int get_counter(StatsCounter counter) const;
+
+    /// Move a gauge up or down
+    void add_gauge(StatsGauge gauge, int delta);
+
+    /// Get a gauge value
+    int get_gauge(StatsGauge gauge) const;
+
+    /// Get the histogram of a stage
+    const LatencyHistogram & get_histogram(StatsStage stage) const
+    {
+        return stages[stage];
+    }
+
+    /// Get one statistic by name, e.g. "decode.p90" or "cache_hit".
+    /// Histogram fields are count, mean, p50, p90, p99 and max.
+    bool get(const std::string &name, std::string &value) const;
+
+    /// Append all statistics as "name value" lines, each name prefixed
+    /// with the given scope.
+    void dump(const char *scope, std::string &output) const;
+
+    /// Reset this scope only, the parent keeps its totals. Gauges are
+    /// left alone, they describe the present rather than a history.
+    void reset();
+
+    /// Names used by get() and dump()
+    static const char * stage_name(StatsStage stage);
+    static const char * counter_name(StatsCounter counter);
+    static const char * gauge_name(StatsGauge gauge);
+
+    /// Monotonic time in microseconds
+    static long long now();
+
+private:
+    PDFStats(const PDFStats &);
+    PDFStats & operator=(const PDFStats &);
+
+private:
+    PDFStats            *parent;
+    LatencyHistogram    stages[STAGE_COUNT];
+    volatile gint       counters[COUNTER_COUNT];
+    volatile gint       gauges[GAUGE_COUNT];
+};
+
+/// @brief Adds the lifetime of the object to a stage histogram.
+class StatsTimer
+{
+public:
+    StatsTimer(PDFStats &s, StatsStage st)
+        : stats(s), stage(st), start(PDFStats::now())
+    {
+    }
+
+    ~StatsTimer()
+    {
+        stats.add_latency(stage, PDFStats::now() - start);
+    }
+
+private:
+    PDFStats    &stats;
+    StatsStage  stage;
+    long long   start;
+};
+
+};
+
+#endif //PDF_STATS_H_
@@ -79,6 +79,11 @@ private:
     /// @brief Abort current task if thread is executing a task.
     bool abort_current_task(Task *new_task);
 
+    /// @brief Take the first task that may start now. When all tasks are
+    /// deferred, return 0 and set wait_usec to the time until the first
+    /// one may start.
+    Task* take_ready_task(long long &wait_usec);
+
     /// @brief Thread functions.
     static gpointer thread_func(gpointer args);
     gpointer non_static_thread_func();
@@ -32,51 +32,37 @@
 namespace pdf
 {
 
-struct TocItem
-{
-    string anchor;        ///< The anchor.
-    string text;          ///< The display text.
-    string goto_anchor;   ///< The anchor of destination.
-    struct TocItem * sibling;     ///< The next sibling.
-    struct TocItem * first_child; ///< The first child.
-
-    TocItem();
-    ~TocItem();
-
-    bool is_invisible_root();
-    void disconnect();
-};
-
 class PDFController;
+
+/// @brief The table of content on top of the document outline. The
+/// outline is already a compact UTF-8 tree, the anchors are made from it
+/// on request, nothing is copied.
 class PDFToc
 {
 public:
     PDFToc(PDFController *doc);
     ~PDFToc(void);
 
-    // check, get and free table of content
+    /// Check whether the outline is loaded and has any items.
     bool has_toc();
-    TocItem * get_toc(void);
-    void free_toc(TocItem * p_toc);
 
-    bool get_goto_anchor_of_toc_idx(int idx, string & anchor);
-
-private:
-    /// Create a new toc item
-    TocItem * create_new_item(OutlineItem * data, int idx);
+    /// The outline, 0 until it is loaded. The item index is the toc_idx
+    /// of the anchors.
+    Outline * get_outline();
 
-    /// Append children of current toc item to toc tree
-    /// This function will return the first child of the parent
-    void append_toc_children(TocItem * parent, int & idx, GooList * items);
+    /// Get the anchor of a toc item.
+    bool get_anchor_of_toc_idx(int idx, string & anchor);
 
-    /// Get the goto anchor of a toc item
-    bool get_dest_page_of_toc_item(OutlineItem * item, int & page_num);
+    /// Get the anchor of the destination of a toc item.
+    bool get_goto_anchor_of_toc_idx(int idx, string & anchor);
 
-    PDFController *document() { return doc_ctrl; }
+private:
+    // The UDS page of an item. The outline keeps DjVu page numbers,
+    // which differ in two page mode.
+    int get_page_of_item(Outline * outline, int idx);
 
 private:
     PDFController *doc_ctrl;   ///< Reference to the PDFDoc.
-    TocItem *toc;              ///< The result of getting toc.
 };
 
 };
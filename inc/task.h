@@ -38,6 +38,7 @@ enum TaskType
 {
     TASK_RENDER = 0,
     TASK_SEARCH,
+    TASK_BACKGROUND,    ///< low priority work, aborted by any other task
     TASK_INVALID
 };
 
@@ -47,6 +48,7 @@ public:
     /// Constructor of task.
     Task()
         : state(INIT)
+        , not_before(0)
     {
     }
 
@@ -78,6 +80,11 @@ public:
     inline bool is_paused() const { return state == PAUSE; }
     void pause() { state = PAUSE; }
 
+    /// Do not start the task before the given monotonic time in
+    /// microseconds, tasks behind it in the queue may run first
+    void set_not_before(long long usec) { not_before = usec; }
+    long long get_not_before() const { return not_before; }
+
 private:
     inline bool is_finished() const { return state == FINISHED; }
 
@@ -118,6 +125,7 @@ private:
 
 private:
     int       state;          ///< Task state.
+    long long not_before;     ///< Earliest start time, 0 for at once.
     Cond      cancel_cond;    ///< Maybe should use a better name.
 
     friend class Thread;
@@ -0,0 +1,83 @@
+/*
+ * File Name: plugin_doc_statistics.h
+ */
+
+/*
+ * This file is part of uds-plugin-common.
+ *
+ * uds-plugin-common is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-common is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#ifndef PLUGIN_DOC_STATISTICS_H_
+#define PLUGIN_DOC_STATISTICS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "plugin_type.h"
+#include "plugin_unknown.h"
+#include "uds_string.h"
+
+/**
+ * @brief Universal Document Shell Document Statistics interface.
+ * Through IPluginDocStatistics, caller is able to read the latency
+ * histograms and counters the plugin keeps about its rendering pipeline.
+ * This is an optional interface, intended for diagnostics and tuning.
+ */
+typedef struct
+{
+    /**
+     * @brief Get the value of one statistic.
+     * @param thiz IPluginUnknown pointer of document object.
+     * @param name Name of the statistic. Names prefixed by "library."
+     * refer to the totals over all open documents, other names to this
+     * document. Latency names have the form "<stage>.<field>", field is
+     * one of count, mean, p50, p90, p99 or max, in microseconds.
+     * @param value Output buffer for the decimal value.
+     * @return PLUGIN_OK if the statistic exists, otherwise PLUGIN_FAIL.
+     */
+    PluginStatus (* get_statistic)( IPluginUnknown      *thiz,
+                                    const UDSString     *name,
+                                    UDSString           *value );
+
+    /**
+     * @brief Dump all statistics as text, one "name value" per line.
+     * @param thiz IPluginUnknown pointer of document object.
+     * @param output Output buffer.
+     * @return PLUGIN_OK if the dump succeeds.
+     */
+    PluginStatus (* dump_statistics)( IPluginUnknown    *thiz,
+                                      UDSString         *output );
+
+    /**
+     * @brief Reset the statistics of this document. The library totals
+     * are kept.
+     * @param thiz IPluginUnknown pointer of document object.
+     * @return PLUGIN_OK if the reset succeeds.
+     */
+    PluginStatus (* reset_statistics)( IPluginUnknown   *thiz );
+
+} IPluginDocStatistics;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -38,6 +38,7 @@
 #include "plugin_doc_dictionary.h"
 #include "plugin_doc_marker.h"
 #include "plugin_doc_search.h"
+#include "plugin_doc_statistics.h"
 #include "plugin_view.h"
 #include "plugin_view_settings.h"
 #include "plugin_font.h"
@@ -68,6 +68,10 @@ typedef struct
 
      /**
      * @brief Set Color Depth.
+     * Below 8 bits, the rendered bitmaps are packed grey of 4, 2 or 1 bits
+     * per pixel, the leftmost pixel in the most significant bits, and each
+     * row starting on a new byte (see row_stride). From 24 bits on, the
+     * bitmaps are RGB with 8 bits per channel.
      * @param thiz IPluginUnknown pointer of the view object
      * @param Color depth(by bits) to be set.
      * @return TODO. Add return codes here.
@@ -0,0 +1,121 @@
+/*
+ * File Name: call_recorder.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include "call_recorder.h"
+#include "log.h"
+
+namespace utils
+{
+
+static gint64 monotonic_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<gint64>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+CallRecorder & CallRecorder::instance()
+{
+    static CallRecorder recorder;
+    return recorder;
+}
+
+CallRecorder::CallRecorder()
+: fp(0)
+, mutex(0)
+, start(0)
+{
+    const char *path = getenv("UDS_PLUGIN_RECORD");
+    if (path == 0 || *path == 0)
+    {
+        return;
+    }
+
+    fp = fopen(path, "w");
+    if (fp == 0)
+    {
+        ERRORPRINTF("Cannot open call trace %s", path);
+        return;
+    }
+
+    mutex = g_mutex_new();
+    start = monotonic_usec();
+    fprintf(fp, "# uds-plugin call trace 1\n");
+    fflush(fp);
+}
+
+CallRecorder::~CallRecorder()
+{
+    if (fp)
+    {
+        fclose(fp);
+        g_mutex_free(mutex);
+    }
+}
+
+void CallRecorder::record(const char *call, const char *format, ...)
+{
+    if (fp == 0)
+    {
+        return;
+    }
+
+    // Take the time before the lock, so that waiting for another
+    // thread's record does not show up as latency.
+    gint64 now = monotonic_usec() - start;
+
+    g_mutex_lock(mutex);
+    fprintf(fp, "%lld\t%s", static_cast<long long>(now), call);
+    if (format && *format)
+    {
+        fputc('\t', fp);
+        va_list args;
+        va_start(args, format);
+        vfprintf(fp, format, args);
+        va_end(args);
+    }
+    fputc('\n', fp);
+
+    // Flush every record, a trace is most useful when the host crashed.
+    fflush(fp);
+    g_mutex_unlock(mutex);
+}
+
+RecordArg::RecordArg(const char *str)
+{
+    size_t i = 0;
+    for (; str && str[i] && i + 1 < sizeof(buf); ++i)
+    {
+        char c = str[i];
+        buf[i] = (c == '\t' || c == '\n' || c == '\r') ? ' ' : c;
+    }
+    buf[i] = 0;
+}
+
+}   // namespace utils
@@ -0,0 +1,93 @@
+/*
+ * File Name: call_recorder.h
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#ifndef CALL_RECORDER_H_
+#define CALL_RECORDER_H_
+
+#include <stdio.h>
+#include <glib.h>
+
+namespace utils
+{
+
+/// @brief Records the interface calls made by UDS, and the events sent
+/// back to it, into a trace file that tools/uds-replay can play back.
+///
+/// Recording is switched on by setting UDS_PLUGIN_RECORD to the path of
+/// the trace file before the plugin library is created. The trace is a
+/// text file, one record per line:
+///     <microseconds since start> TAB <call> [TAB <argument>]...
+/// Calls are named after the interface method without the _impl suffix,
+/// events sent to UDS are recorded as "event" followed by the event name.
+class CallRecorder
+{
+public:
+    /// Get the recorder, opening the trace file on first use.
+    static CallRecorder & instance();
+
+    /// Quick check, used by RECORD_CALL before formatting anything.
+    static bool enabled() { return instance().fp != 0; }
+
+    /// Write one record. The format produces the tab separated arguments.
+    void record(const char *call, const char *format, ...)
+        __attribute__((format(printf, 3, 4)));
+
+private:
+    CallRecorder();
+    ~CallRecorder();
+
+private:
+    FILE    *fp;
+    GMutex  *mutex;
+    gint64  start;      ///< Monotonic time of the first record, in us.
+};
+
+/// @brief Copy of a string argument that is safe to put in a record,
+/// tabs and newlines are replaced by spaces and long strings are cut.
+class RecordArg
+{
+public:
+    explicit RecordArg(const char *str);
+    const char * c_str() const { return buf; }
+
+private:
+    char buf[512];
+};
+
+};  // namespace utils
+
+/// Record an interface call when recording is enabled. Arguments are
+/// printf style and separated by tabs, e.g.
+///     RECORD_CALL("render", "%s\t%d", utils::RecordArg(anchor).c_str(), ref_id);
+#define RECORD_CALL(call, format, ...)                                      \
+    do {                                                                    \
+        if (utils::CallRecorder::enabled())                                 \
+        {                                                                   \
+            utils::CallRecorder::instance().record(call, format, ##__VA_ARGS__); \
+        }                                                                   \
+    } while (0)
+
+#endif
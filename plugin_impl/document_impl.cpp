@@ -31,6 +31,8 @@
 #include "string_impl.h"
 #include "search_criteria_impl.h"
 #include "pdf_anchor.h"
+#include "pdf_library.h"
+#include "call_recorder.h"
 
 namespace pdf
 {
@@ -87,6 +89,11 @@ PluginDocImpl::PluginDocImpl()
     request_search_all      = request_search_all_impl;
     abort_search            = abort_search_impl;
 
+    // IPluginDocStatistics
+    get_statistic       = get_statistic_impl;
+    dump_statistics     = dump_statistics_impl;
+    reset_statistics    = reset_statistics_impl;
+
     // Initialize interface and object table.
     g_instances_table.add_interface<IPluginUnknown>(this);
     g_instances_table.add_interface<IPluginDocument>(this);
@@ -97,11 +104,16 @@ PluginDocImpl::PluginDocImpl()
     g_instances_table.add_interface<IPluginDocDictionary>(this);
     g_instances_table.add_interface<IPluginDocMarker>(this);
     g_instances_table.add_interface<IPluginDocSearch>(this);
+    g_instances_table.add_interface<IPluginDocStatistics>(this);
 
     // connect to the search ready signal
     doc_ctrl.sig_search_results_ready.add_slot(this
         , &PluginDocImpl::on_search_results_ready);
 
+    // connect to the metadata ready signal
+    doc_ctrl.sig_metadata_ready.add_slot(this
+        , &PluginDocImpl::on_metadata_ready);
+
     // Initialize document attributes map.
     init_doc_attributes();
 }
@@ -109,9 +121,53 @@ PluginDocImpl::PluginDocImpl()
 void PluginDocImpl::init_doc_attributes()
 {
     doc_attr_map.insert(std::make_pair("fixed-page", "yes"));
+
+    // grey level post-processing for e-ink, see PostProcessSettings
+    doc_attr_map.insert(std::make_pair("gamma", "1.0"));
+    doc_attr_map.insert(std::make_pair("contrast", "1.0"));
+    doc_attr_map.insert(std::make_pair("darken", "0"));
+
+    // dithering when the view's color depth is below 8: none, ordered
+    // or diffusion
+    doc_attr_map.insert(std::make_pair("dither", "ordered"));
 	// TODO: set attributes "author", "title", "description"
 }
 
+void PluginDocImpl::apply_post_process_attributes()
+{
+    PostProcessSettings settings;
+    settings.gamma = atof(doc_attr_map["gamma"].c_str());
+    settings.contrast = atof(doc_attr_map["contrast"].c_str());
+    settings.darken = atoi(doc_attr_map["darken"].c_str());
+
+    // ignore nonsense rather than render black pages
+    if (settings.gamma <= 0.0f || settings.gamma > 10.0f)
+    {
+        settings.gamma = 1.0f;
+    }
+    if (settings.contrast <= 0.0f || settings.contrast > 10.0f)
+    {
+        settings.contrast = 1.0f;
+    }
+    settings.darken = std::max(0, std::min(settings.darken, 2));
+
+    const std::string &dither = doc_attr_map["dither"];
+    if (dither == "none")
+    {
+        settings.dither = DITHER_NONE;
+    }
+    else if (dither == "diffusion")
+    {
+        settings.dither = DITHER_DIFFUSION;
+    }
+    else
+    {
+        settings.dither = DITHER_ORDERED;
+    }
+
+    doc_ctrl.get_renderer()->set_post_process(settings);
+}
+
 PluginDocImpl::~PluginDocImpl()
 {
     g_instances_table.remove(this);
@@ -214,6 +270,7 @@ PluginDocImpl::open_impl(IPluginUnknown    *thiz,
 {
     // Check object. 
     PluginDocImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("open", "%s", utils::RecordArg(path->get_buffer(path)).c_str());
     
     // Check document has been opened or not.
     if (instance->doc_ctrl.is_open())
@@ -243,6 +300,7 @@ PluginDocImpl::close_impl(IPluginUnknown   *thiz)
 {
     // Check object. 
     PluginDocImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("close", 0);
     
     // Check document has been opened or not.
     if (!instance->doc_ctrl.is_open())
@@ -263,6 +321,7 @@ PluginDocImpl::create_view_impl(IPluginUnknown   *thiz)
 {
     // Check object. 
     PluginDocImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("create_view", 0);
     
     // Create the view.
     ViewPtr ptr = new PluginViewImpl(instance);
@@ -580,41 +639,49 @@ PluginDocImpl::get_supported_marker_types_impl(IPluginUnknown  *thiz )
     return static_cast<IPluginUnknown *>(collection);
 }
 
+// The outline is in preorder, so a parent is always created before its
+// children. Keeping the last entry of every child list makes each append
+// O(1) and the whole tree a single linear pass.
 void PluginDocImpl::add_toc_children(MarkerEntry * parent, 
-                                     TocItem * item, 
+                                     PDFToc * toc,
                                      const unsigned int uds_private_size)
 {
-    while (item)
+    Outline * outline = toc->get_outline();
+    int count = outline ? outline->getLength() : 0;
+
+    std::vector<MarkerEntry *> entries(count, static_cast<MarkerEntry *>(0));
+    std::vector<MarkerEntry *> tails(count + 1, static_cast<MarkerEntry *>(0));
+    std::string anchor;
+    for (int i = 0; i < count; ++i)
     {
-        // Create a MarkerEntryImpl using item.
-        MarkerEntry * entry = generate_marker_entry(item->anchor, 
-                                                    item->text, 
-                                                    item->goto_anchor,
+        const Outline::Item & item = outline->getItem(i);
+        toc->get_anchor_of_toc_idx(i, anchor);
+        MarkerEntry * entry = generate_marker_entry(anchor,
+                                                    outline->getTitle(i),
                                                     uds_private_size);
 
-        // Insert this item as the last child of the parent.
-        if (!parent->first_child)
+        // Insert this item as the last child of its parent. If the parent
+        // could not be created, its whole subtree is left out.
+        MarkerEntry * owner = item.parent < 0 ? parent : entries[item.parent];
+        if (entry == 0 || owner == 0)
         {
-            parent->first_child = entry;
-        }
-        else
-        {
-            MarkerEntry* cur = parent->first_child;
-            while (cur->sibling)
+            if (entry)
             {
-                cur = cur->sibling;
+                marker_entry_free_recursive(entry);
             }
-            cur->sibling = entry;
+            continue;
         }
-    
-        // Recursively descend over children
-        if (item->first_child)
+        entries[i] = entry;
+        MarkerEntry *& tail = tails[item.parent + 1];
+        if (tail == 0)
         {
-            add_toc_children(entry, item->first_child, uds_private_size);
+            owner->first_child = entry;
         }
-
-        // Next sibling
-        item = item->sibling;
+        else
+        {
+            tail->sibling = entry;
+        }
+        tail = entry;
     }
 }
 
@@ -622,18 +689,18 @@ void PluginDocImpl::add_toc_children(MarkerEntry * parent,
 // 1. Generate the collection object.
 // 2. Add marker tree nodes into the collection.
 // 3. Invoke the callback function registered in listeners list.
-// TODO. Remove the marker tree copy, use the MarkerEntryImpl in PDFToc instead.
+// The entries are made straight from the outline, which is built once in
+// PDFDoc; there is no intermediate copy of the tree.
 PluginStatus 
 PluginDocImpl::request_marker_trees_impl(IPluginUnknown     *thiz, 
                                          const unsigned int uds_private_size )
 {
     PluginDocImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("request_marker_trees", "%u", uds_private_size);
 
     // Retrieve TOC.
     PDFToc * toc = instance->doc_ctrl.get_toc();
-    TocItem * item = toc->get_toc();
-
-    if (item == 0)
+    if (!toc->has_toc())
     {
         return PLUGIN_FAIL;
     }
@@ -646,7 +713,7 @@ PluginDocImpl::request_marker_trees_impl(IPluginUnknown     *thiz,
     PDFMarkerEntries * entries = new PDFMarkerEntries;
 
     // Traverse the whole TOC tree.
-    instance->add_toc_children(root_toc, item, uds_private_size);
+    instance->add_toc_children(root_toc, toc, uds_private_size);
     entries->add(root_toc->first_child);
 
     // Root node is useless, disconnect it with other nodes
@@ -661,6 +728,7 @@ PluginDocImpl::request_marker_trees_impl(IPluginUnknown     *thiz,
     // Notify all listeners.
     PluginEventAttrs event_data;
     event_data.marker_ready.result = static_cast<IPluginUnknown *>(collection);
+    RECORD_CALL("event", "EVENT_MARKER_READY");
     instance->listeners.broadcast(thiz, EVENT_MARKER_READY, &event_data);
 
     return PLUGIN_OK;
@@ -677,12 +745,10 @@ PluginBool PluginDocImpl::has_toc_impl(IPluginUnknown *thiz)
 }
 
 MarkerEntry * PluginDocImpl::generate_marker_entry(const std::string & anchor,
-                                                   const std::string & text,
-                                                   const std::string & goto_anchor,
+                                                   const char * text,
                                                    const unsigned int uds_private_size)
 {
-	WARNPRINTF("generate_marker_entry(%s, %s, %s, %d)", anchor.c_str(), text.c_str(), goto_anchor.c_str(), uds_private_size);
-	MarkerEntry * entry = marker_entry_new(uds_private_size);
+    MarkerEntry * entry = marker_entry_new(uds_private_size);
     if (entry == 0)
     {
         return 0;
@@ -762,8 +828,13 @@ PluginDocImpl::request_search_next_impl(IPluginUnknown      *thiz,
                                         const unsigned int  search_id)
 {
     PluginDocImpl *instance = g_instances_table.get_object(thiz);
-    if (instance->doc_ctrl.search_next(
-        (static_cast<PluginSearchCriteria*>(criteria))->get_data()
+    PDFSearchCriteria & data = static_cast<PluginSearchCriteria*>(criteria)->get_data();
+    RECORD_CALL("request_search_next", "%u\t%s\t%s\t%d\t%d\t%d"
+        , search_id
+        , utils::RecordArg(from_anchor->get_buffer(from_anchor)).c_str()
+        , utils::RecordArg(data.text.c_str()).c_str()
+        , data.case_sensitive, data.match_whole_word, data.forward);
+    if (instance->doc_ctrl.search_next(data
         , from_anchor->get_buffer(from_anchor)
         , search_id))
     {
@@ -778,9 +849,12 @@ PluginDocImpl::request_search_all_impl(IPluginUnknown *thiz,
                                        const unsigned int  search_id)
 {
     PluginDocImpl *instance = g_instances_table.get_object(thiz);
-    if (instance->doc_ctrl.search_all(
-        (static_cast<PluginSearchCriteria*>(criteria))->get_data()
-        , search_id))
+    PDFSearchCriteria & data = static_cast<PluginSearchCriteria*>(criteria)->get_data();
+    RECORD_CALL("request_search_all", "%u\t%s\t%d\t%d\t%d"
+        , search_id
+        , utils::RecordArg(data.text.c_str()).c_str()
+        , data.case_sensitive, data.match_whole_word, data.forward);
+    if (instance->doc_ctrl.search_all(data, search_id))
     {
         return PLUGIN_OK;
     }
@@ -792,6 +866,7 @@ PluginDocImpl::abort_search_impl(IPluginUnknown *thiz,
                                  const unsigned int  search_id)
 {
     PluginDocImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("abort_search", "%u", search_id);
     if (instance->doc_ctrl.abort_search(search_id))
     {
         return PLUGIN_OK;
@@ -799,6 +874,56 @@ PluginDocImpl::abort_search_impl(IPluginUnknown *thiz,
     return PLUGIN_FAIL;
 }
 
+PluginStatus
+PluginDocImpl::get_statistic_impl(IPluginUnknown    *thiz,
+                                  const UDSString   *name,
+                                  UDSString         *value)
+{
+    static const std::string LIBRARY_SCOPE("library.");
+
+    PluginDocImpl *instance = g_instances_table.get_object(thiz);
+    std::string key(name->get_buffer(name));
+    std::string result;
+
+    bool ok = false;
+    if (key.compare(0, LIBRARY_SCOPE.size(), LIBRARY_SCOPE) == 0)
+    {
+        ok = PDFLibrary::instance().get_stats().get(
+            key.substr(LIBRARY_SCOPE.size()), result);
+    }
+    else
+    {
+        ok = instance->doc_ctrl.get_stats().get(key, result);
+    }
+
+    if (!ok)
+    {
+        return PLUGIN_FAIL;
+    }
+    value->assign(value, result.c_str());
+    return PLUGIN_OK;
+}
+
+PluginStatus
+PluginDocImpl::dump_statistics_impl(IPluginUnknown  *thiz,
+                                    UDSString       *output)
+{
+    PluginDocImpl *instance = g_instances_table.get_object(thiz);
+    std::string result;
+    instance->doc_ctrl.get_stats().dump("document", result);
+    PDFLibrary::instance().get_stats().dump("library", result);
+    output->assign(output, result.c_str());
+    return PLUGIN_OK;
+}
+
+PluginStatus
+PluginDocImpl::reset_statistics_impl(IPluginUnknown *thiz)
+{
+    PluginDocImpl *instance = g_instances_table.get_object(thiz);
+    instance->doc_ctrl.get_stats().reset();
+    return PLUGIN_OK;
+}
+
 void PluginDocImpl::on_view_released(ViewPtr view)
 {
     ViewsIter iter = std::find(views.begin(), views.end(), view);
@@ -827,9 +952,22 @@ void PluginDocImpl::on_search_results_ready(SearchResult res
         e = EVENT_SEARCH_ABORTED;
     }
 
+    RECORD_CALL("event", "%s\t%u"
+        , e == EVENT_SEARCH_END ? "EVENT_SEARCH_END" : "EVENT_SEARCH_ABORTED"
+        , search_id);
     listeners.broadcast(this, e, &attrs);
 }
 
+void PluginDocImpl::on_metadata_ready()
+{
+    // the outline was not loaded when UDS asked for the marker trees, or
+    // the page sizes it got were estimated
+    PluginEventAttrs attrs;
+    attrs.marker_ready.result = 0;
+    RECORD_CALL("event", "EVENT_MARKER_OUT_OF_DATE");
+    listeners.broadcast(this, EVENT_MARKER_OUT_OF_DATE, &attrs);
+}
+
 // Define pdf attribute.
 PluginStatus
 PluginDocImpl::get_attribute_impl(IPluginUnknown     *thiz,
@@ -857,6 +995,9 @@ PluginDocImpl::set_attribute_impl(IPluginUnknown     *thiz,
 {
 	// WARNPRINTF("set_attribute_impl(\"%s\",\"%s\")", key->get_buffer(key), value->get_buffer(value));
 	PluginDocImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("set_attribute", "%s\t%s"
+        , utils::RecordArg(key->get_buffer(key)).c_str()
+        , utils::RecordArg(value->get_buffer(value)).c_str());
 
     const char* key_cstr = key->get_buffer(key);
     DocAttrMapIter iter = instance->doc_attr_map.find(key_cstr);
@@ -866,6 +1007,11 @@ PluginDocImpl::set_attribute_impl(IPluginUnknown     *thiz,
     }
 
     iter->second = value->get_buffer(value);
+    if (iter->first == "gamma" || iter->first == "contrast" ||
+        iter->first == "darken" || iter->first == "dither")
+    {
+        instance->apply_post_process_attributes();
+    }
     return PLUGIN_OK;
 }
 
@@ -55,6 +55,7 @@ class PluginDocImpl : public IPluginUnknown
                     , public IPluginDocDictionary
                     , public IPluginDocMarker
                     , public IPluginDocSearch
+                    , public IPluginDocStatistics
 {
 public:
     PluginDocImpl();
@@ -238,14 +239,26 @@ private:
         IPluginUnknown *thiz,
         const unsigned int  search_id);
 
+    // IPluginDocStatistics
+    static PluginStatus get_statistic_impl(
+        IPluginUnknown      *thiz,
+        const UDSString     *name,
+        UDSString           *value);
+
+    static PluginStatus dump_statistics_impl(
+        IPluginUnknown      *thiz,
+        UDSString           *output);
+
+    static PluginStatus reset_statistics_impl(
+        IPluginUnknown      *thiz);
+
 private:
     MarkerEntry* generate_marker_entry(const std::string & anchor,
-                                       const std::string & text,
-                                       const std::string & goto_anchor,
+                                       const char * text,
                                        const unsigned int uds_private_size);
 
     void add_toc_children(MarkerEntry * parent, 
-                          TocItem * item,
+                          PDFToc * toc,
                           const unsigned int uds_private_size);
 
 private:
@@ -261,6 +274,9 @@ private:
     void on_search_results_ready(SearchResult res, PDFRangeCollection* coll
         , unsigned int search_id);
 
+    // Handle the metadata ready event
+    void on_metadata_ready();
+
 private:
     static utils::ObjectTable<PluginDocImpl> g_instances_table;
 
@@ -273,6 +289,7 @@ private:
 
 private:
     void init_doc_attributes();
+    void apply_post_process_attributes();
     typedef std::map<std::string, std::string> DocAttrMap;
     typedef DocAttrMap::iterator               DocAttrMapIter;
     DocAttrMap doc_attr_map;
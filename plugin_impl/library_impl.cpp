@@ -27,6 +27,8 @@
 #include <cassert>
 #include <string.h>
 #include "library_impl.h"
+#include "call_recorder.h"
+#include "pdf_library.h"
 
 namespace pdf
 {
@@ -58,10 +60,17 @@ PluginLibraryImpl::PluginLibraryImpl()
     // record the instance.
     g_instances_table.add_interface<IPluginUnknown>(this);
     g_instances_table.add_interface<IPluginLibrary>(this);
+
+    // Starts the call trace when UDS_PLUGIN_RECORD is set.
+    RECORD_CALL("create_plugin_library", 0);
 }
 
 PluginLibraryImpl::~PluginLibraryImpl()
 {
+    // Write the trace events when UDS_PLUGIN_TRACE is set.
+    trace::dump_if_requested();
+    // And the statistics when UDS_PLUGIN_STATS is set.
+    PDFLibrary::instance().dump_stats_if_requested();
     g_instances_table.remove(this);
 }
 
@@ -42,6 +42,7 @@ PluginRenderResultImpl::PluginRenderResultImpl(const unsigned int page_num, cons
 , page_number(page_num)
 , ref_id(id)
 , discard(false)
+, refs(0)
 {
     // IPluginUnknown
     query_interface = query_interface_impl;
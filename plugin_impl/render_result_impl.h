@@ -59,6 +59,23 @@ public:
     void set_discard(bool s) {discard = s;}
     bool is_discard() {return discard;}
 
+    /// Every EVENT_RENDERING_END sent with the result holds a reference
+    /// that UDS drops by releasing the result once, a preview sends two.
+    /// The result is deleted or reused when no reference is left.
+    void add_ref() {g_atomic_int_inc(&refs);}
+
+    /// Returns true when this was the last reference
+    bool release_ref() {return g_atomic_int_dec_and_test(&refs) != 0;}
+    bool is_referenced() {return g_atomic_int_get(&refs) > 0;}
+
+    /// The render task holds a reference of its own while it refines a
+    /// preview it delivered in this result
+    void set_refining(bool r) {if (r) add_ref(); else release_ref();}
+
+    /// Has UDS released every event sent during the refinement, only
+    /// valid while refining
+    bool is_released() {return g_atomic_int_get(&refs) == 1;}
+
     void set_page_number(const unsigned int n) {page_number = n;}
     unsigned int get_page_number() {return page_number;}
     void set_ref_id(const unsigned int r) {ref_id = r;}
@@ -130,6 +147,10 @@ private:
     // flag indicating whether the render result is discarded or not
     bool discard;
 
+    // references held by UDS and the render task, shared with the
+    // working thread
+    volatile gint refs;
+
     friend class PDFPage;
 };
 
@@ -27,6 +27,7 @@
 #include <cassert>
 #include "view_impl.h"
 #include "document_impl.h"
+#include "call_recorder.h"
 
 #include "pdf_library.h"
 
@@ -192,6 +193,7 @@ PluginViewImpl::get_cover_page_impl(IPluginUnknown *thiz,
                                     PluginBitmapAttributes *cover_page)
 {
     PluginViewImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("get_cover_page", "%d\t%d", width, height);
 
     if (instance->renderer->render_cover_page(width, height, cover_page))
     {
@@ -206,6 +208,7 @@ PluginViewImpl::set_display_size_impl(IPluginUnknown *thiz,
                                       const int       height )
 {
     PluginViewImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("set_display_size", "%d\t%d", width, height);
 
     instance->renderer->get_view_attr().set_display_width(width);
     instance->renderer->get_view_attr().set_display_height(height);
@@ -218,6 +221,7 @@ PluginViewImpl::set_DPI_impl(IPluginUnknown        *thiz,
                              const unsigned int    dpi )
 {
     PluginViewImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("set_DPI", "%u", dpi);
 
     instance->renderer->get_view_attr().set_device_dpi_v(dpi);
     instance->renderer->get_view_attr().set_device_dpi_h(dpi);
@@ -230,6 +234,7 @@ PluginViewImpl::set_color_depth_impl(IPluginUnknown *thiz,
                                      const unsigned int color_depth )
 {
     PluginViewImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("set_color_depth", "%u", color_depth);
 
     instance->renderer->get_view_attr().set_color_depth(color_depth);
 
@@ -244,6 +249,19 @@ PluginViewImpl::render_impl(IPluginUnknown      *thiz,
                             const RenderArea    *area, 
                             const unsigned int  refId )
 {
+    PluginRenderSettingsImpl * settings_obj = 
+        PluginRenderSettingsImpl::query_instance(settings);
+    RECORD_CALL("render", "%s\t%d\t%f\t%d\t%u\t%f\t%f\t%f\t%f"
+        , utils::RecordArg(start_of_page_anchor->get_buffer(start_of_page_anchor)).c_str()
+        , page_offset
+        , settings_obj->get_render_attr().get_zoom_setting()
+        , settings_obj->get_render_attr().get_rotate()
+        , refId
+        , area ? area->x_offset : 0.0f
+        , area ? area->y_offset : 0.0f
+        , area ? area->width : 1.0f
+        , area ? area->height : 1.0f);
+
     // Must get proper page anchor, so no page offset allowed
     if (page_offset != 0)
     {
@@ -257,10 +275,6 @@ PluginViewImpl::render_impl(IPluginUnknown      *thiz,
     unsigned int page_num = instance->document->get_page_number(
         start_of_page_anchor->get_buffer(start_of_page_anchor));
 
-    // construct the render setting attributes
-    PluginRenderSettingsImpl * settings_obj = 
-        PluginRenderSettingsImpl::query_instance(settings);
-    
     // send render request
     instance->send_render_request(page_num, settings_obj->get_render_attr()
         , area, refId);
@@ -289,6 +303,7 @@ PluginViewImpl::set_memory_limit_impl(IPluginUnknown       *thiz,
                                       const unsigned int   bytes)
 {
     PluginViewImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("set_memory_limit", "%u", bytes);
     if (instance->document->get_doc_ctrl().set_memory_limit(bytes))
     {
         return PLUGIN_OK;
@@ -303,6 +318,8 @@ PluginViewImpl::get_original_size_impl(IPluginUnknown       *thiz,
                                        unsigned int         *height )
 {
     PluginViewImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("get_original_size", "%s"
+        , utils::RecordArg(start_of_page_anchor->get_buffer(start_of_page_anchor)).c_str());
     if (instance->document->get_original_size(start_of_page_anchor->get_buffer(start_of_page_anchor),
                                               *width,
                                               *height))
@@ -318,6 +335,8 @@ PluginViewImpl::get_page_content_area_impl(IPluginUnknown       *thiz,
                                            RenderArea           *area )
 {
     PluginViewImpl *instance = g_instances_table.get_object(thiz);
+    RECORD_CALL("get_page_content_area", "%s"
+        , utils::RecordArg(start_of_page_anchor->get_buffer(start_of_page_anchor)).c_str());
     if (instance->document->get_content_area(
         start_of_page_anchor->get_buffer(start_of_page_anchor),
         *area))
@@ -441,11 +460,21 @@ PluginViewImpl::on_render_result_released(PluginRenderResultImpl * result)
     RenderResultIter iter = std::find(render_results.begin(),
                                       render_results.end(),
                                       result);
-    if (iter != render_results.end())
+    if (iter == render_results.end())
     {
-        delete *iter;
-        render_results.erase(iter);
+        return;
     }
+
+    if (!result->release_ref())
+    {
+        // UDS holds another event sent with this result, or the render
+        // task still refines it, reuse it once nothing refers to it
+        result->set_discard(true);
+        return;
+    }
+
+    delete *iter;
+    render_results.erase(iter);
 }
 
 void PluginViewImpl::send_render_request(int page_num
@@ -460,7 +489,7 @@ void PluginViewImpl::send_render_request(int page_num
     for (; idx != render_results.end(); ++idx)
     {
         RenderResultPtr p = *idx;
-        if (p->is_discard())
+        if (p->is_discard() && !p->is_referenced())
         {
             result = p;
             break;
@@ -506,8 +535,10 @@ void PluginViewImpl::handle_page_ready(RenderResultPtr result, RenderStatus stat
     switch (stat)
     {
     case TASK_RENDER_DONE:
+    case TASK_RENDER_PREVIEW:
         {
-            // render done
+            // render done, a preview is followed by a second event for
+            // the same reference id
             attrs.render_end.status = RENDER_DONE;
         }
         break;
@@ -530,6 +561,12 @@ void PluginViewImpl::handle_page_ready(RenderResultPtr result, RenderStatus stat
         break;
     }
 
+    // UDS releases the result once for every event it gets
+    result->add_ref();
+
+    RECORD_CALL("event", "EVENT_RENDERING_END\t%lu\t%d\t%d"
+        , attrs.render_end.rid, attrs.render_end.status
+        , stat == TASK_RENDER_PREVIEW ? 1 : 0);
     listeners.broadcast(this, EVENT_RENDERING_END, &attrs);
 }
 
@@ -0,0 +1,809 @@
+/*
+ * File Name: pdf_bitmap_ops.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "pdf_bitmap_ops.h"
+#include "pdf_pixel_format.h"
+
+
+namespace pdf
+{
+
+// Source positions are kept in 16.16 fixed point
+static const int FIXED_SHIFT = 16;
+static const int FIXED_ONE = 1 << FIXED_SHIFT;
+
+// Vertical weights have 7 bits, so that a weighted pixel fits 16 bits
+static const int WEIGHT_SHIFT = 7;
+static const int WEIGHT_ONE = 1 << WEIGHT_SHIFT;
+
+// Copy the samples of a bitmap row into buf, which holds width * CHANNELS
+template <class Format>
+static void load_samples(const unsigned char *row, unsigned char *buf, int width)
+{
+    const unsigned char *samples = Format::to_samples(row, buf, width);
+    if (samples != buf)
+    {
+        memcpy(buf, samples, width * Format::CHANNELS);
+    }
+}
+
+// out[x] = (row0[x] * (WEIGHT_ONE - w) + row1[x] * w) / WEIGHT_ONE
+static void blend_rows(const unsigned char *row0,
+                       const unsigned char *row1,
+                       int w,
+                       unsigned char *out,
+                       int count)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i w0 = _mm_set1_epi16(static_cast<short>(WEIGHT_ONE - w));
+    __m128i w1 = _mm_set1_epi16(static_cast<short>(w));
+    __m128i round = _mm_set1_epi16(WEIGHT_ONE >> 1);
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), WEIGHT_SHIFT);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), WEIGHT_SHIFT);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(__ARM_NEON__)
+    uint8x8_t w0 = vdup_n_u8(static_cast<unsigned char>(WEIGHT_ONE - w));
+    uint8x8_t w1 = vdup_n_u8(static_cast<unsigned char>(w));
+    for (; x + 8 <= count; x += 8)
+    {
+        uint16x8_t sum = vmull_u8(vld1_u8(row0 + x), w0);
+        sum = vmlal_u8(sum, vld1_u8(row1 + x), w1);
+        vst1_u8(out + x, vrshrn_n_u16(sum, WEIGHT_SHIFT));
+    }
+#endif
+    for (; x < count; ++x)
+    {
+        out[x] = static_cast<unsigned char>(
+            (row0[x] * (WEIGHT_ONE - w) + row1[x] * w + (WEIGHT_ONE >> 1)) >> WEIGHT_SHIFT);
+    }
+}
+
+// out[x] is the average of the 2x2 block at (2x, 0) of row0 and row1,
+// for pixels of CH samples. count is the number of output pixels.
+template <int CH>
+static void halve_rows(const unsigned char *row0,
+                       const unsigned char *row1,
+                       unsigned char *out,
+                       int count)
+{
+    int x = 0;
+    if (CH == 1)
+    {
+#if defined(__SSE2__)
+        __m128i mask = _mm_set1_epi16(0x00ff);
+        for (; x + 16 <= count; x += 16)
+        {
+            const __m128i *p0 = reinterpret_cast<const __m128i *>(row0 + 2 * x);
+            const __m128i *p1 = reinterpret_cast<const __m128i *>(row1 + 2 * x);
+            __m128i a = _mm_avg_epu8(_mm_loadu_si128(p0), _mm_loadu_si128(p1));
+            __m128i b = _mm_avg_epu8(_mm_loadu_si128(p0 + 1), _mm_loadu_si128(p1 + 1));
+            a = _mm_avg_epu16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8));
+            b = _mm_avg_epu16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm_packus_epi16(a, b));
+        }
+#elif defined(__ARM_NEON__)
+        for (; x + 16 <= count; x += 16)
+        {
+            uint8x16x2_t a = vld2q_u8(row0 + 2 * x);
+            uint8x16x2_t b = vld2q_u8(row1 + 2 * x);
+            vst1q_u8(out + x, vrhaddq_u8(vrhaddq_u8(a.val[0], a.val[1]),
+                                         vrhaddq_u8(b.val[0], b.val[1])));
+        }
+#endif
+    }
+    for (; x < count; ++x)
+    {
+        const unsigned char *p0 = row0 + 2 * CH * x;
+        const unsigned char *p1 = row1 + 2 * CH * x;
+        for (int c = 0; c < CH; ++c)
+        {
+            out[CH * x + c] = static_cast<unsigned char>(
+                (p0[c] + p0[c + CH] + p1[c] + p1[c + CH] + 2) >> 2);
+        }
+    }
+}
+
+static void build_lut(const PostProcessSettings &settings, unsigned char *lut)
+{
+    for (int i = 0; i < 256; ++i)
+    {
+        double v = pow(i / 255.0f, settings.gamma);
+        v = (v - 0.5f) * settings.contrast + 0.5f;
+        if (v < 0.0f)
+        {
+            v = 0.0f;
+        }
+        else if (v > 1.0f)
+        {
+            v = 1.0f;
+        }
+        lut[i] = static_cast<unsigned char>(v * 255.0f + 0.5f);
+    }
+}
+
+// Turn a grey level lut into one that maps whole bytes of a bitmap row.
+// Byte formats use it as is, packed formats map each pixel of the byte.
+template <class Format>
+static void build_byte_lut(const unsigned char *lut, unsigned char *byte_lut)
+{
+    if (!Format::PACKED)
+    {
+        memcpy(byte_lut, lut, 256);
+        return;
+    }
+
+    const int pixels = 8 / Format::BITS;
+    for (int i = 0; i < 256; ++i)
+    {
+        unsigned char byte = static_cast<unsigned char>(i);
+        unsigned char grey[8];
+        Format::to_grey(&byte, grey, pixels);
+        for (int j = 0; j < pixels; ++j)
+        {
+            grey[j] = lut[grey[j]];
+        }
+        Format::from_samples(grey, &byte_lut[i], pixels);
+    }
+}
+
+// out[x] = min of row[x-CH], row[x], row[x+CH], above[x] and below[x],
+// averaged with row[x] when light is set. count is in samples.
+template <int CH>
+static void darken_row(const unsigned char *above,
+                       const unsigned char *row,
+                       const unsigned char *below,
+                       bool light,
+                       unsigned char *out,
+                       int count)
+{
+    memcpy(out, row, CH);
+    memcpy(out + count - CH, row + count - CH, CH);
+    int x = CH;
+#if defined(__SSE2__)
+    for (; x + 16 + CH <= count; x += 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        __m128i m = _mm_min_epu8(c, _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x - CH)));
+        m = _mm_min_epu8(m, _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x + CH)));
+        m = _mm_min_epu8(m, _mm_loadu_si128(reinterpret_cast<const __m128i *>(above + x)));
+        m = _mm_min_epu8(m, _mm_loadu_si128(reinterpret_cast<const __m128i *>(below + x)));
+        if (light)
+        {
+            m = _mm_avg_epu8(m, c);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), m);
+    }
+#elif defined(__ARM_NEON__)
+    for (; x + 16 + CH <= count; x += 16)
+    {
+        uint8x16_t c = vld1q_u8(row + x);
+        uint8x16_t m = vminq_u8(c, vld1q_u8(row + x - CH));
+        m = vminq_u8(m, vld1q_u8(row + x + CH));
+        m = vminq_u8(m, vld1q_u8(above + x));
+        m = vminq_u8(m, vld1q_u8(below + x));
+        if (light)
+        {
+            m = vrhaddq_u8(m, c);
+        }
+        vst1q_u8(out + x, m);
+    }
+#endif
+    for (; x < count - CH; ++x)
+    {
+        unsigned char m = row[x];
+        m = std::min(m, row[x - CH]);
+        m = std::min(m, row[x + CH]);
+        m = std::min(m, above[x]);
+        m = std::min(m, below[x]);
+        out[x] = light ? static_cast<unsigned char>((m + row[x] + 1) >> 1) : m;
+    }
+}
+
+struct PostProcessKernel
+{
+    SplashBitmap                *bitmap;
+    const PostProcessSettings   *settings;
+
+    template <class Format>
+    void run()
+    {
+        int width = bitmap->getWidth();
+        int height = bitmap->getHeight();
+        int stride = bitmap->getRowSize();
+        unsigned char *data = bitmap->getDataPtr();
+
+        if (!(fabs(settings->gamma - 1.0f) < 0.001f && fabs(settings->contrast - 1.0f) < 0.001f))
+        {
+            unsigned char lut[256];
+            unsigned char byte_lut[256];
+            build_lut(*settings, lut);
+            build_byte_lut<Format>(lut, byte_lut);
+            for (int y = 0; y < height; ++y)
+            {
+                unsigned char *row = data + y * stride;
+                for (int x = 0; x < stride; ++x)
+                {
+                    row[x] = byte_lut[row[x]];
+                }
+            }
+        }
+
+        if (settings->darken <= 0 || width < 3 || height < 3)
+        {
+            return;
+        }
+
+        // the filter runs in place, so the unfiltered samples of the rows
+        // above, at and below the current one are kept aside
+        int count = width * Format::CHANNELS;
+        unsigned char *buffer = new unsigned char[count * 4];
+        unsigned char *above = buffer;
+        unsigned char *row = buffer + count;
+        unsigned char *below = buffer + count * 2;
+        unsigned char *out = buffer + count * 3;
+        load_samples<Format>(data, above, width);
+        load_samples<Format>(data + stride, row, width);
+        for (int y = 1; y < height - 1; ++y)
+        {
+            load_samples<Format>(data + (y + 1) * stride, below, width);
+            darken_row<Format::CHANNELS>(above, row, below, settings->darken == 1, out, count);
+            Format::from_samples(out, data + y * stride, width);
+            std::swap(above, row);
+            std::swap(row, below);
+        }
+        delete [] buffer;
+    }
+};
+
+void post_process_bitmap(SplashBitmap *bitmap, const PostProcessSettings &settings)
+{
+    if (settings.is_identity())
+    {
+        return;
+    }
+
+    TRACE_EVENT_SCOPE(TRACE_DETAIL, "post_process_bitmap", -1, 0);
+    PostProcessKernel kernel = { bitmap, &settings };
+    dispatch_pixel_format(bitmap->getMode(), kernel);
+}
+
+// 4x4 Bayer matrix, thresholds 0..15
+static const unsigned char BAYER[4][4] =
+{
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+};
+
+// levels[x] = (row[x] * max_level + bias[x]) / 255, biases are below 255
+static void quantize_row(const unsigned char *row,
+                         const unsigned char *bias,
+                         int max_level,
+                         unsigned char *levels,
+                         int count)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi16(1);
+    __m128i mul = _mm_set1_epi16(static_cast<short>(max_level));
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bias + x));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul),
+                                   _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul),
+                                   _mm_unpackhi_epi8(b, zero));
+        // exact division by 255 for values below 65535
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(levels + x), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(__ARM_NEON__)
+    uint8x8_t mul = vdup_n_u8(static_cast<unsigned char>(max_level));
+    uint16x8_t one = vdupq_n_u16(1);
+    for (; x + 8 <= count; x += 8)
+    {
+        uint16x8_t t = vmull_u8(vld1_u8(row + x), mul);
+        t = vaddw_u8(t, vld1_u8(bias + x));
+        t = vaddq_u16(vaddq_u16(t, one), vshrq_n_u16(t, 8));
+        vst1_u8(levels + x, vshrn_n_u16(t, 8));
+    }
+#endif
+    for (; x < count; ++x)
+    {
+        levels[x] = static_cast<unsigned char>((row[x] * max_level + bias[x]) / 255);
+    }
+}
+
+// Floyd-Steinberg. cur holds the error carried into this row and next
+// collects it for the following row, both in 1/16 and offset by one, so
+// that x - 1 and x + 1 need no checks.
+static void diffuse_row(const unsigned char *row,
+                        int max_level,
+                        int *cur,
+                        int *next,
+                        unsigned char *levels,
+                        int count)
+{
+    memset(next, 0, (count + 2) * sizeof(int));
+    for (int x = 0; x < count; ++x)
+    {
+        int v = row[x] + cur[x + 1] / 16;
+        int level = (std::max(0, std::min(v, 255)) * max_level + 127) / 255;
+        int error = v - level * 255 / max_level;
+        levels[x] = static_cast<unsigned char>(level);
+
+        cur[x + 2] += error * 7;
+        next[x] += error * 3;
+        next[x + 1] += error * 5;
+        next[x + 2] += error;
+    }
+}
+
+
+template <class Format>
+static void pack_row(const unsigned char *levels, unsigned char *out, int count)
+{
+    Format::pack_levels(levels, out, count);
+}
+
+#if defined(__SSE2__)
+template <>
+void pack_row<Grey4>(const unsigned char *levels, unsigned char *out, int count)
+{
+    int x = 0;
+    __m128i mask = _mm_set1_epi16(0x00ff);
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(levels + x));
+        v = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, mask), 4), _mm_srli_epi16(v, 8));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x / 2), _mm_packus_epi16(v, v));
+    }
+    Grey4::pack_levels(levels + x, out + x / 2, count - x);
+}
+#endif
+
+struct PackKernel
+{
+    SplashBitmap    *src;
+    DitherMode      dither;
+    SplashBitmap    *dst;
+
+    template <class Format>
+    void run()
+    {
+        int width = src->getWidth();
+        int height = src->getHeight();
+        int max_level = Format::MAX_LEVEL;
+        dst = new SplashBitmap(width, height, Format::MODE);
+
+        unsigned char *levels = new unsigned char[width];
+        unsigned char *bias = new unsigned char[width];
+        int *errors = 0;
+        int *cur = 0;
+        int *next = 0;
+        if (dither == DITHER_DIFFUSION)
+        {
+            errors = new int[(width + 2) * 2];
+            memset(errors, 0, (width + 2) * 2 * sizeof(int));
+            cur = errors;
+            next = errors + width + 2;
+        }
+        else if (dither == DITHER_NONE)
+        {
+            memset(bias, 127, width);
+        }
+
+        for (int y = 0; y < height; ++y)
+        {
+            const unsigned char *row = src->getDataPtr() + y * src->getRowSize();
+            if (dither == DITHER_DIFFUSION)
+            {
+                diffuse_row(row, max_level, cur, next, levels, width);
+                std::swap(cur, next);
+            }
+            else
+            {
+                if (dither == DITHER_ORDERED)
+                {
+                    // thresholds spread over the interval between two levels
+                    for (int x = 0; x < width; ++x)
+                    {
+                        bias[x] = static_cast<unsigned char>((BAYER[y & 3][x & 3] * 2 + 1) * 255 / 32);
+                    }
+                }
+                quantize_row(row, bias, max_level, levels, width);
+            }
+            pack_row<Format>(levels, dst->getDataPtr() + y * dst->getRowSize(), width);
+        }
+
+        delete [] errors;
+        delete [] bias;
+        delete [] levels;
+    }
+};
+
+SplashBitmap * pack_bitmap(SplashBitmap *src, SplashColorMode mode, DitherMode dither)
+{
+    TRACE_EVENT_SCOPE(TRACE_DETAIL, "pack_bitmap", -1, 0);
+    PackKernel kernel = { src, dither, 0 };
+    dispatch_pixel_format(mode, kernel);
+    return kernel.dst;
+}
+
+struct GreyKernel
+{
+    SplashBitmap    *src;
+    SplashBitmap    *dst;
+
+    template <class Format>
+    void run()
+    {
+        int width = src->getWidth();
+        int height = src->getHeight();
+        dst = new SplashBitmap(width, height);
+        for (int y = 0; y < height; ++y)
+        {
+            Format::to_grey(src->getDataPtr() + y * src->getRowSize(),
+                            dst->getDataPtr() + y * dst->getRowSize(),
+                            width);
+        }
+    }
+};
+
+SplashBitmap * convert_bitmap(SplashBitmap *src, SplashColorMode mode, DitherMode dither)
+{
+    if (src->getMode() == mode)
+    {
+        SplashBitmap *dst = new SplashBitmap(src->getWidth(), src->getHeight(), mode);
+        memcpy(dst->getDataPtr(), src->getDataPtr(), src->getRowSize() * src->getHeight());
+        return dst;
+    }
+
+    // everything else goes through 8 bit grey
+    GreyKernel grey = { src, 0 };
+    dispatch_pixel_format(src->getMode(), grey);
+    if (mode == splashModeMono8)
+    {
+        return grey.dst;
+    }
+
+    SplashBitmap *dst = pack_bitmap(grey.dst, mode, dither);
+    delete grey.dst;
+    return dst;
+}
+
+struct ScaleKernel
+{
+    SplashBitmap    *src;
+    int             width;
+    int             height;
+    SplashBitmap    *dst;
+
+    template <class Format>
+    void run()
+    {
+        const int ch = Format::CHANNELS;
+        dst = new SplashBitmap(width, height, Format::SAMPLE_MODE);
+        int src_w = src->getWidth();
+        int src_h = src->getHeight();
+        if (src_w <= 0 || src_h <= 0 || width <= 0 || height <= 0)
+        {
+            return;
+        }
+
+        const unsigned char *src_data = src->getDataPtr();
+        int src_stride = src->getRowSize();
+        unsigned char *dst_data = dst->getDataPtr();
+        int dst_stride = dst->getRowSize();
+
+        // sample at the pixel centres, so that the edges are not shifted
+        int step_x = static_cast<int>((static_cast<long long>(src_w) << FIXED_SHIFT) / width);
+        int step_y = static_cast<int>((static_cast<long long>(src_h) << FIXED_SHIFT) / height);
+
+        // the horizontal taps are the same for every row
+        int *taps = new int[width * 2];
+        for (int x = 0; x < width; ++x)
+        {
+            int fx = x * step_x + step_x / 2 - FIXED_ONE / 2;
+            if (fx < 0)
+            {
+                fx = 0;
+            }
+            taps[2 * x] = (fx >> FIXED_SHIFT) * ch;
+            taps[2 * x + 1] = (fx >> 8) & 0xff;
+        }
+
+        // every output row blends two source rows into a temporary row
+        // first, which is the part that vectorizes, then samples it
+        // horizontally. Packed rows are expanded to samples before.
+        unsigned char *tmp0 = new unsigned char[src_w * ch];
+        unsigned char *tmp1 = new unsigned char[src_w * ch];
+        unsigned char *blended = new unsigned char[(src_w + 1) * ch];
+        for (int y = 0; y < height; ++y)
+        {
+            int fy = y * step_y + step_y / 2 - FIXED_ONE / 2;
+            if (fy < 0)
+            {
+                fy = 0;
+            }
+            int y0 = fy >> FIXED_SHIFT;
+            int y1 = (y0 + 1 < src_h) ? y0 + 1 : y0;
+            int wy = (fy >> (FIXED_SHIFT - WEIGHT_SHIFT)) & (WEIGHT_ONE - 1);
+
+            blend_rows(Format::to_samples(src_data + y0 * src_stride, tmp0, src_w),
+                       Format::to_samples(src_data + y1 * src_stride, tmp1, src_w),
+                       wy, blended, src_w * ch);
+            memcpy(blended + src_w * ch, blended + (src_w - 1) * ch, ch);
+
+            unsigned char *out = dst_data + y * dst_stride;
+            for (int x = 0; x < width; ++x)
+            {
+                const unsigned char *p = blended + taps[2 * x];
+                int wx = taps[2 * x + 1];
+                for (int c = 0; c < ch; ++c)
+                {
+                    out[ch * x + c] = static_cast<unsigned char>(
+                        (p[c] * (256 - wx) + p[c + ch] * wx + 128) >> 8);
+                }
+            }
+        }
+
+        delete [] blended;
+        delete [] tmp1;
+        delete [] tmp0;
+        delete [] taps;
+    }
+};
+
+SplashBitmap * scale_bitmap(SplashBitmap *src, int width, int height)
+{
+    TRACE_EVENT_SCOPE(TRACE_DETAIL, "scale_bitmap", -1, 0);
+    ScaleKernel kernel = { src, width, height, 0 };
+    dispatch_pixel_format(src->getMode(), kernel);
+    return kernel.dst;
+}
+
+struct HalveKernel
+{
+    SplashBitmap    *src;
+    SplashBitmap    *dst;
+
+    template <class Format>
+    void run()
+    {
+        int src_w = src->getWidth();
+        dst = new SplashBitmap(src_w / 2, src->getHeight() / 2, Format::SAMPLE_MODE);
+        const unsigned char *src_data = src->getDataPtr();
+        int src_stride = src->getRowSize();
+        unsigned char *dst_data = dst->getDataPtr();
+        int dst_stride = dst->getRowSize();
+        unsigned char *tmp0 = new unsigned char[src_w * Format::CHANNELS];
+        unsigned char *tmp1 = new unsigned char[src_w * Format::CHANNELS];
+        for (int y = 0; y < dst->getHeight(); ++y)
+        {
+            halve_rows<Format::CHANNELS>(
+                Format::to_samples(src_data + 2 * y * src_stride, tmp0, src_w),
+                Format::to_samples(src_data + (2 * y + 1) * src_stride, tmp1, src_w),
+                dst_data + y * dst_stride,
+                dst->getWidth());
+        }
+        delete [] tmp1;
+        delete [] tmp0;
+    }
+};
+
+SplashBitmap * halve_bitmap(SplashBitmap *src)
+{
+    TRACE_EVENT_SCOPE(TRACE_DETAIL, "halve_bitmap", -1, 0);
+    if (src->getWidth() < 2 || src->getHeight() < 2)
+    {
+        return 0;
+    }
+
+    HalveKernel kernel = { src, 0 };
+    dispatch_pixel_format(src->getMode(), kernel);
+    return kernel.dst;
+}
+
+// cols[x] += 1 for every row[x] darker than threshold, returns how many
+// there were
+static int count_ink(const unsigned char *row,
+                     unsigned char threshold,
+                     unsigned short *cols,
+                     int count)
+{
+    int sum = 0;
+    int x = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi8(1);
+    __m128i thr = _mm_set1_epi8(static_cast<char>(threshold));
+    __m128i acc = zero;
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        // 1 where v < threshold, 0 elsewhere
+        __m128i ink = _mm_min_epu8(_mm_subs_epu8(thr, v), one);
+        __m128i *c = reinterpret_cast<__m128i *>(cols + x);
+        _mm_storeu_si128(c, _mm_add_epi16(_mm_loadu_si128(c), _mm_unpacklo_epi8(ink, zero)));
+        _mm_storeu_si128(c + 1, _mm_add_epi16(_mm_loadu_si128(c + 1), _mm_unpackhi_epi8(ink, zero)));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(ink, zero));
+    }
+    sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#elif defined(__ARM_NEON__)
+    uint8x16_t one = vdupq_n_u8(1);
+    uint8x16_t thr = vdupq_n_u8(threshold);
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; x + 16 <= count; x += 16)
+    {
+        uint8x16_t ink = vandq_u8(vcltq_u8(vld1q_u8(row + x), thr), one);
+        vst1q_u16(cols + x, vaddw_u8(vld1q_u16(cols + x), vget_low_u8(ink)));
+        vst1q_u16(cols + x + 8, vaddw_u8(vld1q_u16(cols + x + 8), vget_high_u8(ink)));
+        acc = vpadalq_u16(acc, vpaddlq_u8(ink));
+    }
+    sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+          vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#endif
+    for (; x < count; ++x)
+    {
+        int ink = row[x] < threshold;
+        cols[x] += ink;
+        sum += ink;
+    }
+    return sum;
+}
+
+// Ink of the columns from x1 up to x2 of every row in rows, and of every
+// column in cols
+struct ProjectKernel
+{
+    SplashBitmap    *bitmap;
+    unsigned char   threshold;
+    int             x1;
+    int             x2;
+    int             *rows;
+    unsigned short  *cols;
+
+    template <class Format>
+    void run()
+    {
+        int width = bitmap->getWidth();
+        unsigned char *grey = new unsigned char[width];
+        for (int y = 0; y < bitmap->getHeight(); ++y)
+        {
+            const unsigned char *row = bitmap->getDataPtr() + y * bitmap->getRowSize();
+            if (Format::MODE != splashModeMono8)
+            {
+                Format::to_grey(row, grey, width);
+                row = grey;
+            }
+            rows[y] = count_ink(row + x1, threshold, cols + x1, x2 - x1);
+        }
+        delete [] grey;
+    }
+};
+
+// First index from begin towards end (exclusive, step +1 or -1) whose
+// count is content: above the noise, and within the first border ones
+// below the solid bars that scan edges leave
+template <class T>
+static int first_content(const T *counts, int begin, int end, int step,
+                         int noise, int solid, int border)
+{
+    for (int i = begin; i != end; i += step)
+    {
+        if (counts[i] > noise && (counts[i] < solid || (i - begin) * step >= border))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool find_content_bounds(SplashBitmap *bitmap, unsigned char threshold, double noise,
+                         int &x1, int &y1, int &x2, int &y2)
+{
+    TRACE_EVENT_SCOPE(TRACE_DETAIL, "find_content_bounds", -1, 0);
+    int width = bitmap->getWidth();
+    int height = bitmap->getHeight();
+    if (width <= 0 || height <= 0)
+    {
+        return false;
+    }
+
+    // one pass gives both projections
+    int *rows = new int[height];
+    unsigned short *cols = new unsigned short[width];
+    memset(cols, 0, width * sizeof(unsigned short));
+    ProjectKernel kernel = { bitmap, threshold, 0, width, rows, cols };
+    dispatch_pixel_format(bitmap->getMode(), kernel);
+
+    // a row or column needs more ink than a few specks, and a nearly
+    // solid one close to the edge is a scan border rather than content
+    static const double BORDER = 0.05f;
+    int row_noise = std::max(1, static_cast<int>(noise * width));
+    int col_noise = std::max(1, static_cast<int>(noise * height));
+    int row_solid = width - row_noise;
+    int col_solid = height - col_noise;
+    int row_border = static_cast<int>(BORDER * height);
+    int col_border = static_cast<int>(BORDER * width);
+
+    x1 = first_content(cols, 0, width, 1, col_noise, col_solid, col_border);
+    x2 = first_content(cols, width - 1, -1, -1, col_noise, col_solid, col_border) + 1;
+    if (x1 < 0)
+    {
+        delete [] cols;
+        delete [] rows;
+        return false;
+    }
+
+    // ink in the side margins, a scan border above all, would make every
+    // row look like content, so the rows are counted again without it
+    int margin_ink = 0;
+    for (int x = 0; x < width; ++x)
+    {
+        margin_ink += (x < x1 || x >= x2) ? cols[x] : 0;
+    }
+    if (margin_ink > 0)
+    {
+        ProjectKernel inner = { bitmap, threshold, x1, x2, rows, cols };
+        dispatch_pixel_format(bitmap->getMode(), inner);
+    }
+
+    y1 = first_content(rows, 0, height, 1, row_noise, row_solid, row_border);
+    y2 = first_content(rows, height - 1, -1, -1, row_noise, row_solid, row_border) + 1;
+
+    delete [] cols;
+    delete [] rows;
+    return y1 >= 0;
+}
+
+}   // namespace pdf
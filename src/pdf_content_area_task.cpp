@@ -0,0 +1,96 @@
+/*
+ * File Name: pdf_content_area_task.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#include "log.h"
+
+#include "pdf_content_area_task.h"
+#include "pdf_doc_controller.h"
+
+namespace pdf
+{
+
+PDFContentAreaTask::PDFContentAreaTask(PDFController *ctrl)
+: doc_ctrl(ctrl)
+{
+    type = TASK_BACKGROUND;
+}
+
+PDFContentAreaTask::~PDFContentAreaTask()
+{
+}
+
+void PDFContentAreaTask::execute()
+{
+    // from now on a new task may be queued
+    doc_ctrl->background_task_started();
+
+    // the visible page shown whole waits for its area, it goes first
+    PDFRenderer *renderer = doc_ctrl->get_renderer();
+    PDFContentAreas &areas = doc_ctrl->get_content_areas();
+    int page_number = renderer->get_cropping_page();
+    if (page_number <= 0)
+    {
+        page_number = areas.next_missing(doc_ctrl->get_cur_page_num());
+    }
+    if (page_number <= 0)
+    {
+        return;
+    }
+
+    TRACE_EVENT_SCOPE(TRACE_STAGE, "content_area", page_number, 0);
+    RenderArea area;
+    if (!renderer->detect_content_area(page_number
+        , area
+        , abort_check
+        , static_cast<void*>(this)))
+    {
+        // whoever aborted the task posts it again when done
+        return;
+    }
+
+    areas.set(page_number, area);
+    doc_ctrl->get_stats().inc(COUNTER_CONTENT_AREAS);
+    renderer->content_area_found(page_number);
+    doc_ctrl->post_background_task();
+}
+
+GBool PDFContentAreaTask::abort_check(void *data)
+{
+    PDFContentAreaTask *task = static_cast<PDFContentAreaTask*>(data);
+    return task->is_aborted() ? gTrue : gFalse;
+}
+
+void* PDFContentAreaTask::get_user_data()
+{
+    return doc_ctrl;
+}
+
+unsigned int PDFContentAreaTask::get_id()
+{
+    return 0;
+}
+
+}   // namespace pdf
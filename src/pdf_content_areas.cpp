@@ -0,0 +1,185 @@
+/*
+ * File Name: pdf_content_areas.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+#include <algorithm>
+
+#include "pdf_content_areas.h"
+
+namespace pdf
+{
+
+static const double AREA_SCALE = 65535.0f;
+
+static unsigned short pack_fraction(float value)
+{
+    if (value <= 0.0f)
+    {
+        return 0;
+    }
+    if (value >= 1.0f)
+    {
+        return 65535;
+    }
+    return static_cast<unsigned short>(value * AREA_SCALE + 0.5f);
+}
+
+PDFContentAreas::PDFContentAreas()
+: missing(0)
+{
+}
+
+PDFContentAreas::~PDFContentAreas()
+{
+}
+
+void PDFContentAreas::reset(const int pages)
+{
+    ScopeMutex m(&mutex);
+    PackedArea unknown = { 0, 0, 0, 0 };
+    areas.assign(pages, unknown);
+    missing = pages;
+}
+
+bool PDFContentAreas::get(const int page_number, RenderArea &area)
+{
+    ScopeMutex m(&mutex);
+    if (page_number < 1 || page_number > static_cast<int>(areas.size()))
+    {
+        return false;
+    }
+
+    const PackedArea &packed = areas[page_number - 1];
+    if (packed.width == 0)
+    {
+        return false;
+    }
+
+    area.x_offset = static_cast<float>(packed.x / AREA_SCALE);
+    area.y_offset = static_cast<float>(packed.y / AREA_SCALE);
+    area.width    = static_cast<float>(packed.width / AREA_SCALE);
+    area.height   = static_cast<float>(packed.height / AREA_SCALE);
+    return true;
+}
+
+void PDFContentAreas::set(const int page_number, const RenderArea &area)
+{
+    ScopeMutex m(&mutex);
+    if (page_number < 1 || page_number > static_cast<int>(areas.size()))
+    {
+        return;
+    }
+
+    PackedArea &packed = areas[page_number - 1];
+    if (packed.width == 0)
+    {
+        --missing;
+    }
+    packed.x      = pack_fraction(area.x_offset);
+    packed.y      = pack_fraction(area.y_offset);
+    // an empty area would read as unknown
+    packed.width  = std::max(pack_fraction(area.width), static_cast<unsigned short>(1));
+    packed.height = std::max(pack_fraction(area.height), static_cast<unsigned short>(1));
+}
+
+int PDFContentAreas::next_missing(const int around)
+{
+    ScopeMutex m(&mutex);
+    int count = static_cast<int>(areas.size());
+    if (missing <= 0)
+    {
+        return 0;
+    }
+
+    // the pages after around first, as reading goes forward
+    for (int distance = 0; distance <= count; ++distance)
+    {
+        int after = around + distance;
+        if (after >= 1 && after <= count && areas[after - 1].width == 0)
+        {
+            return after;
+        }
+        int before = around - distance - 1;
+        if (before >= 1 && before <= count && areas[before - 1].width == 0)
+        {
+            return before;
+        }
+    }
+    return 0;
+}
+
+bool PDFContentAreas::is_complete()
+{
+    ScopeMutex m(&mutex);
+    return missing <= 0;
+}
+
+int PDFContentAreas::memory_length()
+{
+    ScopeMutex m(&mutex);
+    return static_cast<int>(areas.size() * sizeof(PackedArea));
+}
+
+void PDFContentAreas::load(const unsigned short *packed, const int pages)
+{
+    ScopeMutex m(&mutex);
+    if (packed == 0 || pages != static_cast<int>(areas.size()))
+    {
+        return;
+    }
+
+    for (int i = 0; i < pages; ++i, packed += 4)
+    {
+        if (packed[2] == 0 || packed[3] == 0)
+        {
+            continue;
+        }
+        if (areas[i].width == 0)
+        {
+            --missing;
+        }
+        areas[i].x      = packed[0];
+        areas[i].y      = packed[1];
+        areas[i].width  = packed[2];
+        areas[i].height = packed[3];
+    }
+}
+
+int PDFContentAreas::dump(std::vector<unsigned short> &packed)
+{
+    ScopeMutex m(&mutex);
+    packed.resize(areas.size() * 4);
+    for (size_t i = 0; i < areas.size(); ++i)
+    {
+        packed[i * 4]     = areas[i].x;
+        packed[i * 4 + 1] = areas[i].y;
+        packed[i * 4 + 2] = areas[i].width;
+        packed[i * 4 + 3] = areas[i].height;
+    }
+    return static_cast<int>(areas.size()) - missing;
+}
+
+}   // namespace pdf
@@ -55,61 +55,117 @@ bool endsWith(const char *a, const char *b) {
 	return strcmp (a+strlen(a)-strlen(b),b) == 0;
 }
 
-OutlineItem* buildOutlineRec(miniexp_t exp) {
-	//WARNPRINTF("Building outline - rec");
-	if(!miniexp_consp(exp)) return 0;
-	int n = miniexp_length(exp);
-	//WARNPRINTF("We have list");
-	if(n < 2) return 0;
-	if(miniexp_stringp(miniexp_nth(0,exp)) &&
-		miniexp_stringp(miniexp_nth(1,exp))) {
-		const char* txt = miniexp_to_str(miniexp_nth(0,exp));
-		const char* dest = miniexp_to_str(miniexp_nth(1,exp));
-		//WARNPRINTF("Found outline item: %s (%s)", txt, dest);
-		int destpg = 1;
-		if(strlen(dest) > 0 && dest[0] == '#') {
-			bool allnum = true;
-			for(int i=1;i<(int)strlen(dest);i++) if(!isdigit(dest[i])) { allnum = false; break; }
-			if(allnum) {
-				destpg = atoi(dest+1);
-			}
-			else return 0;
-		} else {
+int Outline::append(int parent, int page, const char *title, int length) {
+	Item item;
+	item.page = page;
+	item.parent = parent;
+	item.firstChild = -1;
+	item.nextSibling = -1;
+	item.title = (gint32)titles.size();
+	item.titleLength = length;
+	titles.insert(titles.end(), title, title + length);
+	titles.push_back(0);
+	int idx = (int)items.size();
+	items.push_back(item);
+	// tails[parent+1] is the last child so far, appending is O(1)
+	gint32 &tail = tails[parent + 1];
+	if(tail < 0) {
+		if(parent >= 0) items[parent].firstChild = idx;
+	} else {
+		items[tail].nextSibling = idx;
+	}
+	tail = idx;
+	tails.push_back(-1);
+	return idx;
+}
+
+void Outline::serialize(std::string &out) const {
+	gint32 sizes[2] = { (gint32)items.size(), (gint32)titles.size() };
+	out.append((const char*)sizes, sizeof(sizes));
+	if(!items.empty()) out.append((const char*)&items[0], items.size() * sizeof(Item));
+	if(!titles.empty()) out.append(&titles[0], titles.size());
+}
+
+Outline* Outline::load(const char *data, unsigned int size) {
+	gint32 sizes[2];
+	if(size < sizeof(sizes)) return 0;
+	memcpy(sizes, data, sizeof(sizes));
+	gint32 n = sizes[0], textSize = sizes[1];
+	if(n < 0 || textSize < 0 || (unsigned int)textSize > size || n > (gint32)(size / sizeof(Item))
+		|| sizeof(sizes) + n * sizeof(Item) + textSize != size) return 0;
+	Outline *o = new Outline();
+	o->items.resize(n);
+	o->titles.resize(textSize);
+	if(n) memcpy(&o->items[0], data + sizeof(sizes), n * sizeof(Item));
+	if(textSize) memcpy(&o->titles[0], data + sizeof(sizes) + n * sizeof(Item), textSize);
+	// links only point forward in preorder, and every title is terminated
+	for(int i=0;i<n;i++) {
+		const Item &it = o->items[i];
+		if(it.parent < -1 || it.parent >= i
+			|| (it.firstChild != -1 && (it.firstChild <= i || it.firstChild >= n))
+			|| (it.nextSibling != -1 && (it.nextSibling <= i || it.nextSibling >= n))
+			|| it.title < 0 || it.titleLength < 0 || it.title >= textSize
+			|| it.titleLength >= textSize - it.title
+			|| o->titles[it.title + it.titleLength] != 0) {
+			delete o;
 			return 0;
 		}
-		gsize bytes_read;
-	    gsize bytes_written;
-    	GError *error = NULL;			
-    	Unicode *utxt = (Unicode*)g_convert((const gchar *)txt, -1, "UCS-4LE","UTF-8", &bytes_read, &bytes_written, &error);
-		GooList *children = new GooList();
-		for(int i=2;i<n;i++) {
-			OutlineItem *child = buildOutlineRec(miniexp_nth(i,exp));
-			if(child) children->append(child);
-		}
-		return new OutlineItem(utxt, (int)bytes_written/4, destpg, children);
-	} else {
-		//WARNPRINTF("Rong types");
-		return 0;
 	}
+	return o;
+}
+
+// add the outline entry exp and its kids below parent. Entries that don't
+// point to a page or have no valid UTF-8 title are left out with their kids.
+static void buildOutlineRec(Outline *outline, int parent, miniexp_t exp) {
+	if(!miniexp_consp(exp)) return;
+	int n = miniexp_length(exp);
+	if(n < 2) return;
+	if(!miniexp_stringp(miniexp_nth(0,exp)) || !miniexp_stringp(miniexp_nth(1,exp))) return;
+	const char* txt = miniexp_to_str(miniexp_nth(0,exp));
+	const char* dest = miniexp_to_str(miniexp_nth(1,exp));
+	//WARNPRINTF("Found outline item: %s (%s)", txt, dest);
+	if(dest[0] != '#' || dest[1] == 0) return;
+	for(const char *d=dest+1;*d;d++) if(!isdigit(*d)) return;
+	int destpg = atoi(dest+1);
+	int length = strlen(txt);
+	if(destpg <= 0 || length == 0 || !g_utf8_validate(txt, length, 0)) return;
+	// ddjvu already hands out UTF-8, the title is stored as it is
+	int idx = outline->append(parent, destpg, txt, length);
+	for(int i=2;i<n;i++) buildOutlineRec(outline, idx, miniexp_nth(i,exp));
 }
 
 Outline* buildOutline(ddjvu_document_t *doc) {
 	WARNPRINTF("Building outline");
 	miniexp_t r;
 	while((r=ddjvu_document_get_outline(doc))==miniexp_dummy) handleDdjvu(TRUE); // handle_ddjvu_message(ctx, TRUE);
+	Outline *outline = new Outline();
 	int n=miniexp_length(r);
-	GooList *items = new GooList();
-	for(int i=1;i<n;i++) {
-		OutlineItem *item = buildOutlineRec(miniexp_nth(i,r));
-		if(item) items->append(item);
-	}
+	for(int i=1;i<n;i++) buildOutlineRec(outline, -1, miniexp_nth(i,r));
 	ddjvu_miniexp_release(doc, r);
-	return new Outline(items);
+	return outline;
 }
 
-PDFDoc::PDFDoc(GooString* file) {
+// default memory cap of the decoded pages cache
+static const unsigned int DECODED_CACHE_LIMIT = 8 * 1024 * 1024;
+
+PDFDoc::PDFDoc(GooString* file, const pdf::PDFSidecar *sidecarA) {
     WARNPRINTF("Opening DjVu document %s", file->getCString());
-	pageWidths = pageHeights = pageDpis = pageRotations = 0;
+	pageInfos = 0;
+	pageInfoReady = 0;
+	lastPageInfo = -1;
+	nextPageInfo = 0;
+	// US letter at 300 dpi, until the first page info is loaded
+	defaultPageInfo.width = 2550;
+	defaultPageInfo.height = 3300;
+	defaultPageInfo.dpi = 300;
+	defaultPageInfo.rotation = 0;
+	pageModes = 0;
+	pageLinks = 0;
+	pageNamesLoaded = gFalse;
+	linksSize = 0;
+	outline = 0;
+	decodedSize = 0;
+	decodedLimit = DECODED_CACHE_LIMIT;
 	twoPageMode = endsWith(file->getCString(), "2pg.djvu");
 	if(twoPageMode) WARNPRINTF("Opening in two page mode");
 	ddjvu_context_t *ctx = globalParams->getContext();
@@ -126,24 +182,426 @@ PDFDoc::PDFDoc(GooString* file) {
 	}
 	while (!ddjvu_document_decoding_done(doc)) handleDdjvu(TRUE);
   	nPages = ddjvu_document_get_pagenum(doc);
-	pageWidths    = new int[nPages];
-	pageHeights   = new int[nPages];
-	pageDpis      = new int[nPages];
-	pageRotations = new int[nPages];
-	for(int i=0;i<nPages;i++) pageWidths[i] = -1;
-	outline = buildOutline(doc);
+	pageInfos     = new PageInfo[nPages];
+	pageInfoReady = new gint[nPages];
+	pageModes     = new signed char[nPages];
+	for(int i=0;i<nPages;i++) pageInfoReady[i] = 0;
+	memset(pageModes, -1, nPages);
+	pageLinks     = new Links*[getNumPages()];
+	for(int i=0;i<getNumPages();i++) pageLinks[i] = 0;
+	if(sidecarA && sidecarA->is_open() && sidecarA->get_page_count() == nPages) {
+		pdf::PDFSidecar::PageInfo known;
+		for(int i=0;i<nPages;i++) {
+			if(!sidecarA->get_page_info(i, known)) continue;
+			PageInfo pi = { known.width, known.height, known.dpi, known.rotation };
+			publishPageInfo(i, pi);
+		}
+		unsigned int size = 0;
+		const char *data = sidecarA->get_outline(size);
+		if(data) outline = Outline::load(data, size);
+		if(data && !outline) WARNPRINTF("Invalid outline in sidecar");
+	}
 	mtx->unlock();
 }
 
 PDFDoc::~PDFDoc() {
 	WARNPRINTF("Destructing PDFDoc");
-	delete[] pageWidths;
-	delete[] pageHeights;
-	delete[] pageDpis;
-	delete[] pageRotations;
+	pdf::Mutex* mtx = globalParams->getMutex();
+	mtx->lock();
+	trimDecoded(0);
+	mtx->unlock();
+	delete[] pageInfos;
+	delete[] pageInfoReady;
+	delete[] pageModes;
+	if(pageLinks) for(int i=0;i<getNumPages();i++) delete pageLinks[i];
+	delete[] pageLinks;
 	delete outline;
 }
 
+ddjvu_page_t *PDFDoc::getDecodedPage(int pageno) {
+	std::list<DecodedPage>::iterator it;
+	for(it = decoded.begin(); it != decoded.end(); ++it) {
+		if(it->pageno == pageno) {
+			// move to the front
+			if(it != decoded.begin()) decoded.splice(decoded.begin(), decoded, it);
+			return decoded.front().page;
+		}
+	}
+
+	DecodedPage d;
+	d.pageno = pageno;
+	d.page = decodePage(pageno);
+	if(!d.page) return 0;
+
+	// ddjvu doesn't tell how much memory a decoded page takes. JB2 shapes
+	// are about a bit per pixel, IW44 keeps wavelet coefficients for each
+	// pixel and color component.
+	unsigned int pixels = ddjvu_page_get_width(d.page) * ddjvu_page_get_height(d.page);
+	d.size = ddjvu_page_get_type(d.page) == DDJVU_PAGETYPE_BITONAL ? pixels / 8 : pixels;
+	decoded.push_front(d);
+	decodedSize += d.size;
+
+	// keep the page just decoded, even if it alone is over the limit
+	trimDecoded(decodedLimit > d.size ? decodedLimit : d.size);
+	return d.page;
+}
+
+ddjvu_page_t *PDFDoc::decodePage(int pageno) {
+	ddjvu_page_t *pg = ddjvu_page_create_by_pageno(doc, pageno);
+	if(!pg) return 0;
+	while (!ddjvu_page_decoding_done(pg)) handleDdjvu(TRUE);
+	if(ddjvu_page_decoding_error(pg)) {
+		ddjvu_page_release(pg);
+		return 0;
+	}
+	return pg;
+}
+
+void PDFDoc::getSidecarContents(pdf::PDFSidecar::Contents &contents) {
+	pdf::PDFSidecar::PageInfo unknown = { 0, 0, 0, 0 };
+	contents.pages.assign(nPages, unknown);
+	for(int i=0;i<nPages;i++) {
+		if(!g_atomic_int_get(&pageInfoReady[i])) continue;
+		contents.pages[i].width = pageInfos[i].width;
+		contents.pages[i].height = pageInfos[i].height;
+		contents.pages[i].dpi = pageInfos[i].dpi;
+		contents.pages[i].rotation = pageInfos[i].rotation;
+	}
+	// an empty outline means not known, the next open builds it
+	contents.outline.clear();
+	if(getOutline()) getOutline()->serialize(contents.outline);
+}
+
+void PDFDoc::publishPageInfo(int pageno, const PageInfo &pi) {
+	if(pageInfoReady[pageno]) return;
+	pageInfos[pageno] = pi;
+	// glib atomics are full barriers, the entry is written before the flag
+	g_atomic_int_set(&pageInfoReady[pageno], 1);
+	g_atomic_int_set(&lastPageInfo, pageno);
+}
+
+GBool PDFDoc::fetchPageInfo(int pageno) {
+	if(pageInfoReady[pageno]) return gTrue;
+	ddjvu_pageinfo_t info;
+	ddjvu_status_t r;
+	while((r=ddjvu_document_get_pageinfo(doc,pageno,&info)) < DDJVU_JOB_OK) handleDdjvu(TRUE);
+	if(r != DDJVU_JOB_OK || info.width <= 0 || info.height <= 0 || info.dpi <= 0) {
+		WARNPRINTF("No page info for page %d", pageno+1);
+		return gFalse;
+	}
+	PageInfo pi = { info.width, info.height, info.dpi, info.rotation };
+	publishPageInfo(pageno, pi);
+	return gTrue;
+}
+
+GBool PDFDoc::loadPageInfo(int page) {
+	if(twoPageMode) page = (page+1)/2;
+	if(page < 1 || page > nPages) return gFalse;
+	return fetchPageInfo(page-1);
+}
+
+GBool PDFDoc::prefetchPageInfo(int page) {
+	if(isPageInfoLoaded(page)) return gTrue;
+	pdf::Mutex* mtx = globalParams->getMutex();
+	mtx->lock();
+	GBool ok = loadPageInfo(page);
+	mtx->unlock();
+	return ok;
+}
+
+void PDFDoc::loadPageInfos(int count) {
+	pdf::Mutex* mtx = globalParams->getMutex();
+	mtx->lock();
+	// a page without info is skipped, it is estimated for good
+	int pageno = nextPageInfo;
+	for(; pageno < nPages && count > 0; pageno++) {
+		if(pageInfoReady[pageno]) continue;
+		fetchPageInfo(pageno);
+		count--;
+	}
+	g_atomic_int_set(&nextPageInfo, pageno);
+	mtx->unlock();
+}
+
+void PDFDoc::loadOutline() {
+	if(isOutlineReady()) return;
+	pdf::Mutex* mtx = globalParams->getMutex();
+	mtx->lock();
+	Outline *o = buildOutline(doc);
+	mtx->unlock();
+	g_atomic_pointer_set((volatile gpointer*)&outline, o);
+}
+
+GBool PDFDoc::isPageDecoded(int pageno) {
+	std::list<DecodedPage>::iterator it;
+	for(it = decoded.begin(); it != decoded.end(); ++it) {
+		if(it->pageno == pageno) return gTrue;
+	}
+	return gFalse;
+}
+
+GBool PDFDoc::prefetchPage(int page) {
+	if(twoPageMode) page = (page+1)/2;
+	if(page < 1 || page > nPages) return gFalse;
+	pdf::Mutex* mtx = globalParams->getMutex();
+	mtx->lock();
+	GBool ok = gTrue;
+	if(!isPageDecoded(page-1)) {
+		TRACE_EVENT_SCOPE(TRACE_STAGE, "decode_prefetch", page, 0);
+		ok = getDecodedPage(page-1) != 0;
+	}
+	mtx->unlock();
+	return ok;
+}
+
+ddjvu_render_mode_t PDFDoc::getRenderMode(int pageno, ddjvu_page_t *pg) {
+	if(pageModes[pageno] < 0) {
+		ddjvu_render_mode_t mode = DDJVU_RENDER_COLOR;
+		// the display mode the author picked wins over the page type
+		miniexp_t anno = ddjvu_document_get_pageanno(doc, pageno);
+		const char *hint = (anno != miniexp_nil && anno != miniexp_dummy) ? ddjvu_anno_get_mode(anno) : 0;
+		if(hint && strcmp(hint, "bw") == 0) mode = DDJVU_RENDER_BLACK;
+		else if(hint && strcmp(hint, "fore") == 0) mode = DDJVU_RENDER_FOREGROUND;
+		else if(hint && strcmp(hint, "back") == 0) mode = DDJVU_RENDER_BACKGROUND;
+		else if(!hint && ddjvu_page_get_type(pg) == DDJVU_PAGETYPE_BITONAL) mode = DDJVU_RENDER_BLACK;
+		if(anno != miniexp_nil && anno != miniexp_dummy) ddjvu_miniexp_release(doc, anno);
+		pageModes[pageno] = (signed char)mode;
+	}
+	return (ddjvu_render_mode_t)pageModes[pageno];
+}
+
+// cells of the link grid, across and down
+static const int LINK_GRID = 16;
+
+Links::Links(std::vector<Link*> &linksA, double width, double height) {
+	links.swap(linksA);
+	cols = rows = links.empty() ? 0 : LINK_GRID;
+	cellW = width > 0 ? width / LINK_GRID : 1.0;
+	cellH = height > 0 ? height / LINK_GRID : 1.0;
+	if(links.empty()) return;
+	// count the links overlapping every cell, then fill the cells in link
+	// order so that find gives the first link of the page
+	cellStart.assign(cols * rows + 1, 0);
+	std::vector<int> fill;
+	for(int pass=0;pass<2;pass++) {
+		if(pass == 1) {
+			for(int c=0;c<cols*rows;c++) cellStart[c+1] += cellStart[c];
+			cellLinks.resize(cellStart.back());
+			fill.assign(cellStart.begin(), cellStart.end() - 1);
+		}
+		for(int i=0;i<(int)links.size();i++) {
+			double x1, y1, x2, y2;
+			links[i]->getRect(&x1, &y1, &x2, &y2);
+			int c1 = cellOf(x1, cellW, cols), c2 = cellOf(x2, cellW, cols);
+			int r1 = cellOf(y1, cellH, rows), r2 = cellOf(y2, cellH, rows);
+			for(int r=r1;r<=r2;r++) for(int c=c1;c<=c2;c++) {
+				if(pass == 0) cellStart[r*cols+c+1]++;
+				else cellLinks[fill[r*cols+c]++] = i;
+			}
+		}
+	}
+}
+
+Links::~Links() {
+	for(int i=0;i<(int)links.size();i++) delete links[i];
+}
+
+unsigned int Links::getMemorySize() const {
+	// every link owns its destination and an empty name
+	unsigned int link = sizeof(Link) + sizeof(LinkDest) + sizeof(GooString) + sizeof(Link*);
+	return sizeof(*this) + links.size() * link +
+		(cellStart.capacity() + cellLinks.capacity()) * sizeof(int);
+}
+
+int Links::cellOf(double v, double size, int n) const {
+	int c = (int)(v / size);
+	if(c < 0) return 0;
+	return c < n ? c : n - 1;
+}
+
+int Links::find(double x, double y) const {
+	if(links.empty()) return -1;
+	int cell = cellOf(y, cellH, rows) * cols + cellOf(x, cellW, cols);
+	for(int k=cellStart[cell];k<cellStart[cell+1];k++) {
+		if(links[cellLinks[k]]->inRect(x, y)) return cellLinks[k];
+	}
+	return -1;
+}
+
+// a rectangle of the page image as stored to the page as shown, whose
+// size is pageWidth by pageHeight. Text and links both need this.
+static void rotateRect(int realRotate, int pageWidth, int pageHeight, int &x1, int &y1, int &x2, int &y2) {
+	if(realRotate == 1) {
+		int tmp1=y1;
+		int tmp2=y2;
+		y1=x1;//pageHeight-x1;
+		y2=x2; //pageHeight-x2;
+		x1=pageWidth-tmp2;
+		x2=pageWidth-tmp1;
+	} else if(realRotate == 3) {
+		int tmp1=y1;
+		int tmp2=y2;
+		y1=pageHeight-x2;
+		y2=pageHeight-x1;
+		x1=tmp1;
+		x2=tmp2;
+	} else if(realRotate == 2) {
+		int tmp1=x1;
+		x1=pageWidth-x2;
+		x2=pageWidth-tmp1;
+		tmp1=y1;
+		y1=pageHeight-y2;
+		y2=pageHeight-tmp1;
+	}
+}
+
+// bounding box of a maparea shape: (rect x y w h), (oval x y w h),
+// (text x y w h) or (poly x0 y0 x1 y1 ...). Lines aren't clickable.
+static bool getShapeBox(miniexp_t shape, int &x1, int &y1, int &x2, int &y2) {
+	if(!miniexp_consp(shape)) return false;
+	const char *kind = miniexp_to_name(miniexp_nth(0,shape));
+	if(!kind) return false;
+	if(strcmp(kind, "poly") == 0) {
+		bool any = false;
+		for(miniexp_t p = miniexp_cdr(shape); miniexp_consp(p) && miniexp_consp(miniexp_cdr(p)); p = miniexp_cdr(miniexp_cdr(p))) {
+			miniexp_t mx = miniexp_car(p), my = miniexp_car(miniexp_cdr(p));
+			if(!miniexp_numberp(mx) || !miniexp_numberp(my)) return false;
+			int x = miniexp_to_int(mx), y = miniexp_to_int(my);
+			if(!any || x < x1) x1 = x;
+			if(!any || x > x2) x2 = x;
+			if(!any || y < y1) y1 = y;
+			if(!any || y > y2) y2 = y;
+			any = true;
+		}
+		return any;
+	}
+	if(strcmp(kind, "rect") && strcmp(kind, "oval") && strcmp(kind, "text")) return false;
+	if(miniexp_length(shape) != 5) return false;
+	for(int i=1;i<5;i++) if(!miniexp_numberp(miniexp_nth(i,shape))) return false;
+	x1 = miniexp_to_int(miniexp_nth(1,shape));
+	y1 = miniexp_to_int(miniexp_nth(2,shape));
+	x2 = x1 + miniexp_to_int(miniexp_nth(3,shape));
+	y2 = y1 + miniexp_to_int(miniexp_nth(4,shape));
+	return true;
+}
+
+Links* PDFDoc::getLinks(int page) {
+	TRACE_EVENT_INSTANT(TRACE_DETAIL, "PDFDoc::getLinks", page, 0);
+	if(!pageLinks || page < 1 || page > getNumPages()) return 0;
+	volatile gpointer *slot = (volatile gpointer*)&pageLinks[page-1];
+	Links *l = (Links*)g_atomic_pointer_get(slot);
+	if(l) return l;
+	pdf::Mutex* mtx = globalParams->getMutex();
+	mtx->lock();
+	l = (Links*)g_atomic_pointer_get(slot);
+	if(!l) {
+		l = parseLinks(page);
+		g_atomic_int_add(&linksSize, (gint)l->getMemorySize());
+		g_atomic_pointer_set(slot, l);
+	}
+	mtx->unlock();
+	return l;
+}
+
+Links* PDFDoc::parseLinks(int page) {
+	TRACE_EVENT_SCOPE(TRACE_STAGE, "PDFDoc::parseLinks", page, 0);
+	loadPageInfo(page);
+	int pageWidth = getPageWidthPixels(page);
+	int pageHeight = getPageHeightPixels(page);
+	int realRotate = getPageRealRotate(page);
+	bool isLeftPage = page % 2 != 0;
+	int djvuPage = twoPageMode ? (page+1)/2 : page;
+	std::vector<Link*> links;
+	miniexp_t anno;
+	while((anno=ddjvu_document_get_pageanno(doc,djvuPage-1))==miniexp_dummy) handleDdjvu(TRUE);
+	if(anno == miniexp_nil) return new Links(links, pageWidth, pageHeight);
+	// every entry is (maparea url comment shape ...), the url either a
+	// string or (url href target). Only links into the document are kept.
+	miniexp_t *areas = ddjvu_anno_get_hyperlinks(anno);
+	for(int i=0;areas && areas[i];i++) {
+		miniexp_t url = miniexp_nth(1,areas[i]);
+		if(miniexp_consp(url)) url = miniexp_nth(1,url);
+		if(!miniexp_stringp(url)) continue;
+		const char *href = miniexp_to_str(url);
+		if(href[0] != '#') continue;
+		int target = 0;
+		if(href[1] == '+' || href[1] == '-') target = djvuPage + atoi(href+1);
+		else if(isdigit(href[1])) target = atoi(href+1);
+		else target = findPageByName(href+1);
+		if(target < 1 || target > nPages) continue;
+		int x1, y1, x2, y2;
+		if(!getShapeBox(miniexp_nth(3,areas[i]), x1, y1, x2, y2)) continue;
+		rotateRect(realRotate, pageWidth, pageHeight, x1, y1, x2, y2);
+		// a two page spread keeps the links of the half shown
+		if(twoPageMode && isLeftPage != (x1 + x2 < pageWidth)) continue;
+		links.push_back(new Link(x1, y1, x2, y2, target));
+	}
+	free(areas);
+	ddjvu_miniexp_release(doc, anno);
+	return new Links(links, pageWidth, pageHeight);
+}
+
+int PDFDoc::findPageByName(const char *name) {
+	if(!pageNamesLoaded) {
+		// ids first, insert keeps the first page of a key
+		for(int pass=0;pass<3;pass++) {
+			int n = ddjvu_document_get_filenum(doc);
+			for(int i=0;i<n;i++) {
+				ddjvu_fileinfo_t info;
+				ddjvu_status_t r;
+				while((r=ddjvu_document_get_fileinfo(doc,i,&info)) < DDJVU_JOB_OK) handleDdjvu(TRUE);
+				if(r != DDJVU_JOB_OK || info.type != 'P' || info.pageno < 0) continue;
+				const char *key = pass == 0 ? info.id : pass == 1 ? info.name : info.title;
+				if(key) pageNames.insert(std::make_pair(std::string(key), info.pageno + 1));
+			}
+		}
+		// a map node is about four pointers besides the pair
+		unsigned int size = 0;
+		std::map<std::string, int>::iterator name;
+		for(name = pageNames.begin(); name != pageNames.end(); ++name)
+			size += 4 * sizeof(void*) + sizeof(*name) + name->first.capacity() + 1;
+		g_atomic_int_add(&linksSize, (gint)size);
+		pageNamesLoaded = gTrue;
+	}
+	std::map<std::string, int>::iterator it = pageNames.find(name);
+	return it == pageNames.end() ? 0 : it->second;
+}
+
+unsigned int PDFDoc::getAuxSize() {
+	if(!ok) return 0;
+	unsigned int size = nPages * (sizeof(PageInfo) + sizeof(gint) + sizeof(signed char)) +
+		getNumPages() * sizeof(Links*);
+	Outline *o = getOutline();
+	if(o) size += o->getMemorySize();
+	return size;
+}
+
+void PDFDoc::setDecodedCacheLimit(unsigned int bytes) {
+	pdf::Mutex* mtx = globalParams->getMutex();
+	mtx->lock();
+	decodedLimit = bytes;
+	trimDecoded(bytes);
+	mtx->unlock();
+}
+
+unsigned int PDFDoc::trimDecodedCache(unsigned int limit) {
+	pdf::Mutex* mtx = globalParams->getMutex();
+	mtx->lock();
+	unsigned int before = decodedSize;
+	trimDecoded(limit);
+	unsigned int freed = before - decodedSize;
+	mtx->unlock();
+	return freed;
+}
+
+void PDFDoc::trimDecoded(unsigned int limit) {
+	while(decodedSize > limit && !decoded.empty()) {
+		DecodedPage &d = decoded.back();
+		ddjvu_page_release(d.page);
+		decodedSize -= d.size;
+		decoded.pop_back();
+	}
+}
 
 RenderRet PDFDoc::displayPage(OutputDev *out, int page, double hDPI, double vDPI,
 		int rotate, GBool useMediaBox, GBool crop, GBool printing,
@@ -151,38 +609,92 @@ RenderRet PDFDoc::displayPage(OutputDev *out, int page, double hDPI, double vDPI
 		void* abortCheckCbkData,
 		GBool (*annotDisplayDecideCbk) (Annot* annot, void *user_data),
 		void *annotDisplayDecideCbkData) {
+			// don't even wait for the lock when the render is no longer wanted
+			if(abortCheckCbk && abortCheckCbk(abortCheckCbkData)) return Render_Abort;
 			pdf::Mutex* mtx = globalParams->getMutex();
 			mtx->lock();
+			out->setAbortCheck(abortCheckCbk, abortCheckCbkData);
 			out->renderPage(page, this, hDPI, vDPI, rotate, useMediaBox, crop, printing);			
+			GBool aborted = out->wasAborted();
+			out->setAbortCheck(0, 0);
 			mtx->unlock();
-			return Render_Done;
+			return aborted ? Render_Abort : Render_Done;
 		}
 
+// restrict max size for wonky dpi settings
+static void clampBitmapSize(unsigned int *w, unsigned int *h) {
+	if(*w > 2000) { *h = (*h * 2000) / *w; *w = 2000; }
+	if(*h > 2500) { *w = (*w * 2500) / *h; *h = 2500; }
+}
+
+void SplashOutputDev::getBitmapSize(PDFDoc *doc, int page, double hDPI, double vDPI, int *w, int *h) {
+	unsigned int pw = (int)(doc->getPageCropWidth(page) * hDPI / 72.0);
+	unsigned int ph = (int)(doc->getPageCropHeight(page) * vDPI / 72.0);
+	clampBitmapSize(&pw, &ph);
+	*w = pw;
+	*h = ph;
+}
+
+// render a part of a page into a new bitmap of colorMode (Mono8, Mono1
+// or RGB8), 0 if ddjvu can't do it in this render mode
+static SplashBitmap *renderRect(ddjvu_page_t *pg, ddjvu_render_mode_t mode, SplashColorMode colorMode,
+							ddjvu_rect_t *prect, ddjvu_rect_t *rrect) {
+	ddjvu_format_style_t style = DDJVU_FORMAT_GREY8;
+	if(colorMode == splashModeRGB8) style = DDJVU_FORMAT_RGB24;
+	else if(colorMode == splashModeMono1) style = DDJVU_FORMAT_MSBTOLSB;
+	SplashBitmap *bmp = new SplashBitmap(rrect->w, rrect->h, colorMode);
+	ddjvu_format_t *fmt = ddjvu_format_create(style, 0, 0);
+	ddjvu_format_set_row_order(fmt, 1);
+	int rendered = ddjvu_page_render(pg, mode, prect, rrect, fmt, bmp->getRowSize(), (char*)bmp->getDataPtr());
+	ddjvu_format_release(fmt);
+	if(!rendered) {
+		delete bmp;
+		return 0;
+	}
+	// ddjvu sets the bits of black pixels, white is 1 in Mono1
+	if(colorMode == splashModeMono1) {
+		unsigned char *data = bmp->getDataPtr();
+		for(int i = bmp->getRowSize() * bmp->getHeight() - 1; i >= 0; i--) data[i] = ~data[i];
+	}
+	return bmp;
+}
+
 void SplashOutputDev::renderPage(int page, PDFDoc *doc, double hDPI, double vDPI,
 							int rotate, GBool useMediaBox, GBool crop, GBool printing) {
 
-			WARNPRINTF("SplashOutputDev::renderPage, page: %d, hDPI: %f, vDPI: %f, rotate: %d (stub)", page, hDPI, vDPI, rotate);
+			TRACE_EVENT_SCOPE(TRACE_STAGE, "SplashOutputDev::renderPage", page, 0);
+			doc->loadPageInfo(page); // the size is exact from here on
+			int pageWidth = doc->getPageWidthPixels(page);
+			int pageHeight = doc->getPageHeightPixels(page);
 			ddjvu_rect_t prect;
 			prect.x = 0;
 			prect.y = 0;
 			prect.w = (int)(doc->getPageCropWidth(page) * hDPI / 72.0);
-			prect.h = (int)(doc->getPageCropHeight(page) * vDPI / 72.0);								
+			prect.h = (int)(doc->getPageCropHeight(page) * vDPI / 72.0);
+			clampBitmapSize(&prect.w, &prect.h);
+			// the scale of what is really rendered, after the clamping. The
+			// height is the whole page in two page mode too.
+			double scale = (double)prect.h / pageHeight;
 			bool leftPage = page % 2 != 0;
 			if(doc->isTwoPageMode()) page = (page+1)/2;
-			ddjvu_page_t *pg = ddjvu_page_create_by_pageno(doc->getDoc(), page-1);
-			while (!ddjvu_page_decoding_done(pg)) handleDdjvu(TRUE);
-
-			// restrict max size for wonky dpi settings
-			if(prect.w > 2000) { prect.h = (prect.h * 2000) / prect.w; prect.w = 2000; }
-			if(prect.h > 2500) { prect.w = (prect.w * 2500) / prect.h; prect.h = 2500; }
-			SplashBitmap *bmp = new SplashBitmap(prect.w, prect.h);
-			unsigned char *data = bmp->getDataPtr();
-			ddjvu_format_style_t style = DDJVU_FORMAT_GREY8;
-			ddjvu_render_mode_t mode = DDJVU_RENDER_COLOR;
-			ddjvu_format_t *fmt;
-			fmt = ddjvu_format_create(style, 0, 0);
-			ddjvu_format_set_row_order(fmt, 1);
-			int rowsize = prect.w;
+			bitonal = gFalse;
+			ddjvu_page_t *pg;
+			// a page somebody else has decoded is used from the cache anyway
+			decodeCached = doc->isPageDecoded(page-1);
+			GBool cached = cacheDecoded || decodeCached;
+			long long t0 = trace::now();
+			{
+				TRACE_EVENT_SCOPE(TRACE_STAGE, "decode", page, 0);
+				pg = cached ? doc->getDecodedPage(page-1) : doc->decodePage(page-1); // owned by the decoded pages cache if cached
+			}
+			decodeTime = (int)(trace::now() - t0);
+			rasterTime = 0;
+			// the decoded page stays cached, only the raster step is skipped
+			if(checkAbort()) {
+				if(pg && !cached) ddjvu_page_release(pg);
+				return;
+			}
+
 			ddjvu_rect_t rrect;
 			rrect.y = 0;
 			rrect.h = prect.h;
@@ -194,32 +706,51 @@ void SplashOutputDev::renderPage(int page, PDFDoc *doc, double hDPI, double vDPI
 				rrect.x = 0;
 				rrect.w = prect.w;
 			}
-			if(!ddjvu_page_render(pg, mode, &prect, &rrect, fmt, rowsize, (char*)data)) {
-				unsigned char white = 0xFF;
-				memset(data, white, rowsize * prect.h);
+			setDefCTM((double)prect.w / pageWidth, (double)prect.h / pageHeight, rrect.x, prect.h);
+
+			// text only pages skip the compositing and go straight to a 1 bit
+			// mask, unless that loses the anti-aliasing of a reduction
+			ddjvu_render_mode_t mode = pg ? doc->getRenderMode(page-1, pg) : DDJVU_RENDER_COLOR;
+			bitonal = mode == DDJVU_RENDER_BLACK && (colorMode == splashModeMono1 || scale >= 1.0);
+			SplashBitmap *bmp = 0;
+			t0 = trace::now();
+			if(pg) {
+				TRACE_EVENT_SCOPE(TRACE_STAGE, "ddjvu_page_render", page, 0);
+				if(bitonal) bmp = renderRect(pg, DDJVU_RENDER_MASKONLY, splashModeMono1, &prect, &rrect);
+				bitonal = bmp != 0;
+				if(!bmp) bmp = renderRect(pg, mode, colorMode == splashModeRGB8 ? splashModeRGB8 : splashModeMono8, &prect, &rrect);
+			}
+			rasterTime = (int)(trace::now() - t0);
+			if(pg && !cached) ddjvu_page_release(pg);
+			if(!bmp) {
+				bmp = new SplashBitmap(rrect.w, rrect.h, colorMode == splashModeRGB8 ? splashModeRGB8 : splashModeMono8);
+				memset(bmp->getDataPtr(), 0xFF, bmp->getRowSize() * bmp->getHeight());
 				WARNPRINTF("PDFDoc::displayPage: error displaying DjVu page %d, showing white bitmap", page);
 				// ddjvu_context_t *ctx = globalParams->getContext();
 				// ddjvu_message_t *msg = ddjvu_message_peek(ctx);
 				// if(msg && msg->m_any.tag == DDJVU_ERROR) WARNPRINTF("ddjvu: %s\n", msg->m_error.message);
 			}
-			ddjvu_format_release(fmt);
-			ddjvu_page_release(pg);
-			// bitmap improvement?
-			// experimental!
-			// int w = (int)rrect.w;
-			// for(int i=w*(rrect.h-1)-2;i>=w;i--) {
-				// data[i] = (unsigned char)(256.0 * pow((data[i]/256.0),1.7));
-				//if(data[i-1] > data[i] && data[i+1] > data[i]) data[i] >>= 1;
-				// if(data[i-1] > data[i] && data[i+1] > data[i] && data[i+w] < 192 && data[i-w] < 192) data[i] >>= 1;
-				//if(data[i] > 128) data[i] = 192 + (data[i]-128)/2;
-				//else data[i] = data[i]/2;
-			// }
-			// end of bitmap improvement
+			// gamma, contrast and darkening are applied by PDFPage, see post_process_bitmap
 			setBitmap(bmp);
 		}
 
 
 
+void SplashOutputDev::setDefCTM(double sx, double sy, double x0, double h) {
+	defCtm[0] = sx;
+	defCtm[1] = 0.0;
+	defCtm[2] = 0.0;
+	defCtm[3] = -sy;
+	defCtm[4] = -x0;
+	defCtm[5] = h;
+	defIctm[0] = 1.0 / sx;
+	defIctm[1] = 0.0;
+	defIctm[2] = 0.0;
+	defIctm[3] = -1.0 / sy;
+	defIctm[4] = x0 / sx;
+	defIctm[5] = h / sy;
+}
+
 void addWords(miniexp_t exp, std::vector<TextWord*> &words, double svDPI, double shDPI, int pageWidth, int pageHeight, int realRotate) {
 	if(!miniexp_consp(exp)) {
 		// WARNPRINTF("Not a list or empty list!");
@@ -249,28 +780,7 @@ void addWords(miniexp_t exp, std::vector<TextWord*> &words, double svDPI, double
 				//double d = pDPI;
 				// PDFRectangle rect = PDFRectangle(72*x1/d,72*y1/d,72*x2/d,72*y2/d);  // fixme scale location?
 				// fixme incorrect calculation!
-				if(realRotate == 1) { // fixme move to separate function
-					int tmp1=y1;
-					int tmp2=y2;
-					y1=x1;//pageHeight-x1;
-					y2=x2; //pageHeight-x2;
-					x1=pageWidth-tmp2;
-					x2=pageWidth-tmp1;
-				} else if(realRotate == 3) {
-					int tmp1=y1;
-					int tmp2=y2;
-					y1=pageHeight-x2;
-					y2=pageHeight-x1;
-					x1=tmp1;
-					x2=tmp2;
-				} else if(realRotate == 2) {
-					int tmp1=x1;
-					x1=pageWidth-x2;
-					x2=pageWidth-tmp1;
-					tmp1=y1;
-					y1=pageHeight-y2;
-					y2=pageHeight-tmp1;
-				}
+				rotateRect(realRotate, pageWidth, pageHeight, x1, y1, x2, y2);
 				PDFRectangle rect = PDFRectangle(shDPI*x1-1,svDPI*(pageHeight-y2)-1,shDPI*x2+1,svDPI*(pageHeight-y1)+1);  // fixme scale location?
 				words.push_back(new TextWord(word, &rect));
 			   } else {
@@ -302,7 +812,8 @@ TextWordList *makeWordList(miniexp_t exp, double svDPI, double shDPI, int pageWi
 
 void TextOutputDev::renderPage(int page, PDFDoc *doc, double hDPI, double vDPI,
 							int rotate, GBool useMediaBox, GBool crop, GBool printing) {
-	WARNPRINTF("TextOutputDev::renderPage, page: %d, hDPI: %f, vDPI: %f, rotate: %d (stub)", page, hDPI, vDPI, rotate);
+	TRACE_EVENT_SCOPE(TRACE_STAGE, "TextOutputDev::renderPage", page, 0);
+	doc->loadPageInfo(page);
 
 	double shDPI = hDPI / doc->getPageDPI(page);
 	double svDPI = vDPI / doc->getPageDPI(page);
@@ -345,16 +856,37 @@ void TextOutputDev::renderPage(int page, PDFDoc *doc, double hDPI, double vDPI,
 	//WARNPRINTF("RenderPage done");
 }
 								
-SplashBitmap::SplashBitmap(int wa, int ha) {
+int splashColorModeBits(SplashColorMode mode) {
+	switch(mode) {
+		case splashModeMono4: return 4;
+		case splashModeMono2: return 2;
+		case splashModeMono1: return 1;
+		case splashModeRGB8: return 24;
+		default: return 8;
+	}
+}
+
+SplashColorMode splashColorModeForBits(int bits) {
+	switch(bits) {
+		case 4: return splashModeMono4;
+		case 2: return splashModeMono2;
+		case 1: return splashModeMono1;
+		case 24: return splashModeRGB8;
+		default: return splashModeMono8;
+	}
+}
+
+SplashBitmap::SplashBitmap(int wa, int ha, SplashColorMode modea) {
 	// WARNPRINTF("creating SplashBitmap: w=%d h=%d", wa,ha);
-	data = new unsigned char[wa*ha];
 	w = wa;
 	h = ha;
-	rowSize = wa;
+	mode = modea;
+	rowSize = (wa * splashColorModeBits(modea) + 7) / 8;
+	data = new unsigned char[rowSize*ha];
 }
 
 SplashBitmap *SplashOutputDev::takeBitmap() {
-	WARNPRINTF("SplashOutputDev::takeBitmap");
+	TRACE_EVENT_INSTANT(TRACE_DETAIL, "SplashOutputDev::takeBitmap", -1, 0);
 	if(bmp) {
 		SplashBitmap *tmp = bmp;
 		bmp = 0;
@@ -364,7 +896,7 @@ SplashBitmap *SplashOutputDev::takeBitmap() {
 }
 
 TextPage *TextOutputDev::takeText() {
-	WARNPRINTF("TextOutputDev::takeText");
+	TRACE_EVENT_INSTANT(TRACE_DETAIL, "TextOutputDev::takeText", -1, 0);
 	if(text) {
 		TextPage *tmp = text;
 		text = 0;
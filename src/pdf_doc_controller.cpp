@@ -28,6 +28,8 @@
 #include "pdf_doc_controller.h"
 #include "pdf_render_task.h"
 #include "pdf_search_task.h"
+#include "pdf_content_area_task.h"
+#include "pdf_metadata_task.h"
 #include "pdf_anchor.h"
 
 #ifdef WIN32
@@ -44,6 +46,21 @@ void * StandardSecurityHandler::getAuthData()
 namespace pdf
 {
 
+// The metadata task waits this long after open, in us, so that the first
+// page request comes first
+static const long long METADATA_DELAY = 500 * 1000LL;
+
+// The part of the memory limit for decoded pages, in eighths: where it
+// starts and how far rebalancing may move it
+static const int DECODE_EIGHTHS_DEFAULT = 2;
+static const int DECODE_EIGHTHS_MIN = 1;
+static const int DECODE_EIGHTHS_MAX = 4;
+
+// Bitmap lookups between two rebalances, and the difference in hit rate,
+// in percent, that moves an eighth over
+static const unsigned int REBALANCE_WINDOW = 32;
+static const unsigned int REBALANCE_MARGIN = 20;
+
 // Wrap the global parameters, it is a sigleton class
 class PDFGlobalParams
 {
@@ -84,8 +101,22 @@ PDFController::PDFController(void)
 , current_page_num(1)
 , searcher(this)
 , file_name()
-, prerender_policy(new PDFPrerenderPolicyNormal)
-{
+, prerender_policy(new PDFPrerenderPolicyAdaptive)
+, stats(&PDFLibrary::instance().get_stats())
+, content_areas()
+, background_task_queued(0)
+, background_enabled(0)
+, sidecar()
+, memory_limit(0)
+, decode_eighths(DECODE_EIGHTHS_DEFAULT)
+, reported_links(0)
+, reported_aux(0)
+, window_bitmap_hits(0)
+, window_bitmap_lookups(0)
+, window_decode_hits(0)
+, window_decode_lookups(0)
+{
+    pages_cache.set_stats(&stats);
     PDFLibrary::instance().add_document(this);
 }
 
@@ -99,6 +130,10 @@ PDFController::~PDFController(void)
         close();
     }
 
+    // empty the cache while the gauges it updates are still there
+    pages_cache.clear();
+    pages_cache.set_stats(0);
+
     delete prerender_policy;
 }
 
@@ -115,8 +150,9 @@ PluginStatus PDFController::open(const string &path)
 
     GooString * name = new GooString(path.c_str());
 
-    // create PDFDoc instance
-    pdf_doc = new PDFDoc(name);
+    // create PDFDoc instance, with what is known from the last time
+    sidecar.open(path.c_str());
+    pdf_doc = new PDFDoc(name, &sidecar);
 
     if (!pdf_doc->isOk())
     {
@@ -129,27 +165,96 @@ PluginStatus PDFController::open(const string &path)
         return PLUGIN_ERROR_OPEN_FILE;
     }
 
+    // the limit may have been set before the document was opened
+    if (memory_limit > 0)
+    {
+        apply_memory_split();
+    }
+    PDFLibrary::instance().share_memory(this);
+
     // set the file name
     file_name = path;
+
+    // the content areas are found after the first page has been rendered
+    content_areas.reset(page_count());
+    if (sidecar.get_area_count() == static_cast<int>(page_count()))
+    {
+        content_areas.load(sidecar.get_content_areas(), page_count());
+    }
+
+    // the outline and the page infos are loaded in the background
+    g_atomic_int_set(&background_task_queued, 0);
+    g_atomic_int_set(&background_enabled, 1);
+    post_background_task(METADATA_DELAY);
     return PLUGIN_OK;
 }
 
 bool PDFController::close()
 {
-    // remove all of the tasks related to this document
+    // no more background tasks from here on
+    g_atomic_int_set(&background_enabled, 0);
+
+    // remove all of the tasks related to this document. A task running
+    // meanwhile may have queued a background task before that, the
+    // second pass removes that one.
     PDFLibrary::instance().remove_tasks_by_document(this);
+    PDFLibrary::instance().remove_tasks_by_document(this);
+
+    std::vector<unsigned short> areas;
+    int known_areas = content_areas.dump(areas);
+    content_areas.reset(0);
 
     renderer.destroy();
 
+    // the governor may be evicting from pdf_doc for another document,
+    // this waits until it is done
+    PDFLibrary::instance().unshare_memory(this);
+
     if (pdf_doc != 0)
     {
+        save_sidecar(areas, known_areas);
         delete pdf_doc;
         pdf_doc = 0;
     }
+    sidecar.close();
+    account_document_memory();
 
     return true;
 }
 
+void PDFController::save_sidecar(std::vector<unsigned short> &areas, int known_areas)
+{
+    if (!pdf_doc->isOk())
+    {
+        return;
+    }
+
+    PDFSidecar::Contents contents;
+    pdf_doc->getSidecarContents(contents);
+    int known_pages = 0;
+    for (size_t i = 0; i < contents.pages.size(); ++i)
+    {
+        if (contents.pages[i].width > 0)
+        {
+            ++known_pages;
+        }
+    }
+
+    // the sidecar has all of it already
+    unsigned int outline_size = 0;
+    sidecar.get_outline(outline_size);
+    if (sidecar.is_open() &&
+        known_pages <= sidecar.get_known_pages() &&
+        known_areas <= sidecar.get_known_areas() &&
+        (outline_size > 0 || contents.outline.empty()))
+    {
+        return;
+    }
+
+    contents.areas.swap(areas);
+    PDFSidecar::save(file_name.c_str(), contents);
+}
+
 PDFToc * PDFController::get_toc(void)
 {
     return &toc;
@@ -209,23 +314,11 @@ bool PDFController::get_hyperlinks_in_page(int page_num,
                                            PDFAnchor *end_param,
                                            PDFRangeCollection &results)
 {
-    PagePtr page = get_page(page_num);
-    Links *links = 0;
-    bool destroy_links = false;
-    bool ret = true;
-    if (page == 0 || page->get_links() == 0)
+    // the links are parsed once per page and owned by the PDFDoc
+    Links *links = pdf_doc->getLinks(page_num);
+    if (links == 0 || links->getNumLinks() <= 0)
     {
-        links = pdf_doc->generateLinks(page_num);
-        destroy_links = true;
-    }
-    else
-    {
-        links = page->get_links();
-    }
-
-    if (links->getNumLinks() <= 0)
-    {
-        ret = false;
+        return false;
     }
 
     // get all of the hyperlinks from this page
@@ -250,12 +343,7 @@ bool PDFController::get_hyperlinks_in_page(int page_num,
         }
     }
 
-    if (destroy_links)
-    {
-        delete links;
-        links = 0;
-    }
-    return ret;
+    return true;
 }
 
 PDFCollectionBase* PDFController::get_hyperlinks_from_range(const string &start,
@@ -462,18 +550,68 @@ bool PDFController::get_page_content_area(const string &anchor, RenderArea &area
         return false;
     }
 
-    PagePtr page = get_page(page_number);
+    if (content_areas.get(page_number, area))
+    {
+        return true;
+    }
+
+    // not found by the background task yet, the page is rendered whole
+    // until it is, as calc_real_zoom does
+    area.x_offset = 0.0f;
+    area.y_offset = 0.0f;
+    area.width    = 1.0f;
+    area.height   = 1.0f;
+    post_background_task();
+    return true;
+}
 
-    if (page == 0)
+void PDFController::outline_loaded()
+{
+    // UDS asks for the marker trees again
+    sig_metadata_ready.broadcast();
+}
+
+void PDFController::page_infos_loaded()
+{
+    // UDS asks for the geometry of the pages it laid out from estimates
+    sig_metadata_ready.broadcast();
+}
+
+void PDFController::post_background_task(long long delay)
+{
+    if (!g_atomic_int_get(&background_enabled) ||
+        (pdf_doc->isMetadataReady() && content_areas.is_complete()) ||
+        !g_atomic_int_compare_and_exchange(&background_task_queued, 0, 1))
     {
-        return false;
+        return;
+    }
+
+    // behind the prerendering, any other task aborts it. A visible page
+    // waiting for its content area goes ahead of the metadata.
+    Task *task = 0;
+    if (!pdf_doc->isMetadataReady() && renderer.get_cropping_page() <= 0)
+    {
+        task = new PDFMetadataTask(this);
+    }
+    else
+    {
+        task = new PDFContentAreaTask(this);
     }
 
-    return page->get_content_area(&renderer, area);
+    if (delay > 0)
+    {
+        task->set_not_before(PDFStats::now() + delay);
+    }
+    if (!PDFLibrary::instance().get_thread().append_task(task))
+    {
+        delete task;
+        g_atomic_int_set(&background_task_queued, 0);
+    }
 }
 
 bool PDFController::make_enough_memory(const int page_num, const int length)
 {
+    account_document_memory();
     return pages_cache.make_enough_memory(page_num, length);
 }
 
@@ -482,9 +620,167 @@ void PDFController::clear_cached_bitmaps()
     pages_cache.clear_cached_bitmaps();
 }
 
-void PDFController::update_memory_usage(const int length)
+void PDFController::update_memory_usage(const int length,
+                                        const MemoryCategory category)
 {
-    pages_cache.update_mem_usage(length);
+    pages_cache.update_mem_usage(length, category);
+}
+
+// Move the length reported for a category to length. Threads that get
+// here together report the change once.
+static void report_length(PagesCache &cache,
+                          volatile gint &reported,
+                          const int length,
+                          const MemoryCategory category)
+{
+    gint old = g_atomic_int_get(&reported);
+    while (old != length)
+    {
+        if (g_atomic_int_compare_and_exchange(&reported, old, length))
+        {
+            cache.update_mem_usage(length - old, category);
+            return;
+        }
+        old = g_atomic_int_get(&reported);
+    }
+}
+
+void PDFController::account_document_memory()
+{
+    // the links and the outline are built by pdf_doc as they are needed,
+    // it only keeps their size, so pick it up here
+    int links = 0;
+    int aux = content_areas.memory_length();
+    if (pdf_doc)
+    {
+        links = static_cast<int>(pdf_doc->getLinksSize());
+        aux += static_cast<int>(pdf_doc->getAuxSize());
+    }
+    report_length(pages_cache, reported_links, links, MEMORY_LINKS);
+    report_length(pages_cache, reported_aux, aux, MEMORY_AUX);
+}
+
+void PDFController::trim_text(const int page_num)
+{
+    int limit = static_cast<int>(pages_cache.size());
+    int over = pages_cache.get_total_length() - limit;
+    if (limit == 0 || over <= 0)
+    {
+        return;
+    }
+    pages_cache.shrink_text(pages_cache.get_length(MEMORY_TEXT) - over, page_num);
+}
+
+int PDFController::get_memory_usage()
+{
+    account_document_memory();
+    return pages_cache.get_total_length() + get_decode_usage();
+}
+
+int PDFController::shrink_memory(const int target, const int page_num)
+{
+    // the decoded pages go first: they only save decoding time on a
+    // render to come, the bitmaps are what is shown next
+    int freed = 0;
+    if (pdf_doc)
+    {
+        int cached = pages_cache.get_total_length();
+        unsigned int keep = target > cached ? target - cached : 0;
+        freed += static_cast<int>(pdf_doc->trimDecodedCache(keep));
+    }
+
+    int cache_target = target - get_decode_usage();
+    freed += pages_cache.shrink(cache_target > 0 ? cache_target : 0, page_num);
+    return freed;
+}
+
+int PDFController::get_decode_limit()
+{
+    if (memory_limit == 0)
+    {
+        return pdf_doc ? static_cast<int>(pdf_doc->getDecodedCacheLimit()) : 0;
+    }
+    return static_cast<int>(memory_limit / 8 * g_atomic_int_get(&decode_eighths));
+}
+
+int PDFController::get_decode_usage()
+{
+    return pdf_doc ? static_cast<int>(pdf_doc->getDecodedCacheSize()) : 0;
+}
+
+void PDFController::rebalance_memory()
+{
+    if (memory_limit == 0)
+    {
+        return;
+    }
+
+    unsigned int bitmap_hits    = stats.get_counter(COUNTER_CACHE_HIT);
+    unsigned int bitmap_lookups = bitmap_hits + stats.get_counter(COUNTER_CACHE_MISS);
+    unsigned int decode_hits    = stats.get_counter(COUNTER_DECODE_HIT);
+    unsigned int decode_lookups = decode_hits + stats.get_counter(COUNTER_DECODE_MISS);
+
+    // start a new window when the statistics have been reset
+    if (bitmap_lookups < window_bitmap_lookups ||
+        decode_lookups < window_decode_lookups)
+    {
+        window_bitmap_lookups = 0;
+        window_bitmap_hits    = 0;
+        window_decode_lookups = 0;
+        window_decode_hits    = 0;
+    }
+
+    unsigned int lookups = bitmap_lookups - window_bitmap_lookups;
+    if (lookups < REBALANCE_WINDOW)
+    {
+        return;
+    }
+
+    unsigned int decodes = decode_lookups - window_decode_lookups;
+    unsigned int bitmap_rate = (bitmap_hits - window_bitmap_hits) * 100 / lookups;
+    unsigned int decode_rate = decodes > 0 ?
+        (decode_hits - window_decode_hits) * 100 / decodes : 0;
+
+    window_bitmap_hits    = bitmap_hits;
+    window_bitmap_lookups = bitmap_lookups;
+    window_decode_hits    = decode_hits;
+    window_decode_lookups = decode_lookups;
+
+    // When the bitmaps serve most requests, the decoded pages are rarely
+    // used again and give their memory up. When renders keep finding
+    // their page decoded (zooming, previews), it goes the other way.
+    int eighths = g_atomic_int_get(&decode_eighths);
+    if (bitmap_rate >= decode_rate + REBALANCE_MARGIN && eighths > DECODE_EIGHTHS_MIN)
+    {
+        --eighths;
+    }
+    else if (decode_rate >= bitmap_rate + REBALANCE_MARGIN && eighths < DECODE_EIGHTHS_MAX)
+    {
+        ++eighths;
+    }
+    else
+    {
+        return;
+    }
+
+    LOGPRINTF("Bitmap hits %u%%, decode hits %u%%, decoding gets %d/8",
+              bitmap_rate, decode_rate, eighths);
+    g_atomic_int_set(&decode_eighths, eighths);
+    stats.inc(COUNTER_DECODE_SHARE);
+    apply_memory_split();
+}
+
+bool PDFController::apply_memory_split()
+{
+    int decode = get_decode_limit();
+    if (pdf_doc)
+    {
+        pdf_doc->setDecodedCacheLimit(static_cast<unsigned int>(decode));
+    }
+
+    // libdjvu's own cache takes what the decoded pages leave
+    PDFLibrary::instance().update_ddjvu_cache();
+    return pages_cache.reset(memory_limit - decode);
 }
 
 bool PDFController::get_page_crop_width(const string &anchor, double &width)
@@ -590,9 +886,10 @@ bool PDFController::set_memory_limit(const unsigned int bytes)
     // clear all of the render tasks related to this document
     PDFLibrary::instance().thread_cancel_render_tasks(this);
 
-    int size = static_cast<int>(bytes >> 1);
-    TRACE("Set memory:%d to document:%s\n", size, file_name.c_str());
-    return pages_cache.reset(size);
+    // half of it is for the plugin, shared by the bitmaps and decoding
+    memory_limit = bytes >> 1;
+    TRACE("Set memory:%u to document:%s\n", memory_limit, file_name.c_str());
+    return apply_memory_split();
 }
 
 unsigned int PDFController::get_memory_limit()
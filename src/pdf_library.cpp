@@ -27,32 +27,17 @@
 #include "pdf_library.h"
 #include "pdf_doc_controller.h"
 
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <sys/sysinfo.h>
-#endif
+#include <stdlib.h>
 
 namespace pdf
 {
 
-unsigned long get_system_free_memory()
-{
-#ifdef _WIN32
-    MEMORYSTATUS info;
-    GlobalMemoryStatus(&info);
-    return info.dwAvailPhys;
-#else
-    struct sysinfo info;
-    sysinfo(&info);
-    return info.freeram * info.mem_unit;
-#endif
-}
-
 PDFLibrary::PDFLibrary()
 : docs()
 , thread()
 , size_limit(DEFAULT_SIZE_LIMIT)
+, governor()
+, stats()
 {
     // start the task executing thread
     thread.start();
@@ -93,17 +78,14 @@ bool PDFLibrary::make_enough_memory(PDFController *doc_ptr,
         return false;
     }
 
-    // check the free memory in system
-    unsigned long free_mem = get_system_free_memory();
-    if (free_mem < static_cast<unsigned long>(length << 1))
-    {
-        // release all of the cached bitmaps
-        DocumentsIter idx = docs.begin();
-        for (; idx != docs.end(); ++idx)
-        {
-            (*idx)->clear_cached_bitmaps();
-        }
-    }
+    StatsTimer timer(doc_ptr->get_stats(), STAGE_EVICTION);
+
+    // keep all documents together within what the system can spare,
+    // evicting from the other documents first. The budget is a target:
+    // the page asked for is still rendered if the document's own limit
+    // allows, only that limit can refuse it.
+    doc_ptr->rebalance_memory();
+    governor.make_room(doc_ptr, page_num, length);
 
     return doc_ptr->make_enough_memory(page_num, length);
 }
@@ -121,6 +103,7 @@ void PDFLibrary::remove_tasks_by_document(PDFController *doc)
 
 void PDFLibrary::remove_document(PDFController *doc_ptr)
 {
+    governor.remove_document(doc_ptr);
     DocumentsIter idx = std::find(docs.begin(), docs.end(), doc_ptr);
     if (idx != docs.end())
     {
@@ -152,6 +135,27 @@ void PDFLibrary::thread_cancel_render_tasks(void *user_data)
     get_thread().clear_all(user_data, TASK_RENDER);
 }
 
+void PDFLibrary::dump_stats_if_requested()
+{
+    const char *path = getenv("UDS_PLUGIN_STATS");
+    if (path == 0 || *path == 0)
+    {
+        return;
+    }
+
+    FILE *fp = fopen(path, "w");
+    if (fp == 0)
+    {
+        ERRORPRINTF("Cannot write statistics to %s", path);
+        return;
+    }
+
+    std::string output;
+    stats.dump("library", output);
+    fputs(output.c_str(), fp);
+    fclose(fp);
+}
+
 }
 
 
@@ -0,0 +1,409 @@
+/*
+ * File Name: pdf_memory_governor.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/sysinfo.h>
+#endif
+
+#include "log.h"
+#include "pdf_memory_governor.h"
+#include "pdf_doc_controller.h"
+
+namespace pdf
+{
+
+// how often the system state is read again, in us
+static const long long SAMPLE_INTERVAL = 1000000;
+
+// memory left to the system and UDS, whatever the plugin may cache
+static const long long MEMORY_RESERVE = 16 * 1024 * 1024;
+
+// PSI levels, percent of time stalled over 10s, at which the budget is
+// cut to three quarters and to half of what is used
+static const int PRESSURE_SOME = 10;
+static const int PRESSURE_HIGH = 40;
+
+static const char * CGROUP_ROOT = "/sys/fs/cgroup";
+
+// bounds of the ddjvu context cache; libdjvu's own default is 10MB
+static const long long DDJVU_CACHE_MIN = 1 * 1024 * 1024;
+static const long long DDJVU_CACHE_MAX = 10 * 1024 * 1024;
+
+// read a small text file into buf, false if it can't be read
+static bool read_file(const std::string & path, char *buf, const size_t size)
+{
+    FILE *fp = fopen(path.c_str(), "r");
+    if (fp == 0)
+    {
+        return false;
+    }
+    size_t len = fread(buf, 1, size - 1, fp);
+    fclose(fp);
+    buf[len] = 0;
+    return len > 0;
+}
+
+// a memory.max or memory.current value, -1 for "max" or an error
+static long long read_cgroup_value(const std::string & path)
+{
+    char buf[64];
+    long long value = -1;
+    if (!read_file(path, buf, sizeof(buf)) ||
+        sscanf(buf, "%lld", &value) != 1)
+    {
+        return -1;
+    }
+    return value;
+}
+
+// the inactive file pages of a cgroup, which are reclaimed before it
+// gets anywhere near its limit
+static long long read_cgroup_inactive_file(const std::string & dir)
+{
+    char buf[4096];
+    if (!read_file(dir + "/memory.stat", buf, sizeof(buf)))
+    {
+        return 0;
+    }
+    const char *line = strstr(buf, "inactive_file ");
+    long long value = 0;
+    if (line == 0 || sscanf(line, "inactive_file %lld", &value) != 1)
+    {
+        return 0;
+    }
+    return value;
+}
+
+static long long system_free_memory()
+{
+#ifdef _WIN32
+    MEMORYSTATUS info;
+    GlobalMemoryStatus(&info);
+    return info.dwAvailPhys;
+#else
+    struct sysinfo info;
+    sysinfo(&info);
+    return static_cast<long long>(info.freeram + info.bufferram) * info.mem_unit;
+#endif
+}
+
+PDFMemoryGovernor::PDFMemoryGovernor()
+: docs()
+, mutex()
+, budget(-1)
+, ddjvu_cache(-1)
+, sampled_at(0)
+, cgroup_dir()
+, cgroup_checked(false)
+{
+}
+
+PDFMemoryGovernor::~PDFMemoryGovernor()
+{
+}
+
+void PDFMemoryGovernor::add_document(PDFController *doc)
+{
+    ScopeMutex m(&mutex);
+    docs.remove(doc);
+    docs.push_front(doc);
+}
+
+void PDFMemoryGovernor::remove_document(PDFController *doc)
+{
+    // waits for a running make_room, which may be evicting from doc
+    ScopeMutex m(&mutex);
+    docs.remove(doc);
+    size_ddjvu_cache();
+}
+
+long long PDFMemoryGovernor::get_budget()
+{
+    ScopeMutex m(&mutex);
+    return budget;
+}
+
+bool PDFMemoryGovernor::make_room(PDFController *doc,
+                                  const int page_num,
+                                  const int length)
+{
+    ScopeMutex m(&mutex);
+
+    // doc is the most recently used document from now on
+    DocumentsIter iter = std::find(docs.begin(), docs.end(), doc);
+    if (iter != docs.end() && iter != docs.begin())
+    {
+        docs.splice(docs.begin(), docs, iter);
+    }
+
+    // the ddjvu cache counts as full, libdjvu doesn't say what it holds
+    long long usage = ddjvu_cache > 0 ? ddjvu_cache : 0;
+    for (iter = docs.begin(); iter != docs.end(); ++iter)
+    {
+        usage += (*iter)->get_memory_usage();
+    }
+
+    long long now = PDFStats::now();
+    if (budget < 0 || now - sampled_at >= SAMPLE_INTERVAL)
+    {
+        sample(usage);
+        sampled_at = now;
+    }
+
+    long long need = usage + length - budget;
+    if (need <= 0)
+    {
+        return true;
+    }
+
+    // libdjvu's cache goes before anything of the documents
+    if (ddjvu_cache > DDJVU_CACHE_MIN)
+    {
+        long long cut = std::min(need, ddjvu_cache - DDJVU_CACHE_MIN);
+        set_ddjvu_cache(ddjvu_cache - cut);
+        need -= cut;
+    }
+
+    // The share of the i-th most recent document is budget / 2^(i+1),
+    // the last one gets what is left. Evict from the least recent end,
+    // each document down to its share and no further than needed.
+    int count = static_cast<int>(docs.size());
+    Documents::reverse_iterator rev = docs.rbegin();
+    for (int i = count - 1; rev != docs.rend() && need > 0; ++rev, --i)
+    {
+        PDFController *cur = *rev;
+        long long share = (i == count - 1) ? (budget >> i) : (budget >> (i + 1));
+        long long used = cur->get_memory_usage();
+        if (used <= share)
+        {
+            continue;
+        }
+
+        long long target = used - need;
+        if (target < share)
+        {
+            target = share;
+        }
+        int freed = cur->shrink_memory(static_cast<int>(target),
+                                       cur == doc ? page_num : -1);
+        if (freed > 0)
+        {
+            cur->get_stats().inc(COUNTER_BUDGET_EVICTIONS);
+            need -= freed;
+        }
+    }
+
+    // the budget is a target, going over it is routine under pressure and
+    // shows in the budget_evictions counter, keep stderr quiet
+    if (need > 0)
+    {
+        TRACE_EVENT_INSTANT(TRACE_STAGE, "budget_exceeded", page_num, 0);
+    }
+    return need <= 0;
+}
+
+void PDFMemoryGovernor::update_ddjvu_cache()
+{
+    ScopeMutex m(&mutex);
+    size_ddjvu_cache();
+}
+
+void PDFMemoryGovernor::size_ddjvu_cache()
+{
+    // what the decode parts of the documents don't use
+    long long size = 0;
+    long long usage = 0;
+    DocumentsIter iter = docs.begin();
+    for (; iter != docs.end(); ++iter)
+    {
+        int spare = (*iter)->get_decode_limit() - (*iter)->get_decode_usage();
+        size += spare > 0 ? spare : 0;
+        usage += (*iter)->get_memory_usage();
+    }
+
+    // and never more than the budget leaves
+    if (budget >= 0 && size > budget - usage)
+    {
+        size = budget - usage;
+    }
+    size = std::max(DDJVU_CACHE_MIN, std::min(DDJVU_CACHE_MAX, size));
+    set_ddjvu_cache(size);
+}
+
+void PDFMemoryGovernor::set_ddjvu_cache(long long bytes)
+{
+    if (bytes == ddjvu_cache || globalParams == 0 || globalParams->getContext() == 0)
+    {
+        return;
+    }
+
+    Mutex *mtx = globalParams->getMutex();
+    mtx->lock();
+    ddjvu_cache_set_size(globalParams->getContext(), static_cast<unsigned long>(bytes));
+    mtx->unlock();
+    ddjvu_cache = bytes;
+    LOGPRINTF("ddjvu cache set to %lld bytes", bytes);
+}
+
+void PDFMemoryGovernor::sample(const long long usage)
+{
+    long long available = read_mem_available();
+    long long headroom = read_cgroup_headroom();
+    if (headroom >= 0 && (available < 0 || headroom < available))
+    {
+        available = headroom;
+    }
+    if (available < 0)
+    {
+        available = system_free_memory();
+    }
+
+    // the documents may grow until the system is down to the reserve
+    long long room = available - MEMORY_RESERVE;
+    budget = usage + (room > 0 ? room : 0);
+
+    // under pressure the budget steps down from what is used, once per
+    // sample, so the caches shrink gradually while it lasts
+    int pressure = read_pressure();
+    if (pressure >= PRESSURE_HIGH && budget > usage / 2)
+    {
+        budget = usage / 2;
+    }
+    else if (pressure >= PRESSURE_SOME && budget > usage - usage / 4)
+    {
+        budget = usage - usage / 4;
+    }
+
+    LOGPRINTF("Memory budget:%lld usage:%lld available:%lld pressure:%d%%",
+              budget, usage, available, pressure);
+}
+
+long long PDFMemoryGovernor::read_mem_available()
+{
+    char buf[4096];
+    if (!read_file("/proc/meminfo", buf, sizeof(buf)))
+    {
+        return -1;
+    }
+    const char *line = strstr(buf, "MemAvailable:");
+    long long kb = 0;
+    if (line == 0 || sscanf(line, "MemAvailable: %lld", &kb) != 1)
+    {
+        return -1;
+    }
+    return kb * 1024;
+}
+
+void PDFMemoryGovernor::find_cgroup()
+{
+    cgroup_checked = true;
+
+    // the unified hierarchy is the line "0::/path"
+    char buf[1024];
+    if (!read_file("/proc/self/cgroup", buf, sizeof(buf)))
+    {
+        return;
+    }
+    const char *line = strstr(buf, "0::");
+    if (line == 0 || (line != buf && line[-1] != '\n'))
+    {
+        return;
+    }
+    std::string path(line + 3);
+    path = path.substr(0, path.find('\n'));
+    if (path == "/")
+    {
+        path.clear();
+    }
+
+    std::string dir = std::string(CGROUP_ROOT) + path;
+    if (read_cgroup_value(dir + "/memory.current") >= 0)
+    {
+        cgroup_dir = dir;
+    }
+}
+
+long long PDFMemoryGovernor::read_cgroup_headroom()
+{
+    if (!cgroup_checked)
+    {
+        find_cgroup();
+    }
+    if (cgroup_dir.empty())
+    {
+        return -1;
+    }
+
+    // a limit on any ancestor applies as well, take the tightest
+    long long headroom = -1;
+    std::string dir = cgroup_dir;
+    while (dir.size() > strlen(CGROUP_ROOT))
+    {
+        long long max = read_cgroup_value(dir + "/memory.max");
+        long long current = read_cgroup_value(dir + "/memory.current");
+        if (max >= 0 && current >= 0)
+        {
+            long long room = max - current + read_cgroup_inactive_file(dir);
+            if (room < 0)
+            {
+                room = 0;
+            }
+            if (headroom < 0 || room < headroom)
+            {
+                headroom = room;
+            }
+        }
+        dir = dir.substr(0, dir.rfind('/'));
+    }
+    return headroom;
+}
+
+int PDFMemoryGovernor::read_pressure()
+{
+    // the cgroup's own pressure if there is one, else the system's
+    char buf[256];
+    if ((cgroup_dir.empty() ||
+         !read_file(cgroup_dir + "/memory.pressure", buf, sizeof(buf))) &&
+        !read_file("/proc/pressure/memory", buf, sizeof(buf)))
+    {
+        return 0;
+    }
+    double avg10 = 0.0;
+    if (sscanf(buf, "some avg10=%lf", &avg10) != 1)
+    {
+        return 0;
+    }
+    return static_cast<int>(avg10);
+}
+
+}
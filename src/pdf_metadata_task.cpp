@@ -0,0 +1,92 @@
+/*
+ * File Name: pdf_metadata_task.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#include "log.h"
+
+#include "pdf_metadata_task.h"
+#include "pdf_doc_controller.h"
+
+namespace pdf
+{
+
+// Page infos loaded per run, each may read a component file of an
+// indirect document
+static const int PAGE_INFO_BATCH = 8;
+
+PDFMetadataTask::PDFMetadataTask(PDFController *ctrl)
+: doc_ctrl(ctrl)
+{
+    type = TASK_BACKGROUND;
+}
+
+PDFMetadataTask::~PDFMetadataTask()
+{
+}
+
+void PDFMetadataTask::execute()
+{
+    // from now on a new task may be queued
+    doc_ctrl->background_task_started();
+
+    PDFDoc *doc = doc_ctrl->get_pdf_doc();
+    if (!doc->isOutlineReady())
+    {
+        {
+            TRACE_EVENT_SCOPE(TRACE_STAGE, "outline", -1, 0);
+            doc->loadOutline();
+        }
+        doc_ctrl->outline_loaded();
+    }
+    else
+    {
+        {
+            TRACE_EVENT_SCOPE(TRACE_STAGE, "page_infos", -1, 0);
+            doc->loadPageInfos(PAGE_INFO_BATCH);
+        }
+        if (doc->isPageInfoComplete())
+        {
+            doc_ctrl->page_infos_loaded();
+        }
+    }
+
+    // whoever aborted the task posts it again when done
+    if (!is_aborted())
+    {
+        doc_ctrl->post_background_task();
+    }
+}
+
+void* PDFMetadataTask::get_user_data()
+{
+    return doc_ctrl;
+}
+
+unsigned int PDFMetadataTask::get_id()
+{
+    return 0;
+}
+
+}   // namespace pdf
@@ -31,6 +31,8 @@
 #include "pdf_page.h"
 #include "pdf_doc_controller.h"
 #include "pdf_renderer.h"
+#include "pdf_render_task.h"
+#include "pdf_bitmap_ops.h"
 
 namespace pdf
 {
@@ -83,24 +85,33 @@ PDFPage::PDFPage(int page_num, const PDFRenderAttributes & attr)
     init();
     page_number = page_num;
     render_attr = attr;
+    text_at_render_attr = false;
 }
 
 PDFPage::~PDFPage(void)
 {
     destroy();
+    destroy_text();
 }
 
 void PDFPage::init()
 {
     page_number = 0;
     bitmap = 0;
+    preview = false;
+    bitmap_zoom = 0.0f;
+    bitmap_rotate = 0;
+    retired_bitmap = 0;
     links = 0;
     text = 0;
+    text_length = 0;
     doc_controller = 0;
     b_lock = false;
     render_status = RENDER_STOP;
     ref_id = PRERENDER_REF_ID;
-    init_render_area(content_area);
+    prerendered = false;
+    shown = false;
+    text_at_render_attr = false;
 }
 
 size_t PDFPage::operator()()
@@ -127,36 +138,62 @@ void PDFPage::set_render_attr(const PDFRenderAttributes & attr)
     }
 
     render_attr = attr;
+
+    // the text was extracted at the old zoom and rotation
+    text_at_render_attr = false;
 }
 
-void PDFPage::destroy_text()
+unsigned int PDFPage::destroy_text()
 {
+    unsigned int size = text_length;
     if (text) 
     {
         delete text;
         text = 0;
     }
+    text_length = 0;
+    text_at_render_attr = false;
+    return size;
 }
 
 unsigned int PDFPage::destroy_bitmap()
 {
-    unsigned int size = 0;
+    unsigned int size = destroy_retired_bitmap();
     if (bitmap)
     {
-        size = length();
+        size += length();
         delete bitmap;
         bitmap = 0;
     }
+    preview = false;
+    return size;
+}
+
+unsigned int PDFPage::destroy_retired_bitmap()
+{
+    unsigned int size = 0;
+    if (retired_bitmap)
+    {
+        size = retired_bitmap->getHeight() * retired_bitmap->getRowSize();
+        delete retired_bitmap;
+        retired_bitmap = 0;
+    }
     return size;
 }
 
 void PDFPage::destroy_links()
 {
-    if (links) 
+    // the links belong to the PDFDoc, which keeps them for every page
+    links = 0;
+}
+
+void PDFPage::set_shown()
+{
+    if (prerendered && !shown)
     {
-        delete links;
-        links = 0;
+        doc_controller->get_stats().inc(COUNTER_PRERENDER_SHOWN);
     }
+    shown = true;
 }
 
 unsigned int PDFPage::destroy()
@@ -178,8 +215,8 @@ unsigned int PDFPage::destroy()
     set_render_status(RENDER_STOP);
 
     destroy_links();
-    destroy_text();
     unsigned int size = destroy_bitmap();
+    size += destroy_pyramid();
 
     return size;
 }
@@ -285,6 +322,7 @@ void PDFPage::update_text(TextPage *t)
     }
 	if(text) delete text; // fixme added by luite, was this a memory leak?
     text = t;
+    text_length = t ? t->getMemorySize() : 0;
 }
 
 SearchResult PDFPage::search(SearchContext &ctx
@@ -1148,7 +1186,9 @@ bool PDFPage::get_bounding_rectangles(const string &start_anchor
 
 bool PDFPage::render_splash_map(PDFRenderer *renderer, void *abort_data)
 {
-    if (locked())
+    // a preview is locked by the render result showing it, but it is
+    // retired rather than destroyed
+    if (locked() && !is_preview())
     {
         if (get_render_status() == RENDER_STOP)
         {
@@ -1164,9 +1204,21 @@ bool PDFPage::render_splash_map(PDFRenderer *renderer, void *abort_data)
         }
     }
 
-    // destroy the pre-rendered results
+    // destroy the pre-rendered results, a preview stays until it is
+    // replaced, UDS is showing it
+    if (is_unused_prerender())
+    {
+        doc_controller->get_stats().inc(COUNTER_PRERENDER_INVALIDATED);
+    }
     destroy_links();
-    doc_controller->update_memory_usage((-1) * destroy_bitmap());
+    if (is_preview())
+    {
+        doc_controller->update_memory_usage((-1) * destroy_retired_bitmap());
+    }
+    else
+    {
+        doc_controller->update_memory_usage((-1) * destroy_bitmap());
+    }
 
     // set the status to rendering
     set_render_status(RENDER_RUNNING);
@@ -1179,6 +1231,7 @@ bool PDFPage::render_splash_map(PDFRenderer *renderer, void *abort_data)
     // lock when rendering
     ScopeMutex m(&(renderer->get_render_mutex()));
 
+    renderer->get_splash_output_dev()->setColorMode(render_attr.get_post_process().render_mode());
     ret = doc_controller->get_pdf_doc()->displayPage(
         renderer->get_splash_output_dev()
         , page_number
@@ -1210,7 +1263,17 @@ bool PDFPage::render_splash_map(PDFRenderer *renderer, void *abort_data)
 
     if (ret == Render_Done)
     {
+        post_process_bitmap(b, render_attr.get_post_process());
+        b = convert_to_output_depth(b);
+        if (is_preview())
+        {
+            retired_bitmap = bitmap;
+            bitmap = 0;
+        }
         update_bitmap(b);
+        preview = false;
+        bitmap_zoom = render_attr.get_real_zoom_value();
+        bitmap_rotate = render_attr.get_rotate();
         update_links(l);
 
         // retrieve ctm and ictm
@@ -1219,6 +1282,18 @@ bool PDFPage::render_splash_map(PDFRenderer *renderer, void *abort_data)
 
         doc_controller->update_memory_usage(length());
         LOGPRINTF("Rendering of page:%d Done! Length:%d\n", get_page_num(), length());
+
+        PDFStats &stats = doc_controller->get_stats();
+        stats.add_latency(STAGE_DECODE, renderer->get_splash_output_dev()->getDecodeTime());
+        stats.add_latency(STAGE_RASTER, renderer->get_splash_output_dev()->getRasterTime());
+        stats.inc(renderer->get_splash_output_dev()->wasDecodeCached() ?
+                  COUNTER_DECODE_HIT : COUNTER_DECODE_MISS);
+        stats.inc(COUNTER_PAGES_RENDERED);
+        if (renderer->get_splash_output_dev()->isBitonal())
+        {
+            stats.inc(COUNTER_BITONAL_RENDERS);
+        }
+        stats.inc(COUNTER_KBYTES_RENDERED, static_cast<int>(length() >> 10));
         return true;
     }
     else if (ret == Render_Abort)
@@ -1235,6 +1310,134 @@ bool PDFPage::render_splash_map(PDFRenderer *renderer, void *abort_data)
     return false;
 }
 
+bool PDFPage::render_preview(PDFRenderer *renderer, void *abort_data)
+{
+    // the preview is rendered at this fraction of the resolution
+    static const double PREVIEW_SUBSAMPLE = 4.0f;
+
+    if (is_preview())
+    {
+        return true;
+    }
+
+    if (locked())
+    {
+        if (get_render_status() != RENDER_STOP)
+        {
+            LOGPRINTF("Locked, Cannot render preview\n");
+            return false;
+        }
+        unlock();
+    }
+
+    TRACE_EVENT_SCOPE(TRACE_STAGE, "render_preview", page_number, 0);
+    double dpi_h = render_attr.get_real_zoom_value() * 0.01 *
+                   renderer->get_view_attr().get_device_dpi_h();
+    double dpi_v = render_attr.get_real_zoom_value() * 0.01 *
+                   renderer->get_view_attr().get_device_dpi_v();
+    int width = 0, height = 0;
+    SplashOutputDev::getBitmapSize(doc_controller->get_pdf_doc(), page_number,
+                                   dpi_h, dpi_v, &width, &height);
+
+    // on a zoom change, the bitmap at the old zoom or the nearest pyramid
+    // level is good enough
+    SplashBitmap *source = 0;
+    double source_zoom = 0.0f;
+    if (bitmap != 0 && bitmap_rotate == render_attr.get_rotate())
+    {
+        source = bitmap;
+        source_zoom = bitmap_zoom;
+    }
+    pyramid.nearest(render_attr.get_real_zoom_value(), render_attr.get_rotate(),
+                    source, source_zoom);
+
+    SplashBitmap *scaled = 0;
+    if (source != 0)
+    {
+        scaled = scale_bitmap(source, width, height);
+    }
+    else
+    {
+        SplashBitmap *small = 0;
+        {
+            ScopeMutex m(&(renderer->get_render_mutex()));
+            renderer->get_splash_output_dev()->setColorMode(
+                render_attr.get_post_process().render_mode());
+            RenderRet ret = doc_controller->get_pdf_doc()->displayPage(
+                renderer->get_splash_output_dev()
+                , page_number
+                , dpi_h / PREVIEW_SUBSAMPLE
+                , dpi_v / PREVIEW_SUBSAMPLE
+                , render_attr.get_rotate()
+                , gFalse
+                , gTrue
+                , gFalse
+                , abort_render_check
+                , abort_data
+            );
+            small = renderer->get_splash_output_dev()->takeBitmap();
+            if (ret != Render_Done || small == 0)
+            {
+                delete small;
+                return false;
+            }
+        }
+        post_process_bitmap(small, render_attr.get_post_process());
+        scaled = scale_bitmap(small, width, height);
+        delete small;
+    }
+
+    if (is_unused_prerender())
+    {
+        doc_controller->get_stats().inc(COUNTER_PRERENDER_INVALIDATED);
+    }
+    destroy_links();
+    doc_controller->update_memory_usage((-1) * destroy_bitmap());
+
+    update_bitmap(convert_to_output_depth(scaled));
+    preview = true;
+    bitmap_zoom = render_attr.get_real_zoom_value();
+    bitmap_rotate = render_attr.get_rotate();
+    doc_controller->update_memory_usage(length());
+    doc_controller->get_stats().inc(COUNTER_PREVIEWS);
+    return true;
+}
+
+SplashBitmap * PDFPage::convert_to_output_depth(SplashBitmap *b)
+{
+    const PostProcessSettings &output = render_attr.get_post_process();
+    if (b->getMode() == output.output_mode())
+    {
+        return b;
+    }
+
+    SplashBitmap *converted = (b->getMode() == splashModeMono8) ?
+        pack_bitmap(b, output.output_mode(), output.dither) :
+        convert_bitmap(b, output.output_mode(), output.dither);
+    delete b;
+    return converted;
+}
+
+bool PDFPage::build_pyramid()
+{
+    if (bitmap == 0 || preview)
+    {
+        return false;
+    }
+
+    // the levels of the previous zoom are superseded anyway
+    doc_controller->update_memory_usage((-1) * static_cast<int>(pyramid.clear()));
+    if (!doc_controller->cache_has_room(
+            static_cast<int>(PDFPagePyramid::estimate_length(bitmap))))
+    {
+        return false;
+    }
+
+    doc_controller->update_memory_usage(pyramid.build(
+        bitmap, bitmap_zoom, bitmap_rotate, render_attr.get_post_process().dither));
+    return true;
+}
+
 void PDFPage::set_render_status(RenderStatus s)
 {
     render_status = s;
@@ -1244,8 +1447,10 @@ bool PDFPage::render_text(PDFRenderer *renderer, bool use_defalt_setting)
 {
     static const double DEFAULT_ZOOM = 0.2f;
 
-    destroy_text();
+    doc_controller->update_memory_usage((-1) * static_cast<int>(destroy_text()), MEMORY_TEXT);
     // currently, the text rendering cannot be aborted
+    TRACE_EVENT_SCOPE(TRACE_STAGE, "render_text", page_number, 0);
+    StatsTimer timer(doc_controller->get_stats(), STAGE_TEXT);
 
     // lock when rendering
     ScopeMutex m(&(renderer->get_render_mutex()));
@@ -1264,266 +1469,21 @@ bool PDFPage::render_text(PDFRenderer *renderer, bool use_defalt_setting)
         );
 
     update_text(renderer->get_text_output_dev()->takeText());
+    text_at_render_attr = !use_defalt_setting;
+    doc_controller->update_memory_usage(static_cast<int>(text_length), MEMORY_TEXT);
 
-    return true;
-}
-
-bool PDFPage::get_content_area(PDFRenderer *renderer, RenderArea &area)
-{
-    static const double SHRINK_ZOOM = 0.2f;
-    static const int    EXPAND_STEP = 2;
-
-    if (!is_render_area_valid(content_area))
-    {
-        // lock when rendering
-        ScopeMutex m(&(renderer->get_render_mutex()));
-
-        RenderRet ret = doc_controller->get_pdf_doc()->displayPage(
-        renderer->get_thumbnail_output_dev()
-        , get_page_num()
-        , SHRINK_ZOOM * renderer->get_view_attr().get_device_dpi_h()
-        , SHRINK_ZOOM * renderer->get_view_attr().get_device_dpi_v()
-        , 0
-        , gFalse  //useMediaBox, TODO.
-        , gFalse  //crop, TODO.
-        , gFalse  //doLinks, TODO.
-        );
-
-        if (ret == Render_Error || ret == Render_Invalid)
-        {
-            ERRORPRINTF("Error in rendering thumbnail page:%d\n", get_page_num());
-            return false;
-        }
-
-        SplashBitmap *thumb_map = renderer->get_thumbnail_output_dev()->takeBitmap();
-        PDFRectangle content_rect;
-        bool succeed = get_content_from_bitmap(thumb_map, content_rect);
-        // calculate the render area by the rectangle
-        double page_width = thumb_map->getWidth();
-        double page_height = thumb_map->getHeight();
-        delete thumb_map;
-        if (!succeed)
-        {
-            // set the content area to be the page area
-            content_rect.x1 = content_rect.y1 = 0;
-            content_rect.x2 = page_width;
-            content_rect.y2 = page_height;
-        }
-        else
-        {
-            // expand the content area to avoid content covering
-            double inc_x2 = 0;
-            double inc_y2 = 0;
-
-            // expand x1
-            if (content_rect.x1 > EXPAND_STEP)
-            {
-                content_rect.x1 -= EXPAND_STEP;
-                inc_x2 = EXPAND_STEP;
-            }
-            else
-            {
-                inc_x2 = content_rect.x1;
-                content_rect.x1 = 0;
-            }
-
-            // expand y1
-            if (content_rect.y1 > EXPAND_STEP)
-            {
-                content_rect.y1 -= EXPAND_STEP;
-                inc_y2 = EXPAND_STEP;
-            }
-            else
-            {
-                inc_y2 = content_rect.y1;
-                content_rect.y1 = 0;
-            }
-
-            // expand x2
-            content_rect.x2 += (inc_x2 + 1);
-            if (content_rect.x2 > page_width)
-            {
-                content_rect.x2 = page_width;
-            }
-
-            // expand y2
-            content_rect.y2 += (inc_y2 + 1);
-            if (content_rect.y2 > page_height)
-            {
-                content_rect.y2 = page_height;
-            }
-        }
-
-        content_area.x_offset = static_cast<float>(content_rect.x1 / page_width);
-        content_area.y_offset = static_cast<float>(content_rect.y1 / page_height);
-
-        content_area.width =
-            static_cast<float>((content_rect.x2 - content_rect.x1) / page_width);
-        content_area.height =
-            static_cast<float>((content_rect.y2 - content_rect.y1) / page_height);
-
-        if (content_area.width > 1.0f)
-        {
-            content_area.x_offset = 0.0f;
-            content_area.width    = 1.0f;
-        }
-        if (content_area.height > 1.0f)
-        {
-            content_area.y_offset = 0.0f;
-            content_area.height   = 1.0f;
-        }
-    }
-
-    area = content_area;
+    // the text layers of other pages make way when the cache is full,
+    // without touching any bitmap
+    doc_controller->trim_text(page_number);
 
     return true;
 }
 
-bool PDFPage::get_content_from_bitmap(SplashBitmap *bitmap, PDFRectangle &rect)
-{
-    static const int BACKGROUND_COLOR = 255;
-    static const int LINE_STEP        = 1;
-    static const int SHRINK_STEP      = 1;
-    static const double SHRINK_RANGE  = 0.3f;
-
-    // top left
-    int x1 = 0;
-    int y1 = 0;
-    // bottom right
-    int x2 = bitmap->getWidth();
-    int y2 = bitmap->getHeight();
-
-    int left_edge = static_cast<int>(SHRINK_RANGE * x2);
-    int right_edge = static_cast<int>((1.0f - SHRINK_RANGE) * x2);
-    int top_edge = static_cast<int>(SHRINK_RANGE * y2);
-    int bottom_edge = static_cast<int>((1.0f - SHRINK_RANGE) * y2);
-
-    // current pixel
-    Guchar cur_pix;
-    bool stop[4] = {false, false, false, false};
-
-    while (!stop[0] || !stop[1] || !stop[2] || !stop[3])
-    {
-        // check top line
-        int x_cur = x1;
-        while (x_cur < x2 && !stop[0])
-        {
-            bitmap->getPixel(x_cur, y1, &cur_pix);
-            if (cur_pix != BACKGROUND_COLOR)
-            {
-                stop[0] = true;
-                break;
-            }
-            x_cur += LINE_STEP;
-        }
-
-        // check bottom line
-        x_cur = x1;
-        while (x_cur < x2 && !stop[1])
-        {
-            bitmap->getPixel(x_cur, y2, &cur_pix);
-            if (cur_pix != BACKGROUND_COLOR)
-            {
-                stop[1] = true;
-                break;
-            }
-            x_cur += LINE_STEP;
-        }
-
-        // check left line
-        int y_cur = y1;
-        while (y_cur < y2 && !stop[2])
-        {
-            bitmap->getPixel(x1, y_cur, &cur_pix);
-            if (cur_pix != BACKGROUND_COLOR)
-            {
-                stop[2] = true;
-                break;
-            }
-            y_cur += LINE_STEP;
-        }
-
-        // check right line
-        y_cur = y1;
-        while (y_cur < y2 && !stop[3])
-        {
-            bitmap->getPixel(x2, y_cur, &cur_pix);
-            if (cur_pix != BACKGROUND_COLOR)
-            {
-                stop[3] = true;
-                break;
-            }
-            y_cur += LINE_STEP;
-        }
-
-        // shrink the rectangle
-        if (!stop[2])
-        {
-            if (x1 >= left_edge)
-            {
-                stop[2] = true;
-            }
-            else
-            {
-                x1 += SHRINK_STEP;
-            }
-        }
-
-        if (!stop[3])
-        {
-            if (x2 <= right_edge)
-            {
-                stop[3] = true;
-            }
-            else
-            {
-                x2 -= SHRINK_STEP;
-            }
-        }
-
-        if (!stop[0])
-        {
-            if (y1 >= top_edge)
-            {
-                stop[0] = true;
-            }
-            else
-            {
-                y1 += SHRINK_STEP;
-            }
-        }
-
-        if (!stop[1])
-        {
-            if (y2 <= bottom_edge)
-            {
-                stop[1] = true;
-            }
-            else
-            {
-                y2 -= SHRINK_STEP;
-            }
-        }
-
-    }
-
-    if (stop[0] && stop[1] && stop[2] && stop[3])
-    {
-        rect.x1 = x1;
-        rect.x2 = x2;
-        rect.y1 = y1;
-        rect.y2 = y2;
-        return true;
-    }
-
-    return false;
-}
-
 GBool PDFPage::abort_render_check(void *data)
 {
-    Task *task = static_cast<Task*>(data);
+    PDFRenderTask *task = static_cast<PDFRenderTask*>(data);
 
-    return static_cast<GBool>(task->is_aborted());
+    return static_cast<GBool>(task->check_superseded());
 }
 
 // (x,y) -> "pdf:/page:8/link:0/word:12/char:06"
@@ -1532,23 +1492,7 @@ void PDFPage::get_anchor_param_from_coordinates(double x, double y
 {
     int i;
     // Caculate whether (x, y) inside a Link and inside which Link
-    int link_index = -1;
-    if (links && links->onLink(x, y))
-    {
-        int link_num;
-        Link * link;
-
-        link_num = links->getNumLinks();
-        for (i = 0; i < link_num; i++)
-        {
-            link = links->getLink(i);
-            if (link && link->inRect(x, y))
-            {
-                link_index = i;
-                break;
-            }
-        }
-    }
+    int link_index = links ? links->find(x, y) : -1;
 
     // get the anchor of a screen point
     // now the anchor is supposed to be like "pdf:/page:8/link:0/word:12/char:06"
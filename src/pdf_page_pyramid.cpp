@@ -0,0 +1,164 @@
+/*
+ * File Name: pdf_page_pyramid.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#include "pdf_page_pyramid.h"
+#include "pdf_bitmap_ops.h"
+
+namespace pdf
+{
+
+static unsigned int bitmap_length(SplashBitmap *bitmap)
+{
+    return bitmap->getHeight() * bitmap->getRowSize();
+}
+
+PDFPagePyramid::PDFPagePyramid()
+: count(0)
+, level_rotate(0)
+{
+    for (int i = 0; i < MAX_LEVELS; ++i)
+    {
+        levels[i] = 0;
+        zooms[i] = 0.0f;
+    }
+}
+
+PDFPagePyramid::~PDFPagePyramid()
+{
+    clear();
+}
+
+unsigned int PDFPagePyramid::estimate_length(SplashBitmap *bitmap)
+{
+    unsigned int width = bitmap->getWidth();
+    unsigned int height = bitmap->getHeight();
+    unsigned int depth = bitmap->getDepth();
+    unsigned int sum = 0;
+    for (int i = 0; i < MAX_LEVELS; ++i)
+    {
+        width >>= 1;
+        height >>= 1;
+        sum += (width * depth + 7) / 8 * height;
+    }
+    return sum;
+}
+
+unsigned int PDFPagePyramid::build(SplashBitmap *bitmap, double zoom, int rotate,
+                                   DitherMode dither)
+{
+    clear();
+    level_rotate = rotate;
+
+    // halve_bitmap reduces packed bitmaps to 8 bit grey, the levels are
+    // packed again and the next one is reduced from the 8 bit one
+    SplashColorMode mode = bitmap->getMode();
+    SplashBitmap *source = bitmap;
+    bool temporary = false;
+    for (int i = 0; i < MAX_LEVELS; ++i)
+    {
+        SplashBitmap *level = halve_bitmap(source);
+        if (level == 0)
+        {
+            break;
+        }
+
+        zoom *= 0.5f;
+        bool repack = (level->getMode() != mode);
+        levels[count] = repack ? pack_bitmap(level, mode, dither) : level;
+        zooms[count] = zoom;
+        ++count;
+
+        if (temporary)
+        {
+            delete source;
+        }
+        source = level;
+        temporary = repack;
+    }
+
+    if (temporary)
+    {
+        delete source;
+    }
+    return length();
+}
+
+unsigned int PDFPagePyramid::clear()
+{
+    unsigned int size = length();
+    for (int i = 0; i < count; ++i)
+    {
+        delete levels[i];
+        levels[i] = 0;
+    }
+    count = 0;
+    return size;
+}
+
+unsigned int PDFPagePyramid::length() const
+{
+    unsigned int sum = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        sum += bitmap_length(levels[i]);
+    }
+    return sum;
+}
+
+void PDFPagePyramid::nearest(double zoom, int rotate,
+                             SplashBitmap *&best, double &best_zoom) const
+{
+    if (!has_level(rotate))
+    {
+        return;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        double z = zooms[i];
+        bool better = false;
+        if (best == 0)
+        {
+            better = true;
+        }
+        else if (z >= zoom)
+        {
+            better = (best_zoom < zoom || z < best_zoom);
+        }
+        else
+        {
+            better = (best_zoom < zoom && z > best_zoom);
+        }
+
+        if (better)
+        {
+            best = levels[i];
+            best_zoom = z;
+        }
+    }
+}
+
+}   // namespace pdf
@@ -33,9 +33,14 @@ namespace pdf
 PagesCache::PagesCache(void)
 : size_limit(0)
 , total_length(0)
+, stats(0)
 , pages()
 , cache_mutex()
 {
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; ++i)
+    {
+        lengths[i] = 0;
+    }
 }
 
 PagesCache::~PagesCache(void)
@@ -51,14 +56,19 @@ bool PagesCache::reset(const unsigned int size)
 
     if (size_limit > static_cast<unsigned int>(real_size))
     {
-        //remove the redundant pages
-        while (total_length > real_size)
+        //remove the redundant pages, then the text layers. Only what
+        //can be evicted makes the reset fail.
+        while (total_length > real_size && remove_page())
         {
-            if (!remove_page())
-            {
-                // cannot remove the needed page
-                return false;
-            }
+        }
+        if (total_length > real_size)
+        {
+            drop_text(lengths[MEMORY_TEXT] - (total_length - real_size), -1);
+        }
+        if (lengths[MEMORY_BITMAP] + lengths[MEMORY_TEXT] > real_size)
+        {
+            // cannot remove the needed page
+            return false;
         }
     }
 
@@ -84,7 +94,10 @@ void PagesCache::clear()
         delete iter->second;
     }
     pages.clear();
-    total_length = 0;
+
+    // links and the auxiliary data are the document's, it reports them
+    account(MEMORY_BITMAP, -lengths[MEMORY_BITMAP]);
+    account(MEMORY_TEXT, -lengths[MEMORY_TEXT]);
 }
 
 /// Add a new page
@@ -107,6 +120,21 @@ bool PagesCache::make_enough_memory(const int page_num, const int length)
         return true;
     }
 
+    drop_pyramids(length);
+    sum = total_length + length;
+    if (sum <= static_cast<int>(size_limit))
+    {
+        return true;
+    }
+
+    // text layers are quicker to extract again than bitmaps to render
+    drop_text(lengths[MEMORY_TEXT] - (sum - static_cast<int>(size_limit)), page_num);
+    sum = total_length + length;
+    if (sum <= static_cast<int>(size_limit))
+    {
+        return true;
+    }
+
     // remove the most useless pages until the sum is less than
     // a quarter of the size limitation
     unsigned int size = (size_limit >> 1);
@@ -138,6 +166,8 @@ void PagesCache::clear_cached_bitmaps()
     ScopeMutex m(&cache_mutex);
     // clear all cached bitmaps
     LOGPRINTF("Clear cached bitmaps due to out of memory\n\n");
+    drop_pyramids(-1);
+    drop_text(0, -1);
     PagePtr page = 0;
     PagesIter iter = pages.begin();
     for (; iter != pages.end(); ++iter)
@@ -145,10 +175,15 @@ void PagesCache::clear_cached_bitmaps()
         page = iter->second;
         if (page->get_bitmap() && !page->locked())
         {
+            if (page->is_unused_prerender())
+            {
+                page->get_doc_controller()->get_stats().inc(COUNTER_PRERENDER_EVICTED);
+            }
             int delta = static_cast<int>(page->destroy());
 
             // update the total length
-            total_length -= delta;
+            account(MEMORY_BITMAP, -delta);
+            page->get_doc_controller()->get_stats().inc(COUNTER_EVICTION);
         }
     }
 }
@@ -166,17 +201,139 @@ PagePtr PagesCache::get_page(const size_t idx)
     return page;
 }
 
-void PagesCache::update_mem_usage(const int length)
+void PagesCache::update_mem_usage(const int length,
+                                  const MemoryCategory category)
 {
     ScopeMutex m(&cache_mutex);
-    total_length += length;
+    account(category, length);
     /*LOGPRINTF("Add memory usage:%d, total length:%d\n"
             , length
             , total_length);*/
 }
 
+bool PagesCache::has_room(const int length)
+{
+    ScopeMutex m(&cache_mutex);
+    return total_length + length <= static_cast<int>(size_limit);
+}
+
+int PagesCache::get_total_length()
+{
+    ScopeMutex m(&cache_mutex);
+    return total_length;
+}
+
+int PagesCache::get_length(const MemoryCategory category)
+{
+    ScopeMutex m(&cache_mutex);
+    return lengths[category];
+}
+
+int PagesCache::shrink(const int target, const int page_num)
+{
+    ScopeMutex m(&cache_mutex);
+    int before = total_length;
+
+    PagesIter iter = pages.begin();
+    for (; iter != pages.end() && total_length > target; ++iter)
+    {
+        account(MEMORY_BITMAP, -static_cast<int>(iter->second->destroy_pyramid()));
+    }
+
+    if (total_length > target)
+    {
+        drop_text(lengths[MEMORY_TEXT] - (total_length - target), page_num);
+    }
+
+    while (total_length > target && !pages.empty() && remove_page(page_num))
+    {
+    }
+    return before - total_length;
+}
+
+int PagesCache::shrink_text(const int target, const int page_num)
+{
+    ScopeMutex m(&cache_mutex);
+    int before = lengths[MEMORY_TEXT];
+    drop_text(target, page_num);
+    return before - lengths[MEMORY_TEXT];
+}
+
+void PagesCache::drop_pyramids(const int length)
+{
+    PagesIter iter = pages.begin();
+    for (; iter != pages.end(); ++iter)
+    {
+        if (length >= 0 && total_length + length <= static_cast<int>(size_limit))
+        {
+            return;
+        }
+        account(MEMORY_BITMAP, -static_cast<int>(iter->second->destroy_pyramid()));
+    }
+}
+
+void PagesCache::drop_text(const int target, const int page_num)
+{
+    while (lengths[MEMORY_TEXT] > target)
+    {
+        // the lowest priority page whose text layer may go
+        PagePtr victim = 0;
+        PagesIter iter = pages.begin();
+        for (; iter != pages.end(); ++iter)
+        {
+            PagePtr page = iter->second;
+            if (page->get_text() == 0 ||
+                page->locked() ||
+                page->get_page_num() == page_num ||
+                page->get_render_status() == PDFPage::RENDER_RUNNING)
+            {
+                continue;
+            }
+
+            if (victim == 0 ||
+                compare_priority(page->get_page_num(),
+                                 victim->get_page_num(),
+                                 page->get_doc_controller()->get_prerender_policy()) < 0)
+            {
+                victim = page;
+            }
+        }
+
+        if (victim == 0 ||
+            (page_num >= 0 &&
+             compare_priority(victim->get_page_num(),
+                              page_num,
+                              victim->get_doc_controller()->get_prerender_policy()) >= 0))
+        {
+            // the rest is needed as much as the requested page
+            return;
+        }
+
+        account(MEMORY_TEXT, -static_cast<int>(victim->destroy_text()));
+        victim->get_doc_controller()->get_stats().inc(COUNTER_TEXT_EVICTIONS);
+    }
+}
+
+void PagesCache::account(const MemoryCategory category, const int delta)
+{
+    // a category never goes below 0, that would be an accounting error
+    int d = delta < -lengths[category] ? -lengths[category] : delta;
+    lengths[category] += d;
+    total_length += d;
+    if (stats)
+    {
+        stats->add_gauge(static_cast<StatsGauge>(GAUGE_MEMORY_BITMAP + category), d);
+    }
+}
+
 bool PagesCache::remove_page(const int page_num)
 {
+    // the length may be links and auxiliary data only
+    if (pages.empty())
+    {
+        return false;
+    }
+
     // remove the out-of-date page based on the remove strategy
     PagesIter begin = pages.begin();
     PagesIter end = pages.end();
@@ -207,23 +364,23 @@ bool PagesCache::remove_page(const int page_num)
             return false;
         }
 
+        if (remove_iter->second->is_unused_prerender())
+        {
+            remove_iter->second->get_doc_controller()->get_stats().inc(COUNTER_PRERENDER_EVICTED);
+        }
+
         // delete the valid page(length > 0 and NOT locked)
         // sub the total length
         int delta = static_cast<int>(remove_iter->second->destroy());
 
         // update the total length
-        total_length -= delta;
+        account(MEMORY_BITMAP, -delta);
+        remove_iter->second->get_doc_controller()->get_stats().inc(COUNTER_EVICTION);
 
         TRACE("Remove Cached Page:%d, Total Length:%d, Delta Length:%d\n\n"
             , remove_iter->second->get_page_num()
             , total_length
             , delta);
-
-        if (total_length < 0)
-        {
-            // this is an exception 
-            total_length = 0;
-        }
     }
     else if (!remove_iter->second->get_bitmap())
     {
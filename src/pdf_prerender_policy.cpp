@@ -157,6 +157,7 @@ void PDFPrerenderPolicyNormal::generate_requests_list(const int current_page,
             // prerender the next 5 pages
             faraway_pages_first(current_page, total, step > 0, result);
         }
+        break;
     case 0:
         {
             // prerender the nearby pages
@@ -228,5 +229,189 @@ void PDFPrerenderPolicyNormal::nearby_pages_first(const int current_page,
     add_request_page(current_page, -1, total, true, result);
 }
 
+// Time spent on a page before the reader is known, and the bounds
+// that keep a single odd dwell from dominating the average.
+static const long long DEFAULT_DWELL   = 2 * 1000000LL;
+static const long long MIN_DWELL       = 20 * 1000LL;
+static const long long MAX_DWELL       = 60 * 1000000LL;
+
+// Render cost in ms before the first render has been measured
+static const int DEFAULT_RENDER_COST   = 500;
+
+// Never prerender further ahead than this
+static const int MAX_LOOKAHEAD         = 8;
+
+// Pages decoded ahead beyond the requests list
+static const int DECODE_AHEAD          = 4;
+
+PDFPrerenderPolicyAdaptive::PDFPrerenderPolicyAdaptive()
+: PDFPrerenderPolicy()
+, steps_count(0)
+, last_flip(0)
+, dwell(DEFAULT_DWELL)
+, render_cost(DEFAULT_RENDER_COST)
+, page_budget(MAX_LOOKAHEAD + 1)
+, last_direction(1)
+, last_offset(1)
+{
+    memset(steps, 0, sizeof(steps));
+}
+
+PDFPrerenderPolicyAdaptive::~PDFPrerenderPolicyAdaptive()
+{
+}
+
+int PDFPrerenderPolicyAdaptive::get_allowed_hyperlinks_number()
+{
+    // hyperlinked pages share the budget with the prerendered ones
+    return std::min(ALLOWED_HYPERLINKS_NUMBER,
+                    std::max(0, g_atomic_int_get(&page_budget) - 2));
+}
+
+void PDFPrerenderPolicyAdaptive::report_render_cost(long long usec)
+{
+    // moving average, the newest sample weighs a quarter
+    int cost = static_cast<int>(usec / 1000);
+    int old_cost = g_atomic_int_get(&render_cost);
+    g_atomic_int_set(&render_cost, (old_cost * 3 + cost) / 4);
+}
+
+void PDFPrerenderPolicyAdaptive::set_page_budget(int pages)
+{
+    g_atomic_int_set(&page_budget, std::max(1, pages));
+}
+
+void PDFPrerenderPolicyAdaptive::add_step(const int step)
+{
+    long long now = PDFStats::now();
+    if (last_flip != 0)
+    {
+        long long d = std::min(std::max(now - last_flip, MIN_DWELL), MAX_DWELL);
+        dwell = (dwell * 3 + d) / 4;
+    }
+    last_flip = now;
+
+    memmove(steps + 1, steps, (HISTORY_SIZE - 1) * sizeof(int));
+    steps[0] = step;
+    if (steps_count < HISTORY_SIZE)
+    {
+        ++steps_count;
+    }
+}
+
+int PDFPrerenderPolicyAdaptive::reading_direction() const
+{
+    // only page by page flips tell the direction, jumps are navigation
+    int forward = 0, backward = 0;
+    for (int i = 0; i < steps_count; ++i)
+    {
+        if (steps[i] == 1 || steps[i] == 2)
+        {
+            ++forward;
+        }
+        else if (steps[i] == -1 || steps[i] == -2)
+        {
+            ++backward;
+        }
+    }
+
+    if (forward >= backward * 3)
+    {
+        return 1;
+    }
+    if (backward >= forward * 3)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int PDFPrerenderPolicyAdaptive::repeated_jump() const
+{
+    if (steps_count >= 2 && steps[0] == steps[1] &&
+        (steps[0] > 2 || steps[0] < -2))
+    {
+        return steps[0];
+    }
+    return 0;
+}
+
+int PDFPrerenderPolicyAdaptive::lookahead()
+{
+    int cost = std::max(1, g_atomic_int_get(&render_cost));
+    int pages = static_cast<int>(dwell / 1000 / cost);
+    return std::min(std::max(pages, 1), MAX_LOOKAHEAD);
+}
+
+void PDFPrerenderPolicyAdaptive::generate_requests_list(const int current_page,
+                                                        const int previous_page,
+                                                        const int total,
+                                                        std::vector<size_t> & result)
+{
+    result.clear();
+    result.push_back(current_page);
+
+    int step = current_page - previous_page;
+    if (step != 0)
+    {
+        add_step(step);
+    }
+
+    // the current page takes one place in the budget
+    size_t limit = static_cast<size_t>(g_atomic_int_get(&page_budget));
+    int direction = reading_direction();
+    int ahead = lookahead();
+
+    // a repeated jump (e.g. two page spreads, chapters) goes first
+    int jump = repeated_jump();
+    if (jump != 0)
+    {
+        add_request_page(current_page, jump, total, true, result);
+    }
+
+    // the next page in the reading direction, and the previous one as
+    // long as the direction is undecided
+    add_request_page(current_page, 1, total, direction >= 0, result);
+    if (direction == 0)
+    {
+        add_request_page(current_page, -1, total, true, result);
+    }
+
+    for (int offset = 2; offset <= ahead; ++offset)
+    {
+        add_request_page(current_page, offset, total, direction >= 0, result);
+    }
+
+    // the renderer prerenders the first pages that fit in the budget and
+    // only prefetches the text of the others, so allow one budget more
+    if (result.size() > limit * 2)
+    {
+        result.resize(limit * 2);
+    }
+
+    last_direction = direction >= 0 ? 1 : -1;
+    last_offset = std::min(ahead, static_cast<int>(limit * 2));
+
+    // update the requests queue
+    requests.update(result);
+}
+
+void PDFPrerenderPolicyAdaptive::generate_prefetch_list(const int current_page,
+                                                        const int total,
+                                                        std::vector<size_t> & result)
+{
+    result.clear();
+    for (int offset = last_offset + 1;
+         offset <= last_offset + DECODE_AHEAD; ++offset)
+    {
+        int page = current_page + offset * last_direction;
+        if (page > 0 && page <= total &&
+            !requests.contains(static_cast<size_t>(page)))
+        {
+            result.push_back(page);
+            requests.append_request(page);
+        }
+    }
 }
 
+}
@@ -32,6 +32,10 @@
 namespace pdf
 {
 
+// A visible page gets a subsampled preview first when rasterizing takes
+// longer than this on average, in us
+static const unsigned int PREVIEW_MIN_RASTER = 150000;
+
 PDFRenderTask::PDFRenderTask(int page_num, const PDFRenderAttributes &attr
                              , PDFController *ctrl, PluginRenderResultImpl *render_res
                              , int id)
@@ -41,6 +45,11 @@ PDFRenderTask::PDFRenderTask(int page_num, const PDFRenderAttributes &attr
 , doc_ctrl(ctrl)
 , ref_id(id)
 , render_result(render_res)
+, mode(RENDER_BITMAP)
+, generation(0)
+, request_outcome(STAGE_REQUEST_RENDERED)
+, request_issued(0)
+, refreshing(false)
 {
     type = TASK_RENDER;
 }
@@ -54,23 +63,53 @@ PDFRenderTask::PDFRenderTask(PagePtr p, const PDFRenderAttributes &attr
 , doc_ctrl(ctrl)
 , ref_id(id)
 , render_result(render_res)
+, mode(RENDER_BITMAP)
+, generation(0)
+, request_outcome(STAGE_REQUEST_RENDERED)
+, request_issued(0)
+, refreshing(false)
 {
     type = TASK_RENDER;
 }
 
 PDFRenderTask::~PDFRenderTask()
 {
+    if (refreshing)
+    {
+        render_result->set_refining(false);
+    }
 }
 
 void PDFRenderTask::execute()
 {
+    TRACE_EVENT_SCOPE(TRACE_STAGE, "render_task", page_number, ref_id);
+
     // don't execute the prerender task if the page is out of date
     if (is_page_out_of_date())
     {
         return;
     }
 
+    // the user has flipped on, the newer request has its own task
+    if (check_superseded())
+    {
+        if (render_result != 0)
+        {
+            render_result->set_discard(true);
+        }
+        return;
+    }
+
+    if (mode == RENDER_DECODE_ONLY)
+    {
+        // the decoded page is kept by PDFDoc, rendering it later only
+        // takes ddjvu_page_render
+        doc_ctrl->get_pdf_doc()->prefetchPage(page_number);
+        return;
+    }
+
     PDFRenderer *renderer = doc_ctrl->get_renderer();
+    StatsTimer timer(doc_ctrl->get_stats(), STAGE_RENDER_TASK);
 
     // estimate whether the page has been cached
     // it is necessary here although there is same estimation
@@ -99,21 +138,33 @@ void PDFRenderTask::execute()
     // changes.
     page->set_ref_id(ref_id);
 
-    // if it is ZOOM_AUTO_CROP mode, it means it is necessary to get the content
-    // area of the page
-    double real_zoom = page_render_attr.get_real_zoom_value();
-    if (real_zoom == PLUGIN_ZOOM_TO_CROP_BY_PAGE ||
-        real_zoom == PLUGIN_ZOOM_TO_CROP_BY_WIDTH)
+    // the zoom to fit modes depend on the page size, which the request may
+    // have estimated, and in ZOOM_AUTO_CROP mode on the content area, which
+    // the background task may have found since. Never detect it here, a
+    // visible page is shown whole until the content area task finds it.
+    bool uncropped = render_result != 0 && mode == RENDER_BITMAP &&
+                     renderer->lacks_content_area(page_number, page_render_attr);
+    if (page_render_attr.get_zoom_setting() < 0)
     {
-        RenderArea content_area;
-        if (!page->get_content_area(renderer, content_area))
+        bool estimated = !doc_ctrl->get_pdf_doc()->isPageInfoLoaded(page_number);
+        double zoom_setting = page_render_attr.get_zoom_setting();
+        if (estimated)
         {
-            ERRORPRINTF("Cannot get content area of page:%d", page_number);
-            return;
+            doc_ctrl->get_pdf_doc()->prefetchPageInfo(page_number);
         }
-        PDFRenderAttributes origin_attr = page_render_attr;
-        renderer->calc_real_zoom(page_number, origin_attr, page_render_attr);
-        real_zoom = page_render_attr.get_real_zoom_value();
+        if (estimated ||
+            zoom_setting == PLUGIN_ZOOM_TO_CROP_BY_PAGE ||
+            zoom_setting == PLUGIN_ZOOM_TO_CROP_BY_WIDTH)
+        {
+            PDFRenderAttributes origin_attr = page_render_attr;
+            renderer->calc_real_zoom(page_number, origin_attr, page_render_attr);
+        }
+    }
+
+    if (mode == RENDER_TEXT_ONLY)
+    {
+        prefetch_text(renderer);
+        return;
     }
 
     // if the page is cached and the bitmap has been rendered
@@ -121,11 +172,10 @@ void PDFRenderTask::execute()
     // be destroyed and new one is going to be rendered in the following
     // step
     int page_len = static_cast<int>(page->length());
+    int page_len_estimate = static_cast<int>(
+        renderer->estimate_bitmap_length(page_number, page_render_attr));
 
-    page_len = static_cast<int>(PDFPage::try_calc_length(real_zoom,
-                                doc_ctrl->get_page_crop_width(page_number),
-                                doc_ctrl->get_page_crop_height(page_number))) -
-               page_len;
+    page_len = page_len_estimate - page_len;
 
     PDFPage::RenderStatus cur_status = page->get_render_status();
     if (!(page->get_render_attr() == page_render_attr))
@@ -138,6 +188,7 @@ void PDFRenderTask::execute()
     }
     
     bool render_done = true;
+    bool previewed = false;
 
     // render bitmap
     if (cur_status != PDFPage::RENDER_DONE)
@@ -148,7 +199,28 @@ void PDFRenderTask::execute()
         // must be enough
         // TODO. Add the page number as one parameter for making enough memory
         // The pages with lower priorites would be released.
-        if (page_len > 0 &&
+
+        // a preview holds a bitmap of its own until it is refined
+        bool preview = render_result != 0 && !refreshing && want_preview();
+        if (preview &&
+            !PDFLibrary::instance().make_enough_memory(doc_ctrl,
+                                                       page_number,
+                                                       page_len + page_len_estimate))
+        {
+            preview = false;
+        }
+
+        // so does the whole page UDS shows while it is cropped
+        if (refreshing &&
+            !PDFLibrary::instance().make_enough_memory(doc_ctrl,
+                                                       page_number,
+                                                       page_len_estimate))
+        {
+            // UDS keeps the whole page
+            return;
+        }
+
+        if (!preview && !refreshing && page_len > 0 &&
             !PDFLibrary::instance().make_enough_memory(doc_ctrl,
                                                        page_number,
                                                        page_len))
@@ -162,37 +234,99 @@ void PDFRenderTask::execute()
         }
 
         // update the render status
+        if (refreshing)
+        {
+            page->keep_as_preview();
+        }
         page->set_render_status(cur_status);
 
         // only set the render attributes
         page->set_render_attr(page_render_attr);
 
+        previewed = preview && deliver_preview(renderer);
+
+        long long render_start = PDFStats::now();
         render_done = page->render_splash_map(renderer
             , static_cast<void*>(this));
+        if (render_done)
+        {
+            doc_ctrl->get_prerender_policy()->report_render_cost(
+                PDFStats::now() - render_start);
+        }
 
-        // render the text page when the render is done
+        // render the text page when the render is done, unless it has
+        // been prefetched at these settings
         if (render_done)
         {
-            page->render_text(renderer);
+            if (!page->has_text_at_render_attr())
+            {
+                page->render_text(renderer);
+            }
+            page->set_prerendered(render_result == 0);
+            if (render_result == 0)
+            {
+                doc_ctrl->get_stats().inc(COUNTER_PRERENDERED);
+            }
         }
     }
 
+    // UDS has released the result holding the preview, nobody waits for
+    // the refinement
+    bool released = (previewed || refreshing) && render_result->is_released();
+
     if (render_done)
     {
         // set the render status at last
         page->set_render_status(PDFPage::RENDER_DONE);
 
-        if (render_result != 0)
+        if (render_result != 0 && !released)
         {
             // set the page into render result
             render_result->set_page(page);
+            page->set_shown();
         }
 
         // notify uds that the page is ready
-        renderer->handle_page_ready(render_result, page, TASK_RENDER_DONE);
+        if (!released)
+        {
+            if (uncropped)
+            {
+                renderer->wait_for_content_area(page_number, page_render_attr,
+                                                render_result, ref_id, generation);
+            }
+            renderer->handle_page_ready(render_result, page, TASK_RENDER_DONE);
+        }
+
+        if (render_result != 0 && request_issued != 0)
+        {
+            doc_ctrl->get_stats().add_latency(request_outcome,
+                                              PDFStats::now() - request_issued);
+        }
+
+        // reduce the new bitmap for later zoom changes, after UDS has it
+        if (cur_status != PDFPage::RENDER_DONE)
+        {
+            page->build_pyramid();
+        }
+    }
+    else if (previewed || refreshing)
+    {
+        // UDS keeps showing the preview, the next request for the page
+        // renders it again
+        doc_ctrl->get_stats().inc(COUNTER_TASK_ABORTED);
+        doc_ctrl->get_stats().inc(COUNTER_REFINE_ABANDONED);
     }
     else
     {
+        if (is_aborted())
+        {
+            doc_ctrl->get_stats().inc(COUNTER_TASK_ABORTED);
+            if (render_result == 0)
+            {
+                doc_ctrl->get_stats().inc(COUNTER_PRERENDER_WASTED);
+            }
+        }
+
         if (render_result != 0 && is_aborted())
         {
             // if the task is aborted, set the render result to "Discard"
@@ -204,6 +338,79 @@ void PDFRenderTask::execute()
         }
     }
 
+    if (previewed)
+    {
+        render_result->set_refining(false);
+    }
+
+    // a visible page task aborts the content area task, resume it
+    if (!is_aborted())
+    {
+        doc_ctrl->post_background_task();
+    }
+}
+
+bool PDFRenderTask::want_preview()
+{
+    // a zoom change is scaled from the bitmap at the old zoom, which
+    // costs less than any rendering
+    if (page->has_scalable_bitmap(page_render_attr))
+    {
+        return true;
+    }
+
+    // a subsampled rendering shares the decoded page with the full one,
+    // it only saves the time spent rasterizing
+    const LatencyHistogram &raster = doc_ctrl->get_stats().get_histogram(STAGE_RASTER);
+    return raster.count() > 0 && raster.mean() >= PREVIEW_MIN_RASTER;
+}
+
+bool PDFRenderTask::deliver_preview(PDFRenderer *renderer)
+{
+    if (!page->render_preview(renderer, static_cast<void*>(this)))
+    {
+        return false;
+    }
+
+    // the result now refers to the page, it is refined in place
+    render_result->set_refining(true);
+    render_result->set_page(page);
+    renderer->handle_page_ready(render_result, page, TASK_RENDER_PREVIEW);
+
+    if (request_issued != 0)
+    {
+        doc_ctrl->get_stats().add_latency(STAGE_REQUEST_PREVIEW,
+                                          PDFStats::now() - request_issued);
+    }
+    return true;
+}
+
+void PDFRenderTask::prefetch_text(PDFRenderer *renderer)
+{
+    // a page that has a bitmap, or is getting one, keeps the text that
+    // matches it
+    if (page->get_bitmap() != 0 ||
+        page->get_render_status() == PDFPage::RENDER_RUNNING)
+    {
+        return;
+    }
+
+    page->set_render_attr(page_render_attr);
+    if (!page->has_text_at_render_attr())
+    {
+        page->render_text(renderer);
+    }
+}
+
+bool PDFRenderTask::check_superseded()
+{
+    if (generation != 0 && !is_aborted() &&
+        generation != doc_ctrl->get_renderer()->get_generation())
+    {
+        doc_ctrl->get_stats().inc(COUNTER_TASK_SUPERSEDED);
+        abort();
+    }
+    return is_aborted();
 }
 
 bool PDFRenderTask::is_page_out_of_date()
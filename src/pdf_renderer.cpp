@@ -29,6 +29,7 @@
 #include "pdf_anchor.h"
 #include "pdf_render_task.h"
 #include "pdf_library.h"
+#include "pdf_bitmap_ops.h"
 #include "log.h"
 
 namespace pdf
@@ -36,6 +37,11 @@ namespace pdf
 
 SplashColor PDFRenderer::background_color = {255, 255, 255, 0};
 
+// Requests closer together than this are a burst of page flips, during
+// which prerendering waits for PRERENDER_DEBOUNCE after the last request.
+static const long long FLIP_BURST_INTERVAL = 400 * 1000LL;
+static const long long PRERENDER_DEBOUNCE  = 300 * 1000LL;
+
 PDFRenderer::PDFRenderer()
 : doc_controller(0)
 , splash_output_dev(0)
@@ -43,7 +49,17 @@ PDFRenderer::PDFRenderer()
 , thumbnail_output_dev(0)
 , view_attr()
 , cur_render_attr()
+, post_process()
 , render_mutex()
+, generation(0)
+, crop_mutex()
+, crop_page(0)
+, crop_attr()
+, crop_result(0)
+, crop_ref_id(0)
+, crop_generation(0)
+, last_request_time(0)
+, prerender_not_before(0)
 {
 }
 
@@ -96,6 +112,10 @@ bool PDFRenderer::initialize(PDFController* doc)
 
     thumbnail_output_dev->startDoc(doc_controller->get_pdf_doc()->getXRef());
 
+    // thumbnails are rendered once, their decoded pages would push the
+    // pages being read out of the decoded pages cache
+    thumbnail_output_dev->setCacheDecoded(gFalse);
+
     init_pages_index_table();
 
     return true;
@@ -104,6 +124,8 @@ bool PDFRenderer::initialize(PDFController* doc)
 
 void PDFRenderer::destroy()
 {
+    cancel_content_area_wait();
+
     delete splash_output_dev;
     splash_output_dev = 0;
 
@@ -138,6 +160,9 @@ void PDFRenderer::calc_real_zoom(int page_number,
     }
 
     real_attr = origin_attr;
+    PostProcessSettings output = post_process;
+    output.depth = PostProcessSettings::output_depth(view_attr.get_color_depth());
+    real_attr.set_post_process(output);
     double real_zoom = origin_attr.get_zoom_setting();
 
     if (real_zoom < 0)
@@ -176,34 +201,40 @@ void PDFRenderer::calc_real_zoom(int page_number,
         else if (real_zoom == PLUGIN_ZOOM_TO_CROP_BY_PAGE ||
                  real_zoom == PLUGIN_ZOOM_TO_CROP_BY_WIDTH)
         {
-            // try to get the content area from the page
-            PagePtr page = doc_controller->get_page(page_number);
-            if (page != 0 && is_render_area_valid(page->get_content_area()))
+            // the background content area task fills the table, until it
+            // gets to this page the whole page is shown
+            RenderArea content_area;
+            if (!doc_controller->get_content_areas().get(page_number, content_area))
             {
-                // calculate the real zoom by the content area
-                PluginRectangle rect;
-                get_content_area_in_pixel(page->get_content_area(),
-                                          crop_width, crop_height, rect);
-
-                crop_width = rect.width;
-                crop_height = rect.height;
-                if (real_attr.get_rotate() == Clockwise_Degrees_90 ||
-                    real_attr.get_rotate() == Clockwise_Degrees_270)
-                {
-                    std::swap(crop_height, crop_width);
-                }
+                content_area.x_offset = 0.0f;
+                content_area.y_offset = 0.0f;
+                content_area.width    = 1.0f;
+                content_area.height   = 1.0f;
+            }
 
-                zoom_v = static_cast<double>(display_height) * 100 / crop_height;
-                zoom_h = static_cast<double>(display_width) * 100 / crop_width;
+            // calculate the real zoom by the content area
+            PluginRectangle rect;
+            get_content_area_in_pixel(content_area,
+                                      crop_width, crop_height, rect);
 
-                if (real_zoom == PLUGIN_ZOOM_TO_CROP_BY_PAGE)
-                {
-                    real_zoom = min(zoom_v, zoom_h);
-                }
-                else
-                {
-                    real_zoom = zoom_h;
-                }
+            crop_width = rect.width;
+            crop_height = rect.height;
+            if (real_attr.get_rotate() == Clockwise_Degrees_90 ||
+                real_attr.get_rotate() == Clockwise_Degrees_270)
+            {
+                std::swap(crop_height, crop_width);
+            }
+
+            zoom_v = static_cast<double>(display_height) * 100 / crop_height;
+            zoom_h = static_cast<double>(display_width) * 100 / crop_width;
+
+            if (real_zoom == PLUGIN_ZOOM_TO_CROP_BY_PAGE)
+            {
+                real_zoom = min(zoom_v, zoom_h);
+            }
+            else
+            {
+                real_zoom = zoom_h;
             }
         }
     }
@@ -221,7 +252,8 @@ bool PDFRenderer::render_cover_page(const int width, const int height
     }
 
     int cover_num = 1;
-    // 1. calculate the zoom, fit for best
+    // 1. calculate the zoom, fit for best, by the exact size
+    doc_controller->get_pdf_doc()->prefetchPageInfo(cover_num);
     double crop_width = doc_controller->get_page_crop_width(cover_num);
     double crop_height = doc_controller->get_page_crop_height(cover_num);
 
@@ -238,9 +270,9 @@ bool PDFRenderer::render_cover_page(const int width, const int height
         , zoom * get_view_attr().get_device_dpi_h()
         , zoom * get_view_attr().get_device_dpi_v()
         , 0
-        , gFalse //useMediaBox, TODO.
-        , gFalse  //crop, TODO.
-        , gFalse  //doLinks, TODO.
+        , gFalse  // useMediaBox
+        , gFalse  // crop
+        , gFalse  // doLinks
     );
 
     if (ret == Render_Error || ret == Render_Invalid)
@@ -250,6 +282,13 @@ bool PDFRenderer::render_cover_page(const int width, const int height
     }
 
     SplashBitmap *cover_map = get_thumbnail_output_dev()->takeBitmap();
+    if (cover_map != 0 && cover_map->getMode() != splashModeMono8)
+    {
+        // text only pages come out as 1 bit masks, the cover is 8 bit grey
+        SplashBitmap *grey = convert_bitmap(cover_map, splashModeMono8, DITHER_NONE);
+        delete cover_map;
+        cover_map = grey;
+    }
     if (cover_map != 0)
     {
         memcpy((void*)output->data, cover_map->getDataPtr(),
@@ -261,6 +300,167 @@ bool PDFRenderer::render_cover_page(const int width, const int height
     return false;
 }
 
+// Get the content rectangle of a thumbnail bitmap
+static bool get_content_from_bitmap(SplashBitmap *bitmap, PDFRectangle &rect)
+{
+    // darker than this is ink
+    static const unsigned char INK_THRESHOLD = 192;
+    // share of a row or column that may be speckle
+    static const double NOISE_SHARE   = 0.01f;
+    // margins are at most this share of the page on each side
+    static const double SHRINK_RANGE  = 0.3f;
+
+    int width = bitmap->getWidth();
+    int height = bitmap->getHeight();
+    int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+    if (!find_content_bounds(bitmap, INK_THRESHOLD, NOISE_SHARE, x1, y1, x2, y2))
+    {
+        return false;
+    }
+
+    rect.x1 = min(x1, static_cast<int>(SHRINK_RANGE * width));
+    rect.y1 = min(y1, static_cast<int>(SHRINK_RANGE * height));
+    rect.x2 = max(x2, static_cast<int>((1.0f - SHRINK_RANGE) * width));
+    rect.y2 = max(y2, static_cast<int>((1.0f - SHRINK_RANGE) * height));
+    return true;
+}
+
+bool PDFRenderer::detect_content_area(int page_number, RenderArea &area
+                                      , GBool (*abort_check)(void *data)
+                                      , void *abort_data)
+{
+    static const double SHRINK_ZOOM = 0.2f;
+    static const int    EXPAND_STEP = 2;
+
+    StatsTimer timer(doc_controller->get_stats(), STAGE_CONTENT_AREA);
+
+    SplashBitmap *thumb_map = 0;
+    {
+        // lock when rendering
+        ScopeMutex m(&render_mutex);
+
+        RenderRet ret = doc_controller->get_pdf_doc()->displayPage(
+            get_thumbnail_output_dev()
+            , page_number
+            , SHRINK_ZOOM * get_view_attr().get_device_dpi_h()
+            , SHRINK_ZOOM * get_view_attr().get_device_dpi_v()
+            , 0
+            , gFalse  // useMediaBox
+            , gFalse  // crop
+            , gFalse  // doLinks
+            , abort_check
+            , abort_data
+            );
+
+        if (ret == Render_Abort)
+        {
+            return false;
+        }
+
+        if (ret == Render_Error || ret == Render_Invalid)
+        {
+            ERRORPRINTF("Error in rendering thumbnail page:%d\n", page_number);
+        }
+        else
+        {
+            thumb_map = get_thumbnail_output_dev()->takeBitmap();
+        }
+    }
+
+    if (thumb_map == 0)
+    {
+        // crop nothing
+        area.x_offset = 0.0f;
+        area.y_offset = 0.0f;
+        area.width    = 1.0f;
+        area.height   = 1.0f;
+        return true;
+    }
+
+    // the thumbnail is short lived, but it is memory all the same
+    int thumb_length = thumb_map->getHeight() * thumb_map->getRowSize();
+    doc_controller->update_memory_usage(thumb_length, MEMORY_AUX);
+
+    PDFRectangle content_rect;
+    bool succeed = get_content_from_bitmap(thumb_map, content_rect);
+    // calculate the render area by the rectangle
+    double page_width = thumb_map->getWidth();
+    double page_height = thumb_map->getHeight();
+    delete thumb_map;
+    doc_controller->update_memory_usage((-1) * thumb_length, MEMORY_AUX);
+    if (!succeed)
+    {
+        // set the content area to be the page area
+        content_rect.x1 = content_rect.y1 = 0;
+        content_rect.x2 = page_width;
+        content_rect.y2 = page_height;
+    }
+    else
+    {
+        // expand the content area to avoid content covering
+        double inc_x2 = 0;
+        double inc_y2 = 0;
+
+        // expand x1
+        if (content_rect.x1 > EXPAND_STEP)
+        {
+            content_rect.x1 -= EXPAND_STEP;
+            inc_x2 = EXPAND_STEP;
+        }
+        else
+        {
+            inc_x2 = content_rect.x1;
+            content_rect.x1 = 0;
+        }
+
+        // expand y1
+        if (content_rect.y1 > EXPAND_STEP)
+        {
+            content_rect.y1 -= EXPAND_STEP;
+            inc_y2 = EXPAND_STEP;
+        }
+        else
+        {
+            inc_y2 = content_rect.y1;
+            content_rect.y1 = 0;
+        }
+
+        // expand x2
+        content_rect.x2 += (inc_x2 + 1);
+        if (content_rect.x2 > page_width)
+        {
+            content_rect.x2 = page_width;
+        }
+
+        // expand y2
+        content_rect.y2 += (inc_y2 + 1);
+        if (content_rect.y2 > page_height)
+        {
+            content_rect.y2 = page_height;
+        }
+    }
+
+    area.x_offset = static_cast<float>(content_rect.x1 / page_width);
+    area.y_offset = static_cast<float>(content_rect.y1 / page_height);
+
+    area.width =
+        static_cast<float>((content_rect.x2 - content_rect.x1) / page_width);
+    area.height =
+        static_cast<float>((content_rect.y2 - content_rect.y1) / page_height);
+
+    if (area.width > 1.0f)
+    {
+        area.x_offset = 0.0f;
+        area.width    = 1.0f;
+    }
+    if (area.height > 1.0f)
+    {
+        area.y_offset = 0.0f;
+        area.height   = 1.0f;
+    }
+    return true;
+}
+
 void PDFRenderer::post_prerender_task(const size_t page_number,
                                       const PDFRenderAttributes &page_attr)
 {
@@ -289,10 +489,16 @@ void PDFRenderer::post_prerender_task(const size_t page_number,
 
     if (task != 0)
     {
-        PDFLibrary::instance().thread_add_render_task(task, true, false);
+        queue_prerender_task(task);
     }
 }
 
+void PDFRenderer::queue_prerender_task(PDFRenderTask *task)
+{
+    task->set_not_before(prerender_not_before);
+    PDFLibrary::instance().thread_add_render_task(task, true, false);
+}
+
 void PDFRenderer::post_prerender_hyperlinks_task(PagePtr page)
 {
     if (page == 0)
@@ -315,7 +521,6 @@ void PDFRenderer::post_prerender_hyperlinks_task(PagePtr page)
         return;
     }
 
-    link_num = doc_controller->get_prerender_policy()->get_allowed_hyperlinks_number();
     PDFRenderAttributes real_attr;
     for (int i = 0; i < link_num; i++)
     {
@@ -366,6 +571,17 @@ void PDFRenderer::post_render_task(int page_num,
         return;
     }
 
+    long long issued = PDFStats::now();
+
+    // every request supersedes the visible page tasks posted before
+    g_atomic_int_inc(&generation);
+    prerender_not_before = (issued - last_request_time < FLIP_BURST_INTERVAL) ?
+                           issued + PRERENDER_DEBOUNCE : 0;
+    last_request_time = issued;
+
+    // the page waiting for its content area is not visible any more
+    cancel_content_area_wait();
+
     // set the current displaying page
     int last_page = doc_controller->get_cur_page_num();
     doc_controller->set_cur_page_num(page_num);
@@ -375,6 +591,17 @@ void PDFRenderer::post_render_task(int page_num,
     // update global render setting
     cur_render_attr = real_attr;
 
+    // the number of bitmaps at the new settings that fit in the cache,
+    // the requests beyond it only get their text prefetched
+    size_t budget = static_cast<size_t>(-1);
+    unsigned int estimate = estimate_bitmap_length(page_num, real_attr);
+    if (estimate > 0 && doc_controller->get_memory_limit() > 0)
+    {
+        budget = std::max(1u, doc_controller->get_memory_limit() / estimate);
+        doc_controller->get_prerender_policy()->set_page_budget(
+            static_cast<int>(budget));
+    }
+
     // generate request queue of rendering based on current page and last page
     // at this moment, the previous request queue would be cleared.
     std::vector<size_t> requests;
@@ -387,6 +614,7 @@ void PDFRenderer::post_render_task(int page_num,
     PagePtr page = doc_controller->get_page(page_num);
     PDFRenderTask* render_task = 0;
     bool abort_current_task = true;
+    StatsStage outcome = STAGE_REQUEST_RENDERED;
     if (page)
     {
         {
@@ -398,8 +626,12 @@ void PDFRenderer::post_render_task(int page_num,
                 {
                     // update the reference to this page, make it ready to display
                     // need NOT generate a new render task
+                    outcome = page->is_unused_prerender() ?
+                        STAGE_REQUEST_PRERENDERED : STAGE_REQUEST_CACHED;
                     page->set_ref_id(ref_id);
                     render_res->set_page(page);
+                    page->set_shown();
+                    doc_controller->get_stats().inc(COUNTER_CACHE_HIT);
                 }
                 else
                 {
@@ -410,7 +642,9 @@ void PDFRenderer::post_render_task(int page_num,
                                                   ref_id);
                     if (page->get_render_status() == PDFPage::RENDER_RUNNING)
                     {
+                        // a prerender of this page is running, wait for it
                         abort_current_task = false;
+                        outcome = STAGE_REQUEST_WAITED;
                     }
                 }
             }
@@ -434,6 +668,9 @@ void PDFRenderer::post_render_task(int page_num,
 
     if (render_task != 0)
     {
+        doc_controller->get_stats().inc(COUNTER_CACHE_MISS);
+        render_task->set_request(outcome, issued);
+        render_task->set_generation(get_generation());
         LOGPRINTF("PDF tries to render page:%d zoom:%f\n\n",
                   page_num,
                   real_attr.get_zoom_setting());
@@ -450,7 +687,13 @@ void PDFRenderer::post_render_task(int page_num,
              page->get_render_status() == PDFPage::RENDER_DONE)
     {
         // if the page is ready, return it to UDS
+        if (lacks_content_area(page_num, real_attr))
+        {
+            wait_for_content_area(page_num, real_attr, render_res, ref_id,
+                                  get_generation());
+        }
         handle_page_ready(render_res, page, TASK_RENDER_DONE);
+        doc_controller->get_stats().add_latency(outcome, PDFStats::now() - issued);
     }
 
     // prerender the pages, start from 1 in the requests list because
@@ -458,8 +701,90 @@ void PDFRenderer::post_render_task(int page_num,
     for (size_t idx = 1; idx < requests.size(); ++idx)
     {
         int dst_page = requests.at(idx);
-        post_prerender_task(dst_page, render_attr);
+        if (idx < budget)
+        {
+            post_prerender_task(dst_page, render_attr);
+        }
+        else
+        {
+            post_prefetch_task(dst_page, render_attr);
+        }
+    }
+
+    // decode the pages further ahead, these tasks are queued last so
+    // they only take the idle time of the working thread
+    std::vector<size_t> prefetch;
+    doc_controller->get_prerender_policy()->generate_prefetch_list(page_num,
+                                                                   doc_controller->page_count(),
+                                                                   prefetch);
+    for (size_t idx = 0; idx < prefetch.size(); ++idx)
+    {
+        post_decode_task(prefetch.at(idx), render_attr);
+    }
+}
+
+void PDFRenderer::post_decode_task(const size_t page_number,
+                                   const PDFRenderAttributes &page_attr)
+{
+    PagePtr page = doc_controller->get_page(page_number);
+    if (page != 0 && page->get_bitmap() != 0)
+    {
+        // already rendered
+        return;
     }
+
+    PDFRenderTask *task = gen_render_task(page_number, page_attr);
+    task->set_mode(PDFRenderTask::RENDER_DECODE_ONLY);
+    queue_prerender_task(task);
+}
+
+void PDFRenderer::post_prefetch_task(const size_t page_number,
+                                     const PDFRenderAttributes &page_attr)
+{
+    PDFRenderAttributes real_attr;
+    calc_real_zoom(page_number, page_attr, real_attr);
+
+    PagePtr page = doc_controller->get_page(page_number);
+    if (page != 0 &&
+        (page->get_bitmap() != 0 ||
+         (page->get_render_attr() == real_attr && page->has_text_at_render_attr())))
+    {
+        // nothing to prefetch
+        return;
+    }
+
+    PDFRenderTask *task = page ? gen_render_task(page, real_attr)
+                               : gen_render_task(page_number, real_attr);
+    task->set_mode(PDFRenderTask::RENDER_TEXT_ONLY);
+    queue_prerender_task(task);
+}
+
+unsigned int PDFRenderer::estimate_bitmap_length(int page_num,
+                                                 const PDFRenderAttributes &attr)
+{
+    // the splash output device clips the bitmap to this size
+    static const unsigned int MAX_BITMAP_LENGTH = 2000 * 2500;
+
+    // the cache keeps every bitmap at the output depth, text only pages
+    // rendered as 1 bit masks included, see convert_to_output_depth.
+    // Packed output takes a fraction of a byte per pixel.
+    unsigned int depth = attr.get_post_process().depth;
+
+    double zoom = attr.get_real_zoom_value();
+    if (zoom <= 0)
+    {
+        // the content area is not known yet, assume it fills the display
+        unsigned int len = view_attr.get_display_width() * view_attr.get_display_height();
+        return len * depth / 8;
+    }
+
+    // the output device renders at zoom * dpi / 72
+    unsigned int len = PDFPage::try_calc_length(
+        zoom * view_attr.get_device_dpi_h() / 72.0,
+        doc_controller->get_page_crop_width(page_num),
+        doc_controller->get_page_crop_height(page_num));
+
+    return std::min(len, MAX_BITMAP_LENGTH) * depth / 8;
 }
 
 void PDFRenderer::handle_page_ready(PluginRenderResultImpl *render_res,
@@ -489,6 +814,11 @@ void PDFRenderer::handle_page_ready(PluginRenderResultImpl *render_res,
             // notify uds if it is out of memory
         }
         break;
+    case TASK_RENDER_PREVIEW:
+        {
+            // the hyperlinks are prerendered when the full bitmap is done
+        }
+        break;
     case TASK_RENDER_INVALID_PAGE:
         {
             // notify uds it is an invalid page
@@ -501,10 +831,127 @@ void PDFRenderer::handle_page_ready(PluginRenderResultImpl *render_res,
     if (render_res != 0)
     {
         // notify uds that the page has been done, only for rendered result
+        TRACE_EVENT_SCOPE(TRACE_STAGE, "dispatch", page ? page->get_page_num() : -1, 0);
+        StatsTimer timer(doc_controller->get_stats(), STAGE_BROADCAST);
         doc_controller->sig_page_ready.broadcast(render_res, stat);
     }
 }
 
+bool PDFRenderer::lacks_content_area(int page_number,
+                                     const PDFRenderAttributes &attr)
+{
+    double zoom_setting = attr.get_zoom_setting();
+    if (zoom_setting != PLUGIN_ZOOM_TO_CROP_BY_PAGE &&
+        zoom_setting != PLUGIN_ZOOM_TO_CROP_BY_WIDTH)
+    {
+        return false;
+    }
+
+    RenderArea area;
+    return !doc_controller->get_content_areas().get(page_number, area);
+}
+
+void PDFRenderer::wait_for_content_area(int page_number,
+                                        const PDFRenderAttributes &attr,
+                                        PluginRenderResultImpl *render_res,
+                                        const unsigned int ref_id,
+                                        const unsigned int gen)
+{
+    if (render_res == 0)
+    {
+        return;
+    }
+
+    // the result must stay until it is refreshed
+    render_res->set_refining(true);
+
+    PluginRenderResultImpl *dropped = 0;
+    {
+        ScopeMutex m(&crop_mutex);
+        dropped = crop_result;
+        crop_page = page_number;
+        crop_attr = attr;
+        crop_result = render_res;
+        crop_ref_id = ref_id;
+        crop_generation = gen;
+    }
+    if (dropped != 0)
+    {
+        dropped->set_refining(false);
+    }
+
+    // the content area task takes this page first
+    RenderArea area;
+    if (doc_controller->get_content_areas().get(page_number, area))
+    {
+        content_area_found(page_number);
+    }
+    else
+    {
+        doc_controller->post_background_task();
+    }
+}
+
+int PDFRenderer::get_cropping_page()
+{
+    ScopeMutex m(&crop_mutex);
+    return crop_page;
+}
+
+void PDFRenderer::content_area_found(int page_number)
+{
+    PluginRenderResultImpl *render_res = 0;
+    PDFRenderAttributes attr;
+    unsigned int ref_id = 0;
+    unsigned int gen = 0;
+    {
+        ScopeMutex m(&crop_mutex);
+        if (crop_page != page_number)
+        {
+            return;
+        }
+        render_res = crop_result;
+        attr = crop_attr;
+        ref_id = crop_ref_id;
+        gen = crop_generation;
+        crop_page = 0;
+        crop_result = 0;
+    }
+
+    PagePtr page = doc_controller->get_page(page_number);
+    PDFRenderAttributes real_attr;
+    calc_real_zoom(page_number, attr, real_attr);
+    if (gen != get_generation() || page == 0 ||
+        page->get_render_attr() == real_attr)
+    {
+        // superseded, or the content fills the page
+        render_res->set_refining(false);
+        return;
+    }
+
+    // render the cropped page into the result UDS shows, the task keeps
+    // the reference taken for it
+    PDFRenderTask *task = gen_render_task(page, real_attr, render_res, ref_id);
+    task->set_generation(gen);
+    task->set_refreshing();
+    PDFLibrary::instance().thread_add_render_task(task, false, false);
+}
+
+void PDFRenderer::cancel_content_area_wait()
+{
+    PluginRenderResultImpl *render_res = 0;
+    {
+        ScopeMutex m(&crop_mutex);
+        render_res = crop_result;
+        crop_page = 0;
+        crop_result = 0;
+    }
+    if (render_res != 0)
+    {
+        render_res->set_refining(false);
+    }
+}
+
 PDFRenderTask* PDFRenderer::gen_render_task(int page_num,
                                             const PDFRenderAttributes &page_attr,
                                             PluginRenderResultImpl *render_res,
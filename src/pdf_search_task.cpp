@@ -27,6 +27,7 @@
 #include "log.h"
 
 #include "pdf_search_task.h"
+#include "pdf_doc_controller.h"
 
 namespace pdf
 {
@@ -82,6 +83,9 @@ void PDFSearchTask::execute()
     {
         // broadcast
         searcher->notify(res, results, search_id);
+
+        // the search aborted the content area task, resume it
+        searcher->get_doc_ctrl()->post_background_task();
     }
 }
 
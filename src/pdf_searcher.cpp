@@ -269,7 +269,8 @@ SearchResult PDFSearcher::search_current_page(SearchContext &ctx
 
     if (need_remove_text)
     {
-        cur_page->destroy_text();
+        doc_controller->update_memory_usage(
+            (-1) * static_cast<int>(cur_page->destroy_text()), MEMORY_TEXT);
     }
 
     return res;
@@ -0,0 +1,319 @@
+/*
+ * File Name: pdf_sidecar.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "pdf_sidecar.h"
+
+namespace pdf
+{
+
+// Bump the version whenever the layout changes, old sidecars are ignored
+static const char   SIDECAR_MAGIC[8] = { 'D', 'J', 'V', 'U', 'M', 'E', 'T', 'A' };
+static const guint32 SIDECAR_VERSION = 2;
+static const char * SIDECAR_DIR     = "uds-djvu";
+
+// The file starts with the header, followed by the page infos, the
+// content areas and the outline. Everything is in host byte order, the
+// magic and the sizes keep a foreign file from being used.
+struct SidecarHeader
+{
+    char    magic[8];
+    guint32 version;
+    guint32 header_size;
+    guint64 path_hash;
+    guint64 doc_size;
+    gint64  doc_mtime;
+    guint32 page_count;         ///< DjVu pages
+    guint32 area_count;         ///< pages shown, twice as many in two page mode
+    guint32 known_pages;
+    guint32 known_areas;
+    guint32 outline_size;       ///< 0 if there is no outline
+    guint32 reserved;
+};
+
+// FNV-1a
+static guint64 hash_string(const char *str)
+{
+    guint64 hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = reinterpret_cast<const unsigned char *>(str); *p; ++p)
+    {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static const SidecarHeader * header_of(const char *data)
+{
+    return reinterpret_cast<const SidecarHeader *>(data);
+}
+
+static size_t pages_offset()
+{
+    return sizeof(SidecarHeader);
+}
+
+static size_t areas_offset(const SidecarHeader *header)
+{
+    return pages_offset() + header->page_count * sizeof(PDFSidecar::PageInfo);
+}
+
+static size_t outline_offset(const SidecarHeader *header)
+{
+    return areas_offset(header) + header->area_count * 4 * sizeof(unsigned short);
+}
+
+PDFSidecar::PDFSidecar()
+: data(0)
+, size(0)
+{
+}
+
+PDFSidecar::~PDFSidecar()
+{
+    close();
+}
+
+bool PDFSidecar::get_sidecar_path(const char *doc_path
+                                  , std::string &path
+                                  , guint64 &path_hash
+                                  , guint64 &doc_size
+                                  , gint64 &doc_mtime)
+{
+    struct stat st;
+    if (stat(doc_path, &st) != 0)
+    {
+        return false;
+    }
+
+    path_hash = hash_string(doc_path);
+    doc_size  = static_cast<guint64>(st.st_size);
+    doc_mtime = static_cast<gint64>(st.st_mtime);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.meta",
+             static_cast<unsigned long long>(path_hash));
+    gchar *file = g_build_filename(g_get_user_cache_dir(), SIDECAR_DIR, name, NULL);
+    path = file;
+    g_free(file);
+    return true;
+}
+
+bool PDFSidecar::open(const char *doc_path)
+{
+    close();
+
+    std::string path;
+    guint64 path_hash = 0, doc_size = 0;
+    gint64 doc_mtime = 0;
+    if (!get_sidecar_path(doc_path, path, path_hash, doc_size, doc_mtime))
+    {
+        return false;
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 &&
+        static_cast<size_t>(st.st_size) >= sizeof(SidecarHeader))
+    {
+        map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    const char *mapped = static_cast<const char *>(map);
+    const SidecarHeader *header = header_of(mapped);
+    size_t file_size = static_cast<size_t>(st.st_size);
+    if (memcmp(header->magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) != 0 ||
+        header->version != SIDECAR_VERSION ||
+        header->header_size != sizeof(SidecarHeader) ||
+        header->path_hash != path_hash ||
+        header->doc_size != doc_size ||
+        header->doc_mtime != doc_mtime ||
+        header->page_count > file_size ||
+        header->area_count > file_size ||
+        outline_offset(header) + header->outline_size != file_size)
+    {
+        // stale or foreign, it is replaced when the document is closed
+        munmap(map, file_size);
+        return false;
+    }
+
+    data = mapped;
+    size = file_size;
+    return true;
+}
+
+void PDFSidecar::close()
+{
+    if (data != 0)
+    {
+        munmap(const_cast<char *>(data), size);
+        data = 0;
+        size = 0;
+    }
+}
+
+int PDFSidecar::get_page_count() const
+{
+    return data ? static_cast<int>(header_of(data)->page_count) : 0;
+}
+
+int PDFSidecar::get_area_count() const
+{
+    return data ? static_cast<int>(header_of(data)->area_count) : 0;
+}
+
+int PDFSidecar::get_known_pages() const
+{
+    return data ? static_cast<int>(header_of(data)->known_pages) : 0;
+}
+
+int PDFSidecar::get_known_areas() const
+{
+    return data ? static_cast<int>(header_of(data)->known_areas) : 0;
+}
+
+bool PDFSidecar::get_page_info(const int pageno, PageInfo &info) const
+{
+    if (pageno < 0 || pageno >= get_page_count())
+    {
+        return false;
+    }
+
+    memcpy(&info, data + pages_offset() + pageno * sizeof(PageInfo), sizeof(PageInfo));
+    return info.width > 0 && info.height > 0 && info.dpi > 0;
+}
+
+const unsigned short * PDFSidecar::get_content_areas() const
+{
+    if (data == 0)
+    {
+        return 0;
+    }
+    return reinterpret_cast<const unsigned short *>(data + areas_offset(header_of(data)));
+}
+
+const char * PDFSidecar::get_outline(unsigned int &outline_size) const
+{
+    outline_size = data ? header_of(data)->outline_size : 0;
+    if (outline_size == 0)
+    {
+        return 0;
+    }
+    return data + outline_offset(header_of(data));
+}
+
+bool PDFSidecar::save(const char *doc_path, const Contents &contents)
+{
+    std::string path;
+    SidecarHeader header;
+    memset(&header, 0, sizeof(header));
+    if (!get_sidecar_path(doc_path, path, header.path_hash,
+                          header.doc_size, header.doc_mtime))
+    {
+        return false;
+    }
+
+    memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+    header.version      = SIDECAR_VERSION;
+    header.header_size  = sizeof(SidecarHeader);
+    header.page_count   = static_cast<guint32>(contents.pages.size());
+    header.area_count   = static_cast<guint32>(contents.areas.size() / 4);
+    header.outline_size = static_cast<guint32>(contents.outline.size());
+    for (size_t i = 0; i < contents.pages.size(); ++i)
+    {
+        if (contents.pages[i].width > 0)
+        {
+            ++header.known_pages;
+        }
+    }
+    for (size_t i = 2; i < contents.areas.size(); i += 4)
+    {
+        if (contents.areas[i] != 0)
+        {
+            ++header.known_areas;
+        }
+    }
+
+    gchar *dir = g_path_get_dirname(path.c_str());
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    // write a temporary file and rename it, so that a reader never maps
+    // a sidecar half written, and the mapping of the old one stays valid
+    std::string tmp_path = path + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "wb");
+    if (fp == 0)
+    {
+        ERRORPRINTF("Cannot write sidecar %s: %s", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    if (ok && !contents.pages.empty())
+    {
+        ok = fwrite(&contents.pages[0], sizeof(PageInfo),
+                    contents.pages.size(), fp) == contents.pages.size();
+    }
+    if (ok && header.area_count > 0)
+    {
+        ok = fwrite(&contents.areas[0], 4 * sizeof(unsigned short),
+                    header.area_count, fp) == header.area_count;
+    }
+    if (ok && !contents.outline.empty())
+    {
+        ok = fwrite(contents.outline.data(), contents.outline.size(), 1, fp) == 1;
+    }
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        ERRORPRINTF("Cannot write sidecar %s", path.c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+}   // namespace pdf
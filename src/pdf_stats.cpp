@@ -0,0 +1,403 @@
+/*
+ * File Name: pdf_stats.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pdf_stats.h"
+
+namespace pdf
+{
+
+// g_atomic_int_get() does not take a const pointer in older glib
+static inline gint atomic_get(const volatile gint *value)
+{
+    return g_atomic_int_get(const_cast<volatile gint *>(value));
+}
+
+static const char * STAGE_NAMES[STAGE_COUNT] =
+{
+    "decode",
+    "raster",
+    "text",
+    "content_area",
+    "eviction",
+    "broadcast",
+    "render_task",
+    "request_prerendered",
+    "request_cached",
+    "request_waited",
+    "request_rendered",
+    "request_preview"
+};
+
+static const char * COUNTER_NAMES[COUNTER_COUNT] =
+{
+    "cache_hit",
+    "cache_miss",
+    "eviction",
+    "task_aborted",
+    "task_superseded",
+    "prerender_wasted",
+    "pages_rendered",
+    "kbytes_rendered",
+    "prerendered",
+    "prerender_shown",
+    "prerender_evicted",
+    "prerender_invalidated",
+    "previews",
+    "refine_abandoned",
+    "bitonal_renders",
+    "content_areas",
+    "budget_evictions",
+    "decode_hit",
+    "decode_miss",
+    "decode_share",
+    "text_evictions"
+};
+
+static const char * GAUGE_NAMES[GAUGE_COUNT] =
+{
+    "memory_bitmap",
+    "memory_text",
+    "memory_links",
+    "memory_aux"
+};
+
+void LatencyHistogram::add(long long usec)
+{
+    if (usec < 0)
+    {
+        usec = 0;
+    }
+
+    // bucket index is the bit length of the sample
+    int idx = 0;
+    for (long long v = usec; v != 0 && idx < BUCKETS - 1; v >>= 1)
+    {
+        ++idx;
+    }
+
+    g_atomic_int_add(&buckets[idx], 1);
+    g_atomic_int_add(&samples, 1);
+
+    // carry the microseconds over to the milliseconds
+    long long ms = usec / 1000;
+    gint rem = static_cast<gint>(usec % 1000);
+    gint old_rem = atomic_get(&sum_rem_us);
+    while (!g_atomic_int_compare_and_exchange(&sum_rem_us, old_rem,
+                                              (old_rem + rem) % 1000))
+    {
+        old_rem = atomic_get(&sum_rem_us);
+    }
+    if (old_rem + rem >= 1000)
+    {
+        ++ms;
+    }
+    g_atomic_int_add(&sum_ms, ms > G_MAXINT ? G_MAXINT : static_cast<gint>(ms));
+
+    gint value = usec > G_MAXINT ? G_MAXINT : static_cast<gint>(usec);
+    gint old = atomic_get(&max_us);
+    while (value > old &&
+           !g_atomic_int_compare_and_exchange(&max_us, old, value))
+    {
+        old = atomic_get(&max_us);
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        g_atomic_int_set(&buckets[i], 0);
+    }
+    g_atomic_int_set(&samples, 0);
+    g_atomic_int_set(&sum_ms, 0);
+    g_atomic_int_set(&sum_rem_us, 0);
+    g_atomic_int_set(&max_us, 0);
+}
+
+unsigned int LatencyHistogram::count() const
+{
+    return static_cast<unsigned int>(atomic_get(&samples));
+}
+
+unsigned int LatencyHistogram::mean() const
+{
+    unsigned int n = count();
+    if (n == 0)
+    {
+        return 0;
+    }
+    long long sum = static_cast<long long>(atomic_get(&sum_ms)) * 1000 +
+                    atomic_get(&sum_rem_us);
+    return static_cast<unsigned int>(sum / n);
+}
+
+unsigned int LatencyHistogram::percentile(int p) const
+{
+    // buckets are read one by one while other threads may add samples,
+    // so count them here instead of trusting the sample counter
+    unsigned int copy[BUCKETS];
+    unsigned int total = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        copy[i] = static_cast<unsigned int>(atomic_get(&buckets[i]));
+        total += copy[i];
+    }
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    unsigned long long rank = (static_cast<unsigned long long>(total) * p + 99) / 100;
+    unsigned long long seen = 0;
+    for (int i = 0; i < BUCKETS - 1; ++i)
+    {
+        seen += copy[i];
+        if (seen >= rank)
+        {
+            return 1u << i;
+        }
+    }
+    return max();
+}
+
+unsigned int LatencyHistogram::max() const
+{
+    return static_cast<unsigned int>(atomic_get(&max_us));
+}
+
+PDFStats::PDFStats(PDFStats *parent_stats)
+: parent(parent_stats)
+{
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+    {
+        counters[i] = 0;
+    }
+    for (int i = 0; i < GAUGE_COUNT; ++i)
+    {
+        gauges[i] = 0;
+    }
+}
+
+void PDFStats::add_latency(StatsStage stage, long long usec)
+{
+    stages[stage].add(usec);
+    if (parent)
+    {
+        parent->add_latency(stage, usec);
+    }
+}
+
+void PDFStats::inc(StatsCounter counter, int delta)
+{
+    g_atomic_int_add(&counters[counter], delta);
+    if (parent)
+    {
+        parent->inc(counter, delta);
+    }
+}
+
+unsigned int PDFStats::get_counter(StatsCounter counter) const
+{
+    return static_cast<unsigned int>(atomic_get(&counters[counter]));
+}
+
+void PDFStats::add_gauge(StatsGauge gauge, int delta)
+{
+    g_atomic_int_add(&gauges[gauge], delta);
+    if (parent)
+    {
+        parent->add_gauge(gauge, delta);
+    }
+}
+
+int PDFStats::get_gauge(StatsGauge gauge) const
+{
+    return atomic_get(&gauges[gauge]);
+}
+
+// the fields of a histogram, as get() and dump() name them
+static const char * HISTOGRAM_FIELDS[] =
+{
+    "count",
+    "mean",
+    "p50",
+    "p90",
+    "p99",
+    "max"
+};
+
+static bool get_histogram_field(const LatencyHistogram &h,
+                                const char *field,
+                                unsigned int &value)
+{
+    if (strcmp(field, "count") == 0)
+    {
+        value = h.count();
+    }
+    else if (strcmp(field, "mean") == 0)
+    {
+        value = h.mean();
+    }
+    else if (strcmp(field, "p50") == 0)
+    {
+        value = h.percentile(50);
+    }
+    else if (strcmp(field, "p90") == 0)
+    {
+        value = h.percentile(90);
+    }
+    else if (strcmp(field, "p99") == 0)
+    {
+        value = h.percentile(99);
+    }
+    else if (strcmp(field, "max") == 0)
+    {
+        value = h.max();
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool PDFStats::get(const std::string &name, std::string &value) const
+{
+    char buf[16];
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+    {
+        if (name == COUNTER_NAMES[i])
+        {
+            snprintf(buf, sizeof(buf), "%u", get_counter(static_cast<StatsCounter>(i)));
+            value = buf;
+            return true;
+        }
+    }
+
+    for (int i = 0; i < GAUGE_COUNT; ++i)
+    {
+        if (name == GAUGE_NAMES[i])
+        {
+            snprintf(buf, sizeof(buf), "%d", get_gauge(static_cast<StatsGauge>(i)));
+            value = buf;
+            return true;
+        }
+    }
+
+    std::string::size_type dot = name.find('.');
+    if (dot == std::string::npos)
+    {
+        return false;
+    }
+
+    std::string stage(name, 0, dot);
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        unsigned int field = 0;
+        if (stage == STAGE_NAMES[i] &&
+            get_histogram_field(stages[i], name.c_str() + dot + 1, field))
+        {
+            snprintf(buf, sizeof(buf), "%u", field);
+            value = buf;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PDFStats::dump(const char *scope, std::string &output) const
+{
+    char buf[256];
+    int fields = sizeof(HISTOGRAM_FIELDS) / sizeof(HISTOGRAM_FIELDS[0]);
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        for (int j = 0; j < fields; ++j)
+        {
+            unsigned int value = 0;
+            get_histogram_field(stages[i], HISTOGRAM_FIELDS[j], value);
+            snprintf(buf, sizeof(buf), "%s.%s.%s %u\n",
+                     scope, STAGE_NAMES[i], HISTOGRAM_FIELDS[j], value);
+            output += buf;
+        }
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+    {
+        snprintf(buf, sizeof(buf), "%s.%s %u\n",
+                 scope, COUNTER_NAMES[i],
+                 get_counter(static_cast<StatsCounter>(i)));
+        output += buf;
+    }
+
+    for (int i = 0; i < GAUGE_COUNT; ++i)
+    {
+        snprintf(buf, sizeof(buf), "%s.%s %d\n",
+                 scope, GAUGE_NAMES[i],
+                 get_gauge(static_cast<StatsGauge>(i)));
+        output += buf;
+    }
+}
+
+void PDFStats::reset()
+{
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        stages[i].reset();
+    }
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+    {
+        g_atomic_int_set(&counters[i], 0);
+    }
+}
+
+const char * PDFStats::stage_name(StatsStage stage)
+{
+    return STAGE_NAMES[stage];
+}
+
+const char * PDFStats::counter_name(StatsCounter counter)
+{
+    return COUNTER_NAMES[counter];
+}
+
+const char * PDFStats::gauge_name(StatsGauge gauge)
+{
+    return GAUGE_NAMES[gauge];
+}
+
+long long PDFStats::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+}
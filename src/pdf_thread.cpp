@@ -25,6 +25,7 @@
  */
 
 #include "pdf_thread.h"
+#include "pdf_stats.h"
 
 namespace pdf
 {
@@ -63,21 +64,36 @@ gpointer Thread::non_static_thread_func()
         Task *task = 0;
         {
             ScopeMutex m(&queue_mutex);
-            while (task_queue.empty() &&
-                   thread_cmd == CMD_NONE)
+            while (thread_cmd == CMD_NONE)
             {
-                queue_cond.wait(queue_mutex.get_gmutex());
+                // Get task from task queue
+                long long wait_usec = 0;
+                task = take_ready_task(wait_usec);
+                if (task != 0)
+                {
+                    break;
+                }
+
+                if (task_queue.empty())
+                {
+                    queue_cond.wait(queue_mutex.get_gmutex());
+                }
+                else
+                {
+                    // only deferred tasks, sleep until the first is due
+                    queue_cond.timed_wait(queue_mutex.get_gmutex(), wait_usec);
+                }
             }
 
             if (thread_cmd != CMD_NONE)
             {
+                if (task != 0)
+                {
+                    task_queue.push_front(task);
+                }
                 break;
             }
 
-            // Get task from task queue
-            task = task_queue.front();
-            task_queue.pop_front();
-
             // About executing task, update running_task variable.
             ScopeMutex r(&running_task_mutex);
             running_task = task;
@@ -104,6 +120,36 @@ gpointer Thread::non_static_thread_func()
     return 0;
 }
 
+Task* Thread::take_ready_task(long long &wait_usec)
+{
+    long long now = 0;
+    wait_usec = 0;
+    for (TaskQueueIter idx = task_queue.begin(); idx != task_queue.end(); ++idx)
+    {
+        long long not_before = (*idx)->get_not_before();
+        if (not_before != 0)
+        {
+            if (now == 0)
+            {
+                now = PDFStats::now();
+            }
+            if (not_before > now)
+            {
+                if (wait_usec == 0 || not_before - now < wait_usec)
+                {
+                    wait_usec = not_before - now;
+                }
+                continue;
+            }
+        }
+
+        Task *task = *idx;
+        task_queue.erase(idx);
+        return task;
+    }
+    return 0;
+}
+
 void Thread::cancel_tasks(void* user_data)
 {
     clear_all(user_data);
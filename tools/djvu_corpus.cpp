@@ -0,0 +1,783 @@
+/*
+ * File Name: djvu_corpus.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+// Offline generator of synthetic DjVu documents for benchmarking.
+//
+// Pages are drawn as PBM (bitonal) or PGM (photo) images, or both for the
+// compound pages of the mixed layer, from a seeded pseudo random
+// generator, so the same arguments always produce the same document. The djvulibre command line encoders do the actual encoding:
+//   cjb2      bitonal pages (JB2)
+//   c44       photo pages (IW44)
+//   djvumake  compound pages, a JB2 mask over an IW44 background
+//   djvm      bundling of the single page files
+//   djvmcvt   conversion to an indirect document
+//   djvused   hidden text layer and outline
+// They are looked up in $PATH, or in $DJVULIBRE_BIN if it is set.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+enum PageLayer
+{
+    LAYER_BITONAL = 0,
+    LAYER_PHOTO,
+    LAYER_MIXED
+};
+
+struct CorpusOptions
+{
+    int         pages;
+    int         dpi;
+    int         width;          // page width in pixels (of one page in 2pg)
+    int         height;
+    PageLayer   layer;
+    int         words;          // hidden text words per page
+    int         outline_depth;
+    int         outline_fanout;
+    bool        indirect;
+    bool        two_pages;
+    unsigned    seed;
+    bool        keep_temp;
+    std::string output;
+
+    CorpusOptions()
+        : pages(10)
+        , dpi(300)
+        , width(0)
+        , height(0)
+        , layer(LAYER_BITONAL)
+        , words(250)
+        , outline_depth(0)
+        , outline_fanout(8)
+        , indirect(false)
+        , two_pages(false)
+        , seed(1)
+        , keep_temp(false)
+    {
+    }
+};
+
+/// Small linear congruential generator. Deliberately not rand(), so the
+/// corpus does not depend on the libc the tool is built against.
+class Random
+{
+public:
+    explicit Random(unsigned seed) : state(seed * 2654435761u + 1) {}
+
+    unsigned next()
+    {
+        state = state * 1103515245u + 12345u;
+        return (state >> 8) & 0xffffff;
+    }
+
+    int range(int low, int high)
+    {
+        if (high <= low)
+        {
+            return low;
+        }
+        return low + static_cast<int>(next() % static_cast<unsigned>(high - low + 1));
+    }
+
+private:
+    unsigned state;
+};
+
+/// One word of the synthetic text, in DjVu coordinates (origin bottom left).
+struct Word
+{
+    int xmin, ymin, xmax, ymax;
+    std::string text;
+};
+
+struct Line
+{
+    int xmin, ymin, xmax, ymax;
+    std::vector<Word> words;
+};
+
+/// Grey8 canvas, converted to PBM or PGM when the page is written.
+class Canvas
+{
+public:
+    Canvas(int w, int h) : width(w), height(h), pixels(w * h, 255) {}
+
+    void fill_rect(int x, int y, int w, int h, unsigned char value)
+    {
+        for (int j = y; j < y + h && j < height; ++j)
+        {
+            if (j < 0)
+            {
+                continue;
+            }
+            for (int i = x; i < x + w && i < width; ++i)
+            {
+                if (i >= 0)
+                {
+                    pixels[j * width + i] = value;
+                }
+            }
+        }
+    }
+
+    bool write_pbm(const std::string & path) const
+    {
+        FILE *fp = fopen(path.c_str(), "wb");
+        if (fp == 0)
+        {
+            return false;
+        }
+        fprintf(fp, "P4\n%d %d\n", width, height);
+        int row_bytes = (width + 7) / 8;
+        std::vector<unsigned char> row(row_bytes);
+        for (int y = 0; y < height; ++y)
+        {
+            std::fill(row.begin(), row.end(), 0);
+            const unsigned char *src = &pixels[y * width];
+            for (int x = 0; x < width; ++x)
+            {
+                if (src[x] < 128)
+                {
+                    row[x >> 3] |= 0x80 >> (x & 7);
+                }
+            }
+            fwrite(&row[0], 1, row_bytes, fp);
+        }
+        return fclose(fp) == 0;
+    }
+
+    bool write_pgm(const std::string & path) const
+    {
+        FILE *fp = fopen(path.c_str(), "wb");
+        if (fp == 0)
+        {
+            return false;
+        }
+        fprintf(fp, "P5\n%d %d\n255\n", width, height);
+        fwrite(&pixels[0], 1, pixels.size(), fp);
+        return fclose(fp) == 0;
+    }
+
+    int width;
+    int height;
+    std::vector<unsigned char> pixels;
+};
+
+const char * const WORDS[] =
+{
+    "the", "of", "and", "page", "render", "document", "cache", "zoom",
+    "reader", "chapter", "section", "figure", "table", "index", "margin",
+    "bitmap", "outline", "library", "volume", "paragraph", "between",
+    "through", "without", "another", "number", "example", "question"
+};
+const int WORDS_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+std::string int_to_str(int value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", value);
+    return buf;
+}
+
+std::string tool_path(const char *name)
+{
+    const char *dir = getenv("DJVULIBRE_BIN");
+    if (dir == 0 || *dir == 0)
+    {
+        return name;
+    }
+    return std::string(dir) + "/" + name;
+}
+
+bool run(const std::vector<std::string> & argv)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0)
+    {
+        std::vector<char *> args;
+        for (size_t i = 0; i < argv.size(); ++i)
+        {
+            args.push_back(const_cast<char *>(argv[i].c_str()));
+        }
+        args.push_back(0);
+        execvp(args[0], &args[0]);
+        fprintf(stderr, "Cannot execute %s\n", args[0]);
+        _exit(127);
+    }
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "Command failed: %s\n", argv[0].c_str());
+        return false;
+    }
+    return true;
+}
+
+/// Escape a string for the djvused s-expression syntax.
+std::string quote(const std::string & str)
+{
+    std::string ret("\"");
+    for (size_t i = 0; i < str.size(); ++i)
+    {
+        if (str[i] == '"' || str[i] == '\\')
+        {
+            ret += '\\';
+        }
+        ret += str[i];
+    }
+    ret += '"';
+    return ret;
+}
+
+/// Lay out text lines on one column, draw the glyph blobs onto the canvas
+/// and record the words for the hidden text layer.
+void draw_column(Canvas & canvas, Random & rnd, int x0, int col_width,
+                 int dpi, int words, std::vector<Line> & lines)
+{
+    int margin   = dpi * 3 / 4;
+    int x_height = dpi / 12 > 4 ? dpi / 12 : 4;
+    int leading  = x_height * 2;
+    int left     = x0 + margin;
+    int right    = x0 + col_width - margin;
+    int y        = margin;          // top-down, converted when recorded
+
+    Line line;
+    line.xmin = left;
+    int x = left;
+    for (int i = 0; i < words && y + leading < canvas.height - margin; ++i)
+    {
+        const char *text = WORDS[rnd.next() % WORDS_COUNT];
+        int glyph_w = x_height * 2 / 3 + 1;
+        int w = glyph_w * static_cast<int>(strlen(text));
+        if (x + w > right)
+        {
+            if (!line.words.empty())
+            {
+                lines.push_back(line);
+            }
+            line.words.clear();
+            x = left;
+            y += leading;
+            if (y + leading >= canvas.height - margin)
+            {
+                break;
+            }
+        }
+
+        // Draw the glyphs as small blobs with an ascender now and then, so
+        // JB2 has shapes to match and content detection sees real strokes.
+        for (size_t c = 0; c < strlen(text); ++c)
+        {
+            int gx = x + static_cast<int>(c) * glyph_w;
+            int asc = (rnd.next() % 4 == 0) ? x_height / 2 : 0;
+            canvas.fill_rect(gx, y - asc, glyph_w - 1, x_height + asc, 0);
+        }
+
+        Word word;
+        word.xmin = x;
+        word.xmax = x + w;
+        word.ymin = canvas.height - (y + x_height);
+        word.ymax = canvas.height - (y - x_height / 2);
+        word.text = text;
+        line.words.push_back(word);
+        x += w + glyph_w;
+    }
+    if (!line.words.empty())
+    {
+        lines.push_back(line);
+    }
+
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        Line & l = lines[i];
+        l.xmin = l.words.front().xmin;
+        l.xmax = l.words.back().xmax;
+        l.ymin = l.words.front().ymin;
+        l.ymax = l.words.front().ymax;
+    }
+}
+
+void draw_photo(Canvas & canvas, Random & rnd)
+{
+    int cx = rnd.range(0, canvas.width);
+    int cy = rnd.range(0, canvas.height);
+    int scale = canvas.width + canvas.height;
+    for (int y = 0; y < canvas.height; ++y)
+    {
+        for (int x = 0; x < canvas.width; ++x)
+        {
+            int d = abs(x - cx) + abs(y - cy);
+            int v = 40 + (d * 200) / scale + static_cast<int>(rnd.next() % 16);
+            canvas.pixels[y * canvas.width + x] = static_cast<unsigned char>(v > 255 ? 255 : v);
+        }
+    }
+}
+
+/// Background of a compound page: slightly uneven paper with a figure in
+/// the lower half, at the resolution of the canvas.
+void draw_background(Canvas & canvas, Random & rnd)
+{
+    for (size_t i = 0; i < canvas.pixels.size(); ++i)
+    {
+        canvas.pixels[i] = static_cast<unsigned char>(232 + rnd.next() % 16);
+    }
+
+    Canvas figure(canvas.width * 2 / 3, canvas.height / 3);
+    draw_photo(figure, rnd);
+    int x0 = (canvas.width - figure.width) / 2;
+    int y0 = canvas.height / 2 + (canvas.height / 2 - figure.height) / 2;
+    for (int y = 0; y < figure.height; ++y)
+    {
+        memcpy(&canvas.pixels[(y0 + y) * canvas.width + x0],
+               &figure.pixels[y * figure.width], figure.width);
+    }
+}
+
+void write_text_layer(FILE *script, int page, int width, int height,
+                      const std::vector<Line> & lines)
+{
+    fprintf(script, "select %d\nset-txt\n", page);
+    fprintf(script, "(page 0 0 %d %d\n", width, height);
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        const Line & l = lines[i];
+        fprintf(script, " (line %d %d %d %d\n", l.xmin, l.ymin, l.xmax, l.ymax);
+        for (size_t j = 0; j < l.words.size(); ++j)
+        {
+            const Word & w = l.words[j];
+            fprintf(script, "  (word %d %d %d %d %s)\n",
+                    w.xmin, w.ymin, w.xmax, w.ymax, quote(w.text).c_str());
+        }
+        fprintf(script, " )\n");
+    }
+    fprintf(script, ")\n.\n");
+}
+
+/// Write the outline nodes of [first, last) at the given depth. Nodes are
+/// spread evenly over the pages so deep outlines still point everywhere.
+void write_outline_level(FILE *script, int depth, int max_depth, int fanout,
+                         int first, int last, const std::string & prefix)
+{
+    int span = last - first;
+    for (int i = 0; i < fanout; ++i)
+    {
+        int page = first + (span * i) / fanout;
+        std::string title = prefix + int_to_str(i + 1);
+        fprintf(script, "%*s(%s \"#%d\"", depth, "",
+                quote((depth == 0 ? "Chapter " : "Section ") + title).c_str(), page + 1);
+        if (depth + 1 < max_depth)
+        {
+            fprintf(script, "\n");
+            int child_last = first + (span * (i + 1)) / fanout;
+            if (child_last <= page)
+            {
+                child_last = page + 1;
+            }
+            write_outline_level(script, depth + 1, max_depth, fanout,
+                                page, child_last, title + ".");
+        }
+        fprintf(script, ")\n");
+    }
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] output.djvu\n"
+        "  --pages N            number of pages (default 10)\n"
+        "  --dpi N              resolution (default 300)\n"
+        "  --size WxH           page size in pixels (default A5 at dpi)\n"
+        "  --layer TYPE         bitonal, photo or mixed, compound text over a\n"
+        "                       photo background (default bitonal)\n"
+        "  --words N            hidden text words per page, 0 for none (default 250)\n"
+        "  --outline-depth N    outline levels, 0 for none (default 0)\n"
+        "  --outline-fanout N   children per outline node (default 8)\n"
+        "  --indirect           write an indirect document (index + components)\n"
+        "  --2pg                two page spreads, output name gets a 2pg suffix\n"
+        "  --seed N             random seed (default 1)\n"
+        "  --keep               keep the intermediate files\n",
+        prog);
+}
+
+bool parse_args(int argc, char *argv[], CorpusOptions & opts)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--pages" && has_value)
+        {
+            opts.pages = atoi(argv[++i]);
+        }
+        else if (arg == "--dpi" && has_value)
+        {
+            opts.dpi = atoi(argv[++i]);
+        }
+        else if (arg == "--size" && has_value)
+        {
+            if (sscanf(argv[++i], "%dx%d", &opts.width, &opts.height) != 2)
+            {
+                return false;
+            }
+        }
+        else if (arg == "--layer" && has_value)
+        {
+            std::string layer = argv[++i];
+            if (layer == "bitonal")     opts.layer = LAYER_BITONAL;
+            else if (layer == "photo")  opts.layer = LAYER_PHOTO;
+            else if (layer == "mixed")  opts.layer = LAYER_MIXED;
+            else return false;
+        }
+        else if (arg == "--words" && has_value)
+        {
+            opts.words = atoi(argv[++i]);
+        }
+        else if (arg == "--outline-depth" && has_value)
+        {
+            opts.outline_depth = atoi(argv[++i]);
+        }
+        else if (arg == "--outline-fanout" && has_value)
+        {
+            opts.outline_fanout = atoi(argv[++i]);
+        }
+        else if (arg == "--seed" && has_value)
+        {
+            opts.seed = static_cast<unsigned>(strtoul(argv[++i], 0, 10));
+        }
+        else if (arg == "--indirect")
+        {
+            opts.indirect = true;
+        }
+        else if (arg == "--2pg")
+        {
+            opts.two_pages = true;
+        }
+        else if (arg == "--keep")
+        {
+            opts.keep_temp = true;
+        }
+        else if (arg[0] != '-' && opts.output.empty())
+        {
+            opts.output = arg;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (opts.output.empty() || opts.pages <= 0 || opts.dpi <= 0 ||
+        opts.outline_fanout <= 0)
+    {
+        return false;
+    }
+    if (opts.width <= 0 || opts.height <= 0)
+    {
+        // A5 at the requested resolution.
+        opts.width  = opts.dpi * 583 / 100;
+        opts.height = opts.dpi * 827 / 100;
+    }
+
+    // The plugin recognizes spreads by the file name.
+    const std::string suffix = "2pg.djvu";
+    if (opts.two_pages &&
+        (opts.output.size() < suffix.size() ||
+         opts.output.compare(opts.output.size() - suffix.size(), suffix.size(), suffix) != 0))
+    {
+        std::string base = opts.output;
+        if (base.size() > 5 && base.compare(base.size() - 5, 5, ".djvu") == 0)
+        {
+            base.erase(base.size() - 5);
+        }
+        opts.output = base + "." + suffix;
+    }
+    return true;
+}
+
+/// Encode a bitonal canvas to a JB2 page.
+bool encode_jb2(const Canvas & canvas, const std::string & image,
+                const std::string & djvu, const std::string & dpi)
+{
+    if (!canvas.write_pbm(image))
+    {
+        perror(image.c_str());
+        return false;
+    }
+    std::vector<std::string> encode;
+    encode.push_back(tool_path("cjb2"));
+    encode.push_back("-dpi");
+    encode.push_back(dpi);
+    encode.push_back("-losslevel");
+    encode.push_back("100");
+    encode.push_back(image);
+    encode.push_back(djvu);
+    return run(encode);
+}
+
+/// Encode a grey canvas to an IW44 page.
+bool encode_iw44(const Canvas & canvas, const std::string & image,
+                 const std::string & djvu, const std::string & dpi)
+{
+    if (!canvas.write_pgm(image))
+    {
+        perror(image.c_str());
+        return false;
+    }
+    std::vector<std::string> encode;
+    encode.push_back(tool_path("c44"));
+    encode.push_back("-dpi");
+    encode.push_back(dpi);
+    encode.push_back(image);
+    encode.push_back(djvu);
+    return run(encode);
+}
+
+/// Generate the document. Every intermediate file is added to temps,
+/// also when it fails, so that the caller can remove them.
+bool generate(const CorpusOptions & opts, const std::string & tmp_dir,
+              std::vector<std::string> & temps)
+{
+    // background resolution of the compound pages, a divisor of the page
+    static const int BG_REDUCTION = 3;
+
+    Random rnd(opts.seed);
+    int page_width = opts.two_pages ? opts.width * 2 : opts.width;
+    std::string dpi = int_to_str(opts.dpi);
+
+    std::string script_path = tmp_dir + "/corpus.djvused";
+    temps.push_back(script_path);
+    FILE *script = fopen(script_path.c_str(), "w");
+    if (script == 0)
+    {
+        perror(script_path.c_str());
+        return false;
+    }
+
+    std::vector<std::string> bundle;
+    bundle.push_back(tool_path("djvm"));
+    bundle.push_back("-c");
+    std::string bundled = opts.indirect ? tmp_dir + "/bundled.djvu" : opts.output;
+    bundle.push_back(bundled);
+    if (opts.indirect)
+    {
+        temps.push_back(bundled);
+    }
+
+    for (int page = 0; page < opts.pages; ++page)
+    {
+        bool photo = (opts.layer == LAYER_PHOTO);
+        Canvas canvas(page_width, opts.height);
+        std::vector<Line> lines;
+        if (photo)
+        {
+            draw_photo(canvas, rnd);
+        }
+        else
+        {
+            int columns = opts.two_pages ? 2 : 1;
+            for (int c = 0; c < columns; ++c)
+            {
+                std::vector<Line> column;
+                draw_column(canvas, rnd, c * opts.width, opts.width, opts.dpi,
+                            opts.words / columns, column);
+                lines.insert(lines.end(), column.begin(), column.end());
+            }
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "p%05d", page + 1);
+        std::string base = tmp_dir + "/" + name;
+        std::string djvu = base + ".djvu";
+        temps.push_back(djvu);
+
+        bool ok = false;
+        if (photo)
+        {
+            temps.push_back(base + ".pgm");
+            ok = encode_iw44(canvas, base + ".pgm", djvu, dpi);
+        }
+        else if (opts.layer == LAYER_BITONAL)
+        {
+            temps.push_back(base + ".pbm");
+            ok = encode_jb2(canvas, base + ".pbm", djvu, dpi);
+        }
+        else
+        {
+            // the text is the JB2 mask, the background goes to IW44 at a
+            // reduced resolution, as in scanned compound pages
+            Canvas background((page_width + BG_REDUCTION - 1) / BG_REDUCTION,
+                              (opts.height + BG_REDUCTION - 1) / BG_REDUCTION);
+            draw_background(background, rnd);
+
+            std::string mask = base + "_mask.djvu";
+            std::string bg   = base + "_bg.djvu";
+            temps.push_back(base + ".pbm");
+            temps.push_back(mask);
+            temps.push_back(base + "_bg.pgm");
+            temps.push_back(bg);
+            ok = encode_jb2(canvas, base + ".pbm", mask, dpi) &&
+                 encode_iw44(background, base + "_bg.pgm", bg,
+                             int_to_str(opts.dpi / BG_REDUCTION));
+            if (ok)
+            {
+                std::vector<std::string> make;
+                make.push_back(tool_path("djvumake"));
+                make.push_back(djvu);
+                make.push_back("INFO=" + int_to_str(page_width) + "," +
+                               int_to_str(opts.height) + "," + dpi);
+                make.push_back("Sjbz=" + mask);
+                make.push_back("BG44=" + bg);
+                ok = run(make);
+            }
+        }
+        if (!ok)
+        {
+            fclose(script);
+            return false;
+        }
+        bundle.push_back(djvu);
+
+        if (!lines.empty())
+        {
+            write_text_layer(script, page + 1, page_width, opts.height, lines);
+        }
+        if ((page + 1) % 100 == 0)
+        {
+            fprintf(stderr, "%d/%d pages\n", page + 1, opts.pages);
+        }
+    }
+
+    if (opts.outline_depth > 0)
+    {
+        fprintf(script, "select\nset-outline\n(bookmarks\n");
+        write_outline_level(script, 0, opts.outline_depth, opts.outline_fanout,
+                            0, opts.pages, "");
+        fprintf(script, ")\n.\n");
+    }
+    fprintf(script, "save\n");
+    fclose(script);
+
+    if (!run(bundle))
+    {
+        return false;
+    }
+
+    std::vector<std::string> annotate;
+    annotate.push_back(tool_path("djvused"));
+    annotate.push_back(bundled);
+    annotate.push_back("-f");
+    annotate.push_back(script_path);
+    if (!run(annotate))
+    {
+        return false;
+    }
+
+    if (opts.indirect)
+    {
+        // djvmcvt wants the directory of the components and the index name.
+        std::string dir = opts.output;
+        std::string index = opts.output;
+        size_t slash = opts.output.rfind('/');
+        if (slash == std::string::npos)
+        {
+            dir = ".";
+        }
+        else
+        {
+            dir.erase(slash);
+            index.erase(0, slash + 1);
+        }
+        std::vector<std::string> convert;
+        convert.push_back(tool_path("djvmcvt"));
+        convert.push_back("-i");
+        convert.push_back(bundled);
+        convert.push_back(dir);
+        convert.push_back(index);
+        if (!run(convert))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}   // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    CorpusOptions opts;
+    if (!parse_args(argc, argv, opts))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char tmp_dir[] = "/tmp/djvu-corpus-XXXXXX";
+    if (mkdtemp(tmp_dir) == 0)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    std::vector<std::string> temps;
+    bool ok = generate(opts, tmp_dir, temps);
+    if (!opts.keep_temp)
+    {
+        // whether the generation got through or not
+        for (size_t i = 0; i < temps.size(); ++i)
+        {
+            unlink(temps[i].c_str());
+        }
+        rmdir(tmp_dir);
+    }
+    else
+    {
+        fprintf(stderr, "Intermediate files kept in %s\n", tmp_dir);
+    }
+
+    if (!ok)
+    {
+        return 1;
+    }
+    printf("%s\n", opts.output.c_str());
+    return 0;
+}
@@ -0,0 +1,891 @@
+/*
+ * File Name: uds_replay.cpp
+ */
+
+/*
+ * This file is part of uds-plugin-pdf.
+ *
+ * uds-plugin-pdf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * uds-plugin-pdf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2008 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+// Stub UDS host that replays a call trace recorded with UDS_PLUGIN_RECORD
+// (see plugin_impl/call_recorder.h) against a plugin build, and compares
+// the events it gets back with the ones in the trace.
+//
+// Calls are issued with the original timing (optionally scaled), events
+// are collected from the plugin threads and handled on the main thread,
+// like UDS does. The report lists the latency of every render request in
+// the trace and in the replay, that of its preview if it got one, and
+// where the order of the events differs.
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "plugin_inc.h"
+
+namespace
+{
+
+// How long the plugin must send nothing before the replay is over
+const long long SETTLE_USEC = 500000;
+
+long long now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// UDSString as provided by the host.
+class HostString : public UDSString
+{
+public:
+    explicit HostString(const std::string & str = std::string())
+        : value(str)
+    {
+        assign     = assign_impl;
+        get_buffer = get_buffer_impl;
+        size       = size_impl;
+    }
+
+private:
+    static UDSString * assign_impl(UDSString *thiz, const char *src)
+    {
+        static_cast<HostString *>(thiz)->value = src ? src : "";
+        return thiz;
+    }
+
+    static const char * get_buffer_impl(const UDSString *thiz)
+    {
+        return static_cast<const HostString *>(thiz)->value.c_str();
+    }
+
+    static unsigned int size_impl(const UDSString *thiz)
+    {
+        return static_cast<const HostString *>(thiz)->value.size();
+    }
+
+    std::string value;
+};
+
+template <typename T>
+T * query(IPluginUnknown *object, const char *name)
+{
+    void *ptr = 0;
+    HostString id(name);
+    if (object == 0 || object->query_interface(object, &id, &ptr) != PLUGIN_OK)
+    {
+        fprintf(stderr, "Interface %s not supported\n", name);
+        exit(1);
+    }
+    return static_cast<T *>(ptr);
+}
+
+/// One line of the trace.
+struct Record
+{
+    long long time;
+    std::string call;
+    std::vector<std::string> args;
+
+    int arg_int(size_t i) const
+    {
+        return i < args.size() ? atoi(args[i].c_str()) : 0;
+    }
+
+    float arg_float(size_t i, float fallback) const
+    {
+        return i < args.size() ? static_cast<float>(atof(args[i].c_str())) : fallback;
+    }
+};
+
+/// An event as received from (or recorded for) the plugin.
+struct Event
+{
+    long long   time;
+    std::string name;
+    unsigned long id;
+    int         status;
+    IPluginUnknown *result;
+
+    std::string key() const
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), ":%lu", id);
+        return name + buf;
+    }
+};
+
+/// Timing of one request/event pair, keyed by refId or search id. A
+/// render request may get a preview before the event that completes it.
+struct Request
+{
+    std::string desc;
+    long long   issued;
+    long long   preview;
+    long long   done;
+    int         status;
+
+    Request() : issued(-1), preview(-1), done(-1), status(-1) {}
+};
+
+typedef std::map<std::string, Request> Requests;
+
+bool read_trace(const char *path, std::vector<Record> & records)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == 0)
+    {
+        perror(path);
+        return false;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        line[strcspn(line, "\r\n")] = 0;
+
+        // split on every tab, an empty argument is still an argument
+        std::vector<std::string> fields;
+        char *field = line;
+        for (;;)
+        {
+            char *tab = strchr(field, '\t');
+            if (tab == 0)
+            {
+                fields.push_back(field);
+                break;
+            }
+            *tab = 0;
+            fields.push_back(field);
+            field = tab + 1;
+        }
+        if (fields.size() < 2 || fields[1].empty())
+        {
+            continue;
+        }
+
+        Record rec;
+        rec.time = atoll(fields[0].c_str());
+        rec.call = fields[1];
+        rec.args.assign(fields.begin() + 2, fields.end());
+        records.push_back(rec);
+    }
+    fclose(fp);
+    return true;
+}
+
+std::string event_key(const std::string & name, const std::string & id)
+{
+    return name + ":" + id;
+}
+
+/// Collect the request timing and the event order from the trace itself.
+void analyse_trace(const std::vector<Record> & records,
+                   Requests & requests,
+                   std::vector<std::string> & order)
+{
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const Record & rec = records[i];
+        if (rec.call == "render" && rec.args.size() >= 5)
+        {
+            Request & req = requests[event_key("EVENT_RENDERING_END", rec.args[4])];
+            req.desc = rec.args[0];
+            req.issued = rec.time;
+        }
+        else if ((rec.call == "request_search_next" || rec.call == "request_search_all")
+                 && !rec.args.empty())
+        {
+            Request & req = requests[event_key("search", rec.args[0])];
+            req.desc = rec.call;
+            req.issued = rec.time;
+        }
+        else if (rec.call == "event" && !rec.args.empty())
+        {
+            std::string name = rec.args[0];
+            std::string id = rec.args.size() > 1 ? rec.args[1] : "0";
+            order.push_back(event_key(name, id));
+
+            std::string key = (name == "EVENT_RENDERING_END") ?
+                event_key(name, id) : event_key("search", id);
+            Requests::iterator it = requests.find(key);
+            bool preview = rec.args.size() > 3 && rec.args[3] == "1";
+            if (it != requests.end() && preview)
+            {
+                if (it->second.preview < 0)
+                {
+                    it->second.preview = rec.time;
+                }
+            }
+            else if (it != requests.end() && it->second.done < 0)
+            {
+                it->second.done = rec.time;
+                it->second.status = rec.args.size() > 2 ? atoi(rec.args[2].c_str()) : 0;
+            }
+        }
+    }
+}
+
+/// Length of the longest common subsequence, to tell how many events
+/// arrived in the same relative order.
+size_t common_order(const std::vector<std::string> & a,
+                    const std::vector<std::string> & b)
+{
+    std::vector<size_t> prev(b.size() + 1, 0), cur(b.size() + 1, 0);
+    for (size_t i = 1; i <= a.size(); ++i)
+    {
+        for (size_t j = 1; j <= b.size(); ++j)
+        {
+            if (a[i - 1] == b[j - 1])
+            {
+                cur[j] = prev[j - 1] + 1;
+            }
+            else
+            {
+                cur[j] = std::max(prev[j], cur[j - 1]);
+            }
+        }
+        prev.swap(cur);
+    }
+    return prev[b.size()];
+}
+
+void print_percentiles(const char *title, std::vector<long long> values)
+{
+    if (values.empty())
+    {
+        printf("%-8s no samples\n", title);
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    printf("%-8s n=%-5u p50=%7.1fms p90=%7.1fms p99=%7.1fms max=%7.1fms\n",
+           title, static_cast<unsigned>(n),
+           values[n / 2] / 1000.0,
+           values[(n * 9) / 10] / 1000.0,
+           values[(n * 99) / 100] / 1000.0,
+           values[n - 1] / 1000.0);
+}
+
+class Host
+{
+public:
+    Host()
+        : library(0)
+        , doc(0)
+        , view(0)
+        , start(0)
+    {
+        pthread_mutex_init(&mutex, 0);
+    }
+
+    bool load(const char *plugin_path)
+    {
+        void *handle = dlopen(plugin_path, RTLD_NOW | RTLD_LOCAL);
+        if (handle == 0)
+        {
+            fprintf(stderr, "%s\n", dlerror());
+            return false;
+        }
+        CreateLibFunc create =
+            reinterpret_cast<CreateLibFunc>(dlsym(handle, "create_plugin_library"));
+        if (create == 0)
+        {
+            fprintf(stderr, "No create_plugin_library in %s\n", plugin_path);
+            return false;
+        }
+        library = create();
+        return library != 0;
+    }
+
+    /// Issue one recorded call. Returns false for calls the host does not
+    /// know how to replay, they are reported but otherwise skipped.
+    bool replay(const Record & rec, const std::string & document)
+    {
+        const std::string & c = rec.call;
+        if (c == "create_plugin_library")
+        {
+            // Done by load().
+        }
+        else if (c == "open")
+        {
+            create_document();
+            HostString path(document.empty() ? (rec.args.empty() ? "" : rec.args[0]) : document);
+            PluginStatus ret = query<IPluginDocument>(doc, "IPluginDocument")->open(doc, &path);
+            if (ret != PLUGIN_OK)
+            {
+                fprintf(stderr, "Cannot open %s (%d)\n", path.get_buffer(&path), ret);
+                exit(1);
+            }
+        }
+        else if (c == "create_view")
+        {
+            create_document();
+            view = query<IPluginDocument>(doc, "IPluginDocument")->create_view(doc);
+            IPluginEventBroadcaster *events =
+                query<IPluginEventBroadcaster>(view, "IPluginEventBroadcaster");
+            unsigned long id = 0;
+            events->add_event_receiver(view, EVENT_RENDERING_END, on_event, this, &id);
+        }
+        else if (c == "close" && doc)
+        {
+            query<IPluginDocument>(doc, "IPluginDocument")->close(doc);
+        }
+        else if (c == "set_display_size" && view)
+        {
+            query<IPluginViewSettings>(view, "IPluginViewSettings")->set_display_size(
+                view, rec.arg_int(0), rec.arg_int(1));
+        }
+        else if (c == "set_DPI" && view)
+        {
+            query<IPluginViewSettings>(view, "IPluginViewSettings")->set_DPI(
+                view, rec.arg_int(0));
+        }
+        else if (c == "set_color_depth" && view)
+        {
+            query<IPluginViewSettings>(view, "IPluginViewSettings")->set_color_depth(
+                view, rec.arg_int(0));
+        }
+        else if (c == "set_memory_limit" && view && !rec.args.empty())
+        {
+            query<IPluginRender>(view, "IPluginRender")->set_memory_limit(
+                view, static_cast<unsigned int>(strtoul(rec.args[0].c_str(), 0, 10)));
+        }
+        else if (c == "render" && view && rec.args.size() >= 5)
+        {
+            HostString anchor(rec.args[0]);
+            // traces recorded before the area was logged render whole pages
+            RenderArea area = {rec.arg_float(5, 0.0f), rec.arg_float(6, 0.0f),
+                               rec.arg_float(7, 1.0f), rec.arg_float(8, 1.0f)};
+            unsigned int ref_id = static_cast<unsigned int>(strtoul(rec.args[4].c_str(), 0, 10));
+            issue(event_key("EVENT_RENDERING_END", rec.args[4]), rec.args[0]);
+            query<IPluginRender>(view, "IPluginRender")->render(
+                view, &anchor, rec.arg_int(1),
+                render_settings(static_cast<float>(atof(rec.args[2].c_str())), rec.arg_int(3)),
+                &area, ref_id);
+        }
+        else if (c == "get_cover_page" && view)
+        {
+            int width = rec.arg_int(0), height = rec.arg_int(1);
+            std::vector<unsigned char> buf(width * height);
+            PluginBitmapAttributes cover = {width, height, &buf[0], width};
+            query<IPluginView>(view, "IPluginView")->get_cover_page(view, width, height, &cover);
+        }
+        else if (c == "get_original_size" && view && !rec.args.empty())
+        {
+            HostString anchor(rec.args[0]);
+            unsigned int width = 0, height = 0;
+            query<IPluginRender>(view, "IPluginRender")->get_original_size(
+                view, &anchor, &width, &height);
+        }
+        else if (c == "get_page_content_area" && view && !rec.args.empty())
+        {
+            HostString anchor(rec.args[0]);
+            RenderArea area;
+            query<IPluginRender>(view, "IPluginRender")->get_page_content_area(
+                view, &anchor, &area);
+        }
+        else if ((c == "request_search_next" || c == "request_search_all") && doc)
+        {
+            bool next = (c == "request_search_next");
+            size_t base = next ? 2 : 1;
+            if (rec.args.size() < base + 4)
+            {
+                return false;
+            }
+            IPluginDocSearch *search = query<IPluginDocSearch>(doc, "IPluginDocSearch");
+            IPluginUnknown *criteria = search->create_search_criteria(doc);
+            IPluginSearchCriteria *setter =
+                query<IPluginSearchCriteria>(criteria, "IPluginSearchCriteria");
+            HostString text(rec.args[base]);
+            setter->set_search_text(criteria, &text);
+            setter->set_case_sensitive(criteria, rec.arg_int(base + 1) ? PLUGIN_TRUE : PLUGIN_FALSE);
+            setter->set_match_whole_word(criteria, rec.arg_int(base + 2) ? PLUGIN_TRUE : PLUGIN_FALSE);
+            setter->set_forward(criteria, rec.arg_int(base + 3) ? PLUGIN_TRUE : PLUGIN_FALSE);
+
+            unsigned int id = static_cast<unsigned int>(rec.arg_int(0));
+            issue(event_key("search", rec.args[0]), c);
+            if (next)
+            {
+                HostString from(rec.args[1]);
+                search->request_search_next(doc, criteria, &from, id);
+            }
+            else
+            {
+                search->request_search_all(doc, criteria, id);
+            }
+            criteria->release(criteria);
+        }
+        else if (c == "abort_search" && doc)
+        {
+            query<IPluginDocSearch>(doc, "IPluginDocSearch")->abort_search(
+                doc, static_cast<unsigned int>(rec.arg_int(0)));
+        }
+        else if (c == "request_marker_trees" && doc)
+        {
+            query<IPluginDocMarker>(doc, "IPluginDocMarker")->request_marker_trees(
+                doc, static_cast<unsigned int>(rec.arg_int(0)));
+        }
+        else if (c == "set_attribute" && doc && rec.args.size() >= 2)
+        {
+            HostString key(rec.args[0]), value(rec.args[1]);
+            query<IPluginDocAttributes>(doc, "IPluginDocAttributes")->set_attribute(
+                doc, &key, &value);
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /// Print the plugin's own statistics, if it has them.
+    void print_statistics()
+    {
+        void *ptr = 0;
+        HostString id("IPluginDocStatistics");
+        if (doc == 0 || doc->query_interface(doc, &id, &ptr) != PLUGIN_OK)
+        {
+            return;
+        }
+        IPluginDocStatistics *stats = static_cast<IPluginDocStatistics *>(ptr);
+        HostString output;
+        if (stats->dump_statistics(doc, &output) == PLUGIN_OK)
+        {
+            printf("\nPlugin statistics (us):\n%s", output.get_buffer(&output));
+        }
+    }
+
+    /// Handle the events received so far on the main thread.
+    void dispatch()
+    {
+        std::vector<Event> pending;
+        pthread_mutex_lock(&mutex);
+        pending.swap(incoming);
+        pthread_mutex_unlock(&mutex);
+
+        for (size_t i = 0; i < pending.size(); ++i)
+        {
+            Event & e = pending[i];
+            order.push_back(e.key());
+
+            char id[32];
+            snprintf(id, sizeof(id), "%lu", e.id);
+            std::string key = (e.name == "EVENT_RENDERING_END") ?
+                event_key(e.name, id) : event_key("search", id);
+            Requests::iterator it = requests.find(key);
+            if (it != requests.end() && e.name == "EVENT_RENDERING_END")
+            {
+                // UDS can't tell a preview from the final page, every
+                // event but the last one for the refId was a preview
+                if (it->second.done >= 0 && it->second.preview < 0)
+                {
+                    it->second.preview = it->second.done;
+                }
+                it->second.done = e.time - start;
+                it->second.status = e.status;
+            }
+            else if (it != requests.end() && it->second.done < 0)
+            {
+                it->second.done = e.time - start;
+                it->second.status = e.status;
+            }
+
+            if (e.name == "EVENT_RENDERING_END")
+            {
+                // Keep a few pages around like UDS does, their bitmaps
+                // stay locked in the plugin cache while we hold them.
+                if (e.result)
+                {
+                    results.push_back(e.result);
+                }
+                while (results.size() > 3)
+                {
+                    results.front()->release(results.front());
+                    results.pop_front();
+                }
+            }
+            else if (e.result)
+            {
+                e.result->release(e.result);
+            }
+        }
+    }
+
+    size_t outstanding() const
+    {
+        size_t count = 0;
+        for (Requests::const_iterator it = requests.begin(); it != requests.end(); ++it)
+        {
+            if (it->second.done < 0)
+            {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    void shutdown()
+    {
+        while (!results.empty())
+        {
+            results.front()->release(results.front());
+            results.pop_front();
+        }
+        for (Settings::iterator it = settings.begin(); it != settings.end(); ++it)
+        {
+            it->second->release(it->second);
+        }
+        if (view)
+        {
+            view->release(view);
+        }
+        if (doc)
+        {
+            doc->release(doc);
+        }
+        if (library)
+        {
+            library->release(library);
+        }
+    }
+
+public:
+    IPluginUnknown  *library;
+    IPluginUnknown  *doc;
+    IPluginUnknown  *view;
+    long long       start;
+    Requests        requests;
+    std::vector<std::string> order;
+
+private:
+    void create_document()
+    {
+        if (doc)
+        {
+            return;
+        }
+        IPluginLibrary *lib = query<IPluginLibrary>(library, "IPluginLibrary");
+        doc = lib->create_document(library);
+        IPluginEventBroadcaster *events =
+            query<IPluginEventBroadcaster>(doc, "IPluginEventBroadcaster");
+        unsigned long id = 0;
+        events->add_event_receiver(doc, EVENT_SEARCH_END, on_event, this, &id);
+        events->add_event_receiver(doc, EVENT_SEARCH_ABORTED, on_event, this, &id);
+        events->add_event_receiver(doc, EVENT_MARKER_READY, on_event, this, &id);
+    }
+
+    void issue(const std::string & key, const std::string & desc)
+    {
+        Request & req = requests[key];
+        req = Request();
+        req.desc = desc;
+        req.issued = now_usec() - start;
+    }
+
+    IPluginUnknown * render_settings(float zoom, int rotation)
+    {
+        std::pair<float, int> key(zoom, rotation);
+        Settings::iterator it = settings.find(key);
+        if (it != settings.end())
+        {
+            return it->second;
+        }
+
+        IPluginUnknown *obj = query<IPluginRender>(view, "IPluginRender")->create_render_settings(view);
+        query<IPluginZoom>(obj, "IPluginZoom")->set_zoom_factor(obj, zoom);
+        query<IPluginRotation>(obj, "IPluginRotation")->set_rotation(
+            obj, static_cast<PluginRotationDegree>(rotation));
+        settings[key] = obj;
+        return obj;
+    }
+
+    static void on_event(IPluginUnknown *sender, unsigned long handler_id,
+                         const PluginEvent plugin_event, void *user_data,
+                         const PluginEventAttrs *plugin_data)
+    {
+        Host *host = static_cast<Host *>(user_data);
+        Event e;
+        e.time   = now_usec();
+        e.id     = 0;
+        e.status = 0;
+        e.result = 0;
+        switch (plugin_event)
+        {
+        case EVENT_RENDERING_END:
+            e.name   = "EVENT_RENDERING_END";
+            e.id     = plugin_data->render_end.rid;
+            e.status = plugin_data->render_end.status;
+            e.result = plugin_data->render_end.result;
+            break;
+        case EVENT_SEARCH_END:
+        case EVENT_SEARCH_ABORTED:
+            e.name   = plugin_event == EVENT_SEARCH_END ? "EVENT_SEARCH_END" : "EVENT_SEARCH_ABORTED";
+            e.id     = plugin_data->search_end.search_id;
+            e.result = plugin_data->search_end.result;
+            break;
+        case EVENT_MARKER_READY:
+            e.name   = "EVENT_MARKER_READY";
+            e.result = plugin_data->marker_ready.result;
+            break;
+        default:
+            return;
+        }
+
+        pthread_mutex_lock(&host->mutex);
+        host->incoming.push_back(e);
+        pthread_mutex_unlock(&host->mutex);
+    }
+
+private:
+    typedef std::map<std::pair<float, int>, IPluginUnknown *> Settings;
+
+    pthread_mutex_t             mutex;
+    std::vector<Event>          incoming;   ///< Filled by the plugin threads.
+    std::deque<IPluginUnknown *> results;
+    Settings                    settings;
+};
+
+void report(const Requests & recorded, const Host & host,
+            const std::vector<std::string> & recorded_order)
+{
+    printf("%-24s %-32s %10s %10s %10s %10s %10s\n", "request", "target",
+           "trace", "replay", "delta", "pv trace", "pv replay");
+    std::vector<long long> before, after, before_preview, after_preview;
+    for (Requests::const_iterator it = recorded.begin(); it != recorded.end(); ++it)
+    {
+        const Request & r = it->second;
+        Requests::const_iterator found = host.requests.find(it->first);
+        if (found == host.requests.end())
+        {
+            continue;
+        }
+        const Request & p = found->second;
+        long long lat_r = (r.done >= 0 && r.issued >= 0) ? r.done - r.issued : -1;
+        long long lat_p = (p.done >= 0 && p.issued >= 0) ? p.done - p.issued : -1;
+        if (lat_r >= 0)
+        {
+            before.push_back(lat_r);
+        }
+        if (lat_p >= 0)
+        {
+            after.push_back(lat_p);
+        }
+        long long pv_r = (r.preview >= 0 && r.issued >= 0) ? r.preview - r.issued : -1;
+        long long pv_p = (p.preview >= 0 && p.issued >= 0) ? p.preview - p.issued : -1;
+        if (pv_r >= 0)
+        {
+            before_preview.push_back(pv_r);
+        }
+        if (pv_p >= 0)
+        {
+            after_preview.push_back(pv_p);
+        }
+
+        char col_r[32] = "-", col_p[32] = "-", col_d[32] = "";
+        if (lat_r >= 0) snprintf(col_r, sizeof(col_r), "%.1fms", lat_r / 1000.0);
+        if (lat_p >= 0) snprintf(col_p, sizeof(col_p), "%.1fms", lat_p / 1000.0);
+        if (lat_r >= 0 && lat_p >= 0)
+        {
+            snprintf(col_d, sizeof(col_d), "%+.1fms", (lat_p - lat_r) / 1000.0);
+        }
+        if (r.status != p.status && r.done >= 0 && p.done >= 0)
+        {
+            strncat(col_d, " status!", sizeof(col_d) - strlen(col_d) - 1);
+        }
+        char col_pr[32] = "-", col_pp[32] = "-";
+        if (pv_r >= 0) snprintf(col_pr, sizeof(col_pr), "%.1fms", pv_r / 1000.0);
+        if (pv_p >= 0) snprintf(col_pp, sizeof(col_pp), "%.1fms", pv_p / 1000.0);
+        printf("%-24s %-32.32s %10s %10s %10s %10s %10s\n",
+               it->first.c_str(), r.desc.c_str(), col_r, col_p, col_d, col_pr, col_pp);
+    }
+
+    printf("\nLatency\n");
+    print_percentiles("trace", before);
+    print_percentiles("replay", after);
+
+    printf("\nPreview latency\n");
+    print_percentiles("trace", before_preview);
+    print_percentiles("replay", after_preview);
+
+    size_t common = common_order(recorded_order, host.order);
+    printf("\nEvent order: %u recorded, %u replayed, %u in the same relative order\n",
+           static_cast<unsigned>(recorded_order.size()),
+           static_cast<unsigned>(host.order.size()),
+           static_cast<unsigned>(common));
+    size_t n = std::min(recorded_order.size(), host.order.size());
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (recorded_order[i] != host.order[i])
+        {
+            printf("First difference at event #%u: trace %s, replay %s\n",
+                   static_cast<unsigned>(i), recorded_order[i].c_str(), host.order[i].c_str());
+            break;
+        }
+    }
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] plugin.so trace.txt\n"
+        "  --speed F       replay F times faster than recorded (default 1)\n"
+        "  --asap          issue the calls without waiting\n"
+        "  --document P    open P instead of the recorded document\n"
+        "  --timeout S     seconds to wait for outstanding events (default 30)\n",
+        prog);
+}
+
+}   // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    double speed = 1.0;
+    bool asap = false;
+    int timeout = 30;
+    std::string document;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--speed" && i + 1 < argc)
+        {
+            speed = atof(argv[++i]);
+        }
+        else if (arg == "--asap")
+        {
+            asap = true;
+        }
+        else if (arg == "--document" && i + 1 < argc)
+        {
+            document = argv[++i];
+        }
+        else if (arg == "--timeout" && i + 1 < argc)
+        {
+            timeout = atoi(argv[++i]);
+        }
+        else if (arg[0] != '-')
+        {
+            files.push_back(argv[i]);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (files.size() != 2 || speed <= 0.0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Record> records;
+    if (!read_trace(files[1], records) || records.empty())
+    {
+        fprintf(stderr, "Empty or unreadable trace %s\n", files[1]);
+        return 1;
+    }
+
+    Requests recorded;
+    std::vector<std::string> recorded_order;
+    analyse_trace(records, recorded, recorded_order);
+
+    Host host;
+    if (!host.load(files[0]))
+    {
+        return 1;
+    }
+
+    host.start = now_usec();
+    long long first = records.front().time;
+    unsigned skipped = 0;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const Record & rec = records[i];
+        if (rec.call == "event")
+        {
+            continue;
+        }
+
+        // Wait for the recorded moment, handling events meanwhile.
+        long long due = host.start + static_cast<long long>((rec.time - first) / speed);
+        while (!asap && now_usec() < due)
+        {
+            host.dispatch();
+            long long left = due - now_usec();
+            usleep(static_cast<useconds_t>(std::max(0LL, std::min(left, 2000LL))));
+        }
+        host.dispatch();
+
+        if (!host.replay(rec, document))
+        {
+            ++skipped;
+        }
+    }
+
+    // a preview is followed by the final page for the same refId, so
+    // wait until the plugin has been quiet for a while as well
+    long long deadline = now_usec() + timeout * 1000000LL;
+    long long quiet_since = now_usec();
+    size_t seen = host.order.size();
+    while (now_usec() < deadline &&
+           (host.outstanding() > 0 || now_usec() - quiet_since < SETTLE_USEC))
+    {
+        host.dispatch();
+        if (host.order.size() != seen)
+        {
+            seen = host.order.size();
+            quiet_since = now_usec();
+        }
+        usleep(2000);
+    }
+    host.dispatch();
+
+    report(recorded, host, recorded_order);
+    host.print_statistics();
+    if (skipped)
+    {
+        printf("%u calls could not be replayed\n", skipped);
+    }
+    size_t missing = host.outstanding();
+    if (missing)
+    {
+        printf("%u requests did not complete within %d seconds\n",
+               static_cast<unsigned>(missing), timeout);
+    }
+
+    host.shutdown();
+    return missing ? 2 : 0;
+}